@@ -0,0 +1,291 @@
+/**
+ * Cheap-8: a chip-8 emulator
+ *
+ * File: c8block.c
+ * License: DWYW - "Do Whatever You Want"
+ *
+ * Cache of pre-decoded basic blocks and an execution engine that runs
+ * a whole block per dispatch
+ */
+
+#include "c8block.h"
+
+/**
+ * Just like g_disasmem in c8comp.c the cache is indexed directly by an
+ * address of the first opcode in a block so finding a block for current
+ * PC is a single load
+ *
+ * Cache belongs to a single core at a time (g_blockCacheCore) and is reset
+ * whenever the engine is run on some other core
+ */
+static Block *g_blockCache[MEMORY_SIZE];
+static const C8core *g_blockCacheCore = NULL;
+
+// Returns non zero if a given opcode has to be the last one in a block
+BYTE isBlockTerminator(BYTE opidx) {
+	switch (opidx) {
+	case OP_RETURN:
+	case OP_JUMP:
+	case OP_CALL_SUBR:
+	case OP_SKIP_EQ:
+	case OP_SKIP_NEQ:
+	case OP_SKIP_EQ_REG:
+	case OP_SKIP_NEQ_REG:
+	case OP_JUMP_FROM_V0:
+	case OP_SKIP_KPRESS:
+	case OP_SKIP_NKPRESS:
+	case OP_WAIT_KEY:
+	case OP_SET_BCD:
+	case OP_DUMP_REGS:
+	case OP_CALL_MCR:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Removes a block that starts at a given address from cache
+static inline void dropBlock(WORD addr) {
+	free(g_blockCache[addr]);
+	g_blockCache[addr] = NULL;
+}
+
+// Copies a single opcode into a fused form of a block as is
+static inline BlockInstr *appendFused(Block *block, const BlockInstr *instr) {
+	BlockInstr *fused = &block->fused[block->fusedLength++];
+	*fused = *instr;
+	return fused;
+}
+
+/** fuseBlock
+ *
+ * @param core
+ *  Pointer to C8core struct representing a chip-8 system core
+ * @param block
+ *  Block with already decoded opcodes
+ * @description:
+ *  Builds a fused form of a block replacing these sequences with fused handlers:
+ *      6XNN + 6YNN         (loading coordinates)
+ *      ANNN + DXYN         (drawing a sprite)
+ *      7X01 + 3XNN + 1NNN  (counting loop, jump is a tail)
+ *      FX33 + FX65         (printing a number, load is a tail)
+ */
+static void fuseBlock(C8core *core, Block *block) {
+	block->fusedLength = 0;
+	block->tail = 0;
+	block->tailSkipPC = 0;
+
+	// Tail is the opcode right after a block (if it's there at all)
+	const DecodedOpcode *tail = NULL;
+	if (block->end + 1 < MEMORY_SIZE)
+		tail = decodeOpcode(GET_WORD(core->memory[block->end], core->memory[block->end + 1]));
+
+	for (BYTE i = 0; i < block->length; i++) {
+		const BlockInstr *instr = &block->instrs[i];
+		const BlockInstr *next = i + 1 < block->length ? &block->instrs[i + 1] : NULL;
+		BlockInstr *fused = appendFused(block, instr);
+
+		if (next != NULL && instr->opidx == OP_SET_CONST && next->opidx == OP_SET_CONST) {
+			fused->handler = handle_FUSED_SET_CONST_PAIR;
+			fused->span = 2;
+			fused->yParam = next->xParam;
+			fused->nParam = instr->nParam | (next->nParam << 8);
+			i++;
+		} else if (next != NULL && instr->opidx == OP_SET_IDX && next->opidx == OP_DRAW) {
+			fused->handler = handle_FUSED_SET_IDX_DRAW;
+			fused->span = 2;
+			fused->xParam = next->xParam;
+			fused->yParam = next->yParam;
+			fused->nParam = instr->nParam | (next->nParam << 12);
+			i++;
+		} else if (next != NULL && i + 2 == block->length && tail != NULL
+				&& instr->opidx == OP_ADD_CONST && instr->nParam == 1
+				&& next->opidx == OP_SKIP_EQ && next->xParam == instr->xParam
+				&& tail->opidx == OP_JUMP && tail->nParam >= MEMORY_RANGE_PROGRAM_MIN
+				&& tail->nParam != block->end + OPCODE_SIZE) {
+			fused->handler = handle_FUSED_COUNT_LOOP;
+			fused->span = 2;
+			fused->yParam = (BYTE) next->nParam;
+			fused->nParam = tail->nParam;
+			block->tail = 1;
+			block->tailSkipPC = block->end + OPCODE_SIZE;
+			i++;
+		} else if (next == NULL && tail != NULL
+				&& instr->opidx == OP_SET_BCD && tail->opidx == OP_LOAD_REGS) {
+			fused->handler = handle_FUSED_BCD_LOAD;
+			fused->yParam = (BYTE) tail->xParam;
+			fused->nParam = block->end;
+			block->tail = 1;
+			block->tailSkipPC = block->end;
+		}
+	}
+}
+
+/** buildBlock
+ *
+ * @param core
+ *  Pointer to C8core struct representing a chip-8 system core
+ * @param addr
+ *  Address of the first opcode in a block
+ * @description:
+ *  Decodes opcodes starting from addr until a block terminator, block
+ *  length limit or the end of memory, saves the block in cache and marks
+ *  memory pages it occupies as code pages
+ */
+static Block *buildBlock(C8core *core, WORD addr) {
+	Block *block = (Block*) malloc(sizeof(Block));
+	if (block == NULL)
+		return NULL;
+
+	WORD pc = addr;
+	block->start = addr;
+	block->length = 0;
+	block->hits = 0;
+	block->native = NULL;
+
+	while (block->length < BLOCK_MAX_LENGTH && pc + 1 < MEMORY_SIZE) {
+		const DecodedOpcode *decoded = decodeOpcode(GET_WORD(core->memory[pc], core->memory[pc + 1]));
+		BlockInstr *instr = &block->instrs[block->length];
+
+		instr->handler = decoded->handler;
+		instr->opidx = decoded->opidx;
+		instr->span = 1;
+		instr->xParam = (BYTE) decoded->xParam;
+		instr->yParam = (BYTE) decoded->yParam;
+		instr->nParam = decoded->nParam;
+
+		block->length += 1;
+		pc += OPCODE_SIZE;
+
+		if (isBlockTerminator(decoded->opidx))
+			break;
+	}
+
+	block->end = pc;
+	fuseBlock(core, block);
+
+	// Tail opcode is a part of a block as far as memory writes are concerned
+	WORD last = block->tail ? block->end + 1 : block->end - 1;
+
+	block->pages = 0;
+	for (WORD page = MEMORY_PAGE(block->start); page <= MEMORY_PAGE(last); page++)
+		block->pages |= MEMORY_PAGE_BIT(page);
+
+	core->codePages |= block->pages;
+	g_blockCache[addr] = block;
+
+	return block;
+}
+
+// Returns a cached block starting at a given address (decodes it if needed)
+// or NULL if there's not a single whole opcode at that address
+Block *getBlock(C8core *core, WORD addr) {
+	if (addr + 1 >= MEMORY_SIZE)
+		return NULL;
+
+	if (g_blockCache[addr] != NULL)
+		return g_blockCache[addr];
+
+	return buildBlock(core, addr);
+}
+
+/** invalidateDirtyBlocks
+ *
+ * @param core
+ *  Pointer to C8core struct representing a chip-8 system core
+ * @description:
+ *  Drops every cached block that occupies a page marked in core->dirtyPages
+ *  Since block (with it's tail) is never longer than a page and an opcode only
+ *  blocks starting in a dirty page or in a page right before it have to be looked at
+ */
+void invalidateDirtyBlocks(C8core *core) {
+	QWORD dirty = core->dirtyPages;
+	core->dirtyPages = 0;
+
+	for (WORD page = 0; page < MEMORY_PAGE_COUNT; page++) {
+		if (!(dirty & MEMORY_PAGE_BIT(page)))
+			continue;
+
+		int from = (page << MEMORY_PAGE_SHIFT) - (BLOCK_MAX_LENGTH + 1) * OPCODE_SIZE;
+		int to = (page + 1) << MEMORY_PAGE_SHIFT;
+
+		for (int addr = from < 0 ? 0 : from; addr < to; addr++) {
+			if (g_blockCache[addr] != NULL && (g_blockCache[addr]->pages & MEMORY_PAGE_BIT(page)))
+				dropBlock(addr);
+		}
+	}
+}
+
+// Drops all cached blocks and assigns the cache to a given core
+void resetBlockCache(const C8core *core) {
+	for (WORD addr = 0; addr < MEMORY_SIZE; addr++) {
+		if (g_blockCache[addr] != NULL)
+			dropBlock(addr);
+	}
+
+	g_blockCacheCore = core;
+}
+
+// Makes sure that cache belongs to a given core and resets it otherwise
+void claimBlockCache(C8core *core) {
+	if (g_blockCacheCore == core)
+		return;
+
+	resetBlockCache(core);
+	core->codePages = 0;
+	core->dirtyPages = 0;
+}
+
+// Frees memory allocated for cached blocks
+void destroyBlockCache() {
+	resetBlockCache(NULL);
+}
+
+/** runCyclesBlocks
+ *
+ * @param core
+ *  Pointer to C8core struct representing a chip-8 system core
+ * @param cycles
+ *  Number of opcodes to run
+ * @description:
+ *  Runs pre-decoded blocks from cache one after another, the only per-block
+ *  overhead is a dirty pages check and a cache lookup by PC
+ *  Blocks are run in their fused form unless it doesn't fit into a given
+ *  number of cycles, in which case the last block is run opcode by opcode
+ *  and is cut short
+ *  Opcodes that don't fit into a block (i.e. at the very end of memory) are
+ *  run with processOpcode
+ */
+DWORD runCyclesBlocks(C8core *core, DWORD cycles) {
+	DWORD ran = 0;
+
+	claimBlockCache(core);
+
+	while (ran < cycles) {
+		if (core->dirtyPages)
+			invalidateDirtyBlocks(core);
+
+		const Block *block = getBlock(core, core->PC);
+
+		if (block == NULL) {
+			core->opcode = GET_WORD(core->memory[core->PC], core->memory[core->PC + 1]);
+			processOpcode(core);
+			ran += 1;
+			continue;
+		}
+
+		if (block->length + block->tail <= cycles - ran) {
+			ran += runFusedBlock(core, block);
+			continue;
+		}
+
+		DWORD count = block->length;
+		if (count > cycles - ran)
+			count = cycles - ran;
+
+		runBlock(core, block, count);
+		ran += count;
+	}
+
+	return ran;
+}
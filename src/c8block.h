@@ -0,0 +1,95 @@
+/**
+ * Cheap-8: a chip-8 emulator
+ *
+ * File: c8block.h
+ * License: DWYW - "Do Whatever You Want"
+ *
+ * Cache of pre-decoded basic blocks and an execution engine that runs
+ * a whole block per dispatch
+ */
+
+#ifndef _C8BLOCK_H_
+#define _C8BLOCK_H_
+
+#include "opcodes.h"
+
+// Maximum number of opcodes in a single block
+#define BLOCK_MAX_LENGTH		32
+
+// Single pre-decoded opcode within a block
+typedef struct _BlockInstr {
+	OPCODE_HANDLER handler; // Opcode handler
+	BYTE opidx;             // Index of an opcode in OPCODES (of the first one for fused opcodes)
+	BYTE span;              // Number of opcodes it runs (not counting a tail, see Block)
+	BYTE xParam;            // X parameter as passed to a handler
+	BYTE yParam;            // Y parameter as passed to a handler
+	WORD nParam;            // N parameter as passed to a handler
+} BlockInstr;
+
+// Function pointer type for a block compiled into native code (see c8jit.c)
+// Runs the whole block on a given core
+typedef void (*BLOCK_NATIVE)(C8core*);
+
+/* Basic block is a straight run of opcodes that ends with an opcode that
+ * either changes PC (jump, call, return, skip, key wait) or writes into
+ * memory (and therefore could have changed the block itself)
+ *
+ * Each block also has a fused form where common sequences of opcodes are
+ * replaced with a single fused handler (see handle_FUSED_* in opcodes.c)
+ * Last fused opcode might also run a "tail" which is the first opcode of
+ * the next block, PC equals tailSkipPC after a block if the tail didn't run
+ */
+typedef struct _Block {
+	WORD start;             // Address of the first opcode
+	WORD end;               // Address right after the last opcode
+	QWORD pages;            // Memory pages that the block occupies
+	BYTE length;            // Number of opcodes in a block
+	DWORD hits;             // Number of times a block was run (used by JIT to find hot blocks)
+	BLOCK_NATIVE native;    // Native code for a block or NULL if it wasn't compiled
+	BlockInstr instrs[BLOCK_MAX_LENGTH];
+
+	BYTE fusedLength;       // Number of opcodes in a fused form of a block
+	BYTE tail;              // 1 if fused form might run a tail opcode, 0 otherwise
+	WORD tailSkipPC;        // Value of PC after a fused block that didn't run a tail
+	BlockInstr fused[BLOCK_MAX_LENGTH];
+} Block;
+
+// Returns non zero if a given opcode has to be the last one in a block
+BYTE isBlockTerminator(BYTE opidx);
+
+Block *getBlock(C8core *core, WORD addr);
+
+// Runs first count opcodes of a given block with their regular handlers
+static inline void runBlock(C8core *core, const Block *block, DWORD count) {
+	const BlockInstr *instr = block->instrs;
+	for (DWORD i = 0; i < count; i++, instr++) {
+		core->PC += OPCODE_SIZE;
+		instr->handler(core, instr->xParam, instr->yParam, instr->nParam);
+	}
+}
+
+/* Runs a fused form of a whole block and returns number of opcodes run
+ * Caller has to make sure that block->length + block->tail opcodes fit
+ * into it's budget
+ */
+static inline DWORD runFusedBlock(C8core *core, const Block *block) {
+	const BlockInstr *instr = block->fused;
+	for (BYTE i = 0; i < block->fusedLength; i++, instr++) {
+		core->PC += instr->span * OPCODE_SIZE;
+		instr->handler(core, instr->xParam, instr->yParam, instr->nParam);
+	}
+
+	if (block->tail && core->PC != block->tailSkipPC)
+		return block->length + 1;
+
+	return block->length;
+}
+
+void invalidateDirtyBlocks(C8core *core);
+void resetBlockCache(const C8core *core);
+void claimBlockCache(C8core *core);
+void destroyBlockCache();
+
+DWORD runCyclesBlocks(C8core *core, DWORD cycles);
+
+#endif  /* _C8BLOCK_H_ */
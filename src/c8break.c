@@ -0,0 +1,399 @@
+/**
+ * Cheap-8: a chip-8 emulator
+ *
+ * File: c8break.c
+ * License: DWYW - "Do Whatever You Want"
+ *
+ * Breakpoints: compiling break conditions and running a core
+ * until it reaches an address that has a breakpoint
+ *
+ * Conditions are written like C expressions, for example
+ *     V3 == 0x10 && I > 0x300
+ *     [I] != 0 || DT == 0
+ * where [X] is a byte of memory at address X. Values are V0 - VF, I, PC,
+ * SP, DT, ST and numbers (decimal, 0x hex or 0 octal), operators are
+ * == != < <= > >= && || and parentheses
+ *
+ * Grammar (parsed by recursive descent straight into a stack bytecode):
+ *     or      := and ('||' and)*
+ *     and     := compare ('&&' compare)*
+ *     compare := unary (relop unary)?
+ *     unary   := '(' or ')' | '[' value ']' | value
+ */
+
+#include "c8break.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+// State of a condition compiler
+typedef struct _BreakCompiler {
+	const char *src;        // Next character to parse
+	Breakpoint *bp;         // Breakpoint code is emitted into
+	BYTE depth;             // Stack depth when compiled code runs up to this point
+	const char *error;      // Why compilation failed (NULL if it didn't)
+} BreakCompiler;
+
+static void compileOr(BreakCompiler *c);
+
+static void skipSpaces(BreakCompiler *c) {
+	while (isspace((unsigned char) *c->src))
+		c->src++;
+}
+
+// Consumes token if it's the next one in a source
+static BYTE acceptToken(BreakCompiler *c, const char *token) {
+	size_t len = strlen(token);
+
+	skipSpaces(c);
+	if (strncmp(c->src, token, len) != 0)
+		return 0;
+
+	c->src += len;
+	return 1;
+}
+
+// Emits a single instruction and keeps track of a stack depth
+static void emit(BreakCompiler *c, BYTE op, WORD arg) {
+	if (c->error)
+		return;
+
+	if (c->bp->codeLength >= BREAKPOINT_MAX_CODE) {
+		c->error = "condition is too long";
+		return;
+	}
+
+	if (op <= BREAK_OP_ST) {
+		if (++c->depth > BREAKPOINT_MAX_STACK) {
+			c->error = "condition is nested too deep";
+			return;
+		}
+	} else if (op != BREAK_OP_MEM) {
+		c->depth--;
+	}
+
+	c->bp->code[c->bp->codeLength].op = op;
+	c->bp->code[c->bp->codeLength].arg = arg;
+	c->bp->codeLength++;
+}
+
+// Parses a register, a special register or a number
+static void compileValue(BreakCompiler *c) {
+	static const struct {
+		const char *name;
+		BYTE op;
+	} specials[] = {
+		{"PC", BREAK_OP_PC},
+		{"SP", BREAK_OP_SP},
+		{"DT", BREAK_OP_DT},
+		{"ST", BREAK_OP_ST},
+		{"I", BREAK_OP_I}
+	};
+
+	char *end = NULL;
+	unsigned long value;
+
+	skipSpaces(c);
+
+	if (toupper((unsigned char) c->src[0]) == 'V' && isxdigit((unsigned char) c->src[1])
+			&& !isalnum((unsigned char) c->src[2])) {
+		char digit[2] = {c->src[1], 0};
+
+		emit(c, BREAK_OP_REG, (WORD) strtoul(digit, NULL, 16));
+		c->src += 2;
+		return;
+	}
+
+	for (BYTE i = 0; i < sizeof(specials) / sizeof(specials[0]); i++) {
+		size_t len = strlen(specials[i].name);
+
+		if (strncasecmp(c->src, specials[i].name, len) == 0 && !isalnum((unsigned char) c->src[len])) {
+			emit(c, specials[i].op, 0);
+			c->src += len;
+			return;
+		}
+	}
+
+	if (!isdigit((unsigned char) c->src[0])) {
+		c->error = "expected a register or a number";
+		return;
+	}
+
+	value = strtoul(c->src, &end, 0);
+	if (value > 0xFFFF) {
+		c->error = "number is too big";
+		return;
+	}
+
+	emit(c, BREAK_OP_CONST, (WORD) value);
+	c->src = end;
+}
+
+static void compileUnary(BreakCompiler *c) {
+	if (acceptToken(c, "(")) {
+		compileOr(c);
+		if (!c->error && !acceptToken(c, ")"))
+			c->error = "expected ')'";
+	} else if (acceptToken(c, "[")) {
+		compileValue(c);
+		emit(c, BREAK_OP_MEM, 0);
+		if (!c->error && !acceptToken(c, "]"))
+			c->error = "expected ']'";
+	} else {
+		compileValue(c);
+	}
+}
+
+static void compileCompare(BreakCompiler *c) {
+	// Two character operators go first so that '<' doesn't match "<="
+	static const struct {
+		const char *token;
+		BYTE op;
+	} relops[] = {
+		{"==", BREAK_OP_EQ},
+		{"!=", BREAK_OP_NE},
+		{"<=", BREAK_OP_LE},
+		{">=", BREAK_OP_GE},
+		{"<", BREAK_OP_LT},
+		{">", BREAK_OP_GT}
+	};
+
+	compileUnary(c);
+
+	for (BYTE i = 0; i < sizeof(relops) / sizeof(relops[0]) && !c->error; i++) {
+		if (acceptToken(c, relops[i].token)) {
+			compileUnary(c);
+			emit(c, relops[i].op, 0);
+			return;
+		}
+	}
+}
+
+static void compileAnd(BreakCompiler *c) {
+	compileCompare(c);
+	while (!c->error && acceptToken(c, "&&")) {
+		compileCompare(c);
+		emit(c, BREAK_OP_AND, 0);
+	}
+}
+
+static void compileOr(BreakCompiler *c) {
+	compileAnd(c);
+	while (!c->error && acceptToken(c, "||")) {
+		compileAnd(c);
+		emit(c, BREAK_OP_OR, 0);
+	}
+}
+
+/** compileBreakpoint
+ *
+ * @param bp
+ *  Pointer to a Breakpoint struct to fill in
+ * @param addr
+ *  Address of an opcode to break at
+ * @param condition
+ *  Break condition (NULL or empty string for a breakpoint that always breaks)
+ * @param error
+ *  Pointer to where a reason of a failure is stored (can be NULL)
+ * @description:
+ *  Compiles a condition into a bytecode once so that it's not parsed
+ *  again every time execution reaches a breakpoint
+ */
+VM_RESULT compileBreakpoint(Breakpoint *bp, WORD addr, const char *condition, const char **error) {
+	BreakCompiler c = {condition, bp, 0, NULL};
+
+	memset(bp, 0, sizeof(Breakpoint));
+	bp->addr = addr & (MEMORY_SIZE - 1);
+
+	if (condition == NULL)
+		return VM_RESULT_SUCCESS;
+
+	skipSpaces(&c);
+	if (*c.src != 0) {
+		if (strlen(condition) >= BREAKPOINT_CONDITION_SIZE) {
+			c.error = "condition is too long";
+		} else {
+			compileOr(&c);
+			skipSpaces(&c);
+			if (!c.error && *c.src != 0)
+				c.error = "unexpected characters at the end";
+		}
+
+		if (c.error) {
+			if (error)
+				*error = c.error;
+			memset(bp, 0, sizeof(Breakpoint));
+			return VM_RESULT_ERROR;
+		}
+
+		snprintf(bp->condition, BREAKPOINT_CONDITION_SIZE, "%s", condition);
+	}
+
+	return VM_RESULT_SUCCESS;
+}
+
+/** testCondition
+ *
+ * @param bp
+ *  Pointer to a compiled breakpoint
+ * @param core
+ *  Pointer to C8core struct representing a chip-8 system core
+ * @description:
+ *  Runs compiled condition of a breakpoint against a core
+ *  Returns non zero if execution should stop (always for no condition)
+ */
+BYTE testCondition(const Breakpoint *bp, const C8core *core) {
+	DWORD stack[BREAKPOINT_MAX_STACK];
+	BYTE top = 0;
+
+	if (bp->codeLength == 0)
+		return 1;
+
+	for (BYTE i = 0; i < bp->codeLength; i++) {
+		const BreakInstr *instr = &bp->code[i];
+
+		switch (instr->op) {
+		case BREAK_OP_CONST:    stack[top++] = instr->arg; break;
+		case BREAK_OP_REG:      stack[top++] = core->reg[instr->arg & 0x0F]; break;
+		case BREAK_OP_I:        stack[top++] = core->I; break;
+		case BREAK_OP_PC:       stack[top++] = core->PC; break;
+		case BREAK_OP_SP:       stack[top++] = core->SP; break;
+		case BREAK_OP_DT:       stack[top++] = core->tDelay; break;
+		case BREAK_OP_ST:       stack[top++] = core->tSound; break;
+		case BREAK_OP_MEM:      stack[top - 1] = core->memory[stack[top - 1] & (MEMORY_SIZE - 1)]; break;
+		case BREAK_OP_EQ:       top--; stack[top - 1] = stack[top - 1] == stack[top]; break;
+		case BREAK_OP_NE:       top--; stack[top - 1] = stack[top - 1] != stack[top]; break;
+		case BREAK_OP_LT:       top--; stack[top - 1] = stack[top - 1] < stack[top]; break;
+		case BREAK_OP_LE:       top--; stack[top - 1] = stack[top - 1] <= stack[top]; break;
+		case BREAK_OP_GT:       top--; stack[top - 1] = stack[top - 1] > stack[top]; break;
+		case BREAK_OP_GE:       top--; stack[top - 1] = stack[top - 1] >= stack[top]; break;
+		case BREAK_OP_AND:      top--; stack[top - 1] = stack[top - 1] && stack[top]; break;
+		case BREAK_OP_OR:       top--; stack[top - 1] = stack[top - 1] || stack[top]; break;
+		}
+	}
+
+	return stack[0] != 0;
+}
+
+void initBreakpoints(BreakpointSet *set) {
+	memset(set, 0, sizeof(BreakpointSet));
+	set->lastHit = BREAKPOINT_NONE;
+}
+
+// Returns index of a breakpoint at a given address (BREAKPOINT_NONE if there's none)
+BYTE findBreakpoint(const BreakpointSet *set, WORD addr) {
+	addr &= MEMORY_SIZE - 1;
+	if (!BREAKPOINT_MAP_TEST(set->map, addr))
+		return BREAKPOINT_NONE;
+
+	for (BYTE i = 0; i < set->count; i++) {
+		if (set->list[i].addr == addr)
+			return i;
+	}
+
+	return BREAKPOINT_NONE;
+}
+
+/** setBreakpoint
+ *
+ * @param set
+ *  Pointer to a BreakpointSet struct
+ * @param bp
+ *  Pointer to a compiled breakpoint
+ * @description:
+ *  Adds a breakpoint (or replaces one that's at the same address)
+ *  Returns zero if there's no room for another breakpoint
+ */
+BYTE setBreakpoint(BreakpointSet *set, const Breakpoint *bp) {
+	BYTE idx = findBreakpoint(set, bp->addr);
+
+	if (idx == BREAKPOINT_NONE) {
+		if (set->count >= BREAKPOINT_MAX_COUNT)
+			return 0;
+		idx = set->count++;
+	} else if (set->lastHit == idx) {
+		set->lastHit = BREAKPOINT_NONE;
+	}
+
+	set->list[idx] = *bp;
+	set->list[idx].hits = 0;
+	set->map[bp->addr >> 6] |= (QWORD) 1 << (bp->addr & 63);
+
+	return 1;
+}
+
+// Removes a breakpoint at a given address if there is one
+void clearBreakpoint(BreakpointSet *set, WORD addr) {
+	BYTE idx = findBreakpoint(set, addr);
+
+	if (idx == BREAKPOINT_NONE)
+		return;
+
+	addr &= MEMORY_SIZE - 1;
+	set->map[addr >> 6] &= ~((QWORD) 1 << (addr & 63));
+
+	// Last breakpoint takes a place of the removed one
+	set->count--;
+	if (idx != set->count)
+		set->list[idx] = set->list[set->count];
+
+	if (set->lastHit == idx)
+		set->lastHit = BREAKPOINT_NONE;
+	else if (set->lastHit == set->count)
+		set->lastHit = idx;
+}
+
+/** runUntilBreakpoint
+ *
+ * @param core
+ *  Pointer to C8core struct representing a chip-8 system core
+ * @param cycles
+ *  Number of opcodes to run
+ * @param set
+ *  Pointer to a BreakpointSet struct
+ * @description:
+ *  Interpreter that tests a breakpoint bit before every opcode
+ *  and only runs a condition at addresses that have a breakpoint
+ *  Stops right before an opcode a breakpoint hits at or right after
+ *  an opcode that wrote into a watched address (set->hit is set)
+ *  and returns number of opcodes that were run
+ */
+DWORD runUntilBreakpoint(C8core *core, DWORD cycles, BreakpointSet *set) {
+	DWORD ran = 0;
+
+	for (; ran < cycles; ran++) {
+		WORD pc = core->PC;
+
+		// Execution that has stopped at a breakpoint continues
+		// from that same breakpoint so it mustn't stop there again
+		if (set->stepOver) {
+			set->stepOver = 0;
+		} else if (BREAKPOINT_MAP_TEST(set->map, pc)) {
+			BYTE idx = findBreakpoint(set, pc);
+
+			if (testCondition(&set->list[idx], core)) {
+				set->list[idx].hits++;
+				set->totalHits++;
+				set->lastHit = idx;
+				set->hit = 1;
+				break;
+			}
+		}
+
+		core->opcode = GET_WORD(core->memory[pc], core->memory[pc + 1]);
+		processOpcode(core);
+
+#if CORE_WATCHPOINTS
+		if (core->watchHit) {
+			core->watchHit = 0;
+			core->watchPC = pc;
+			core->watchHits++;
+			set->hit = 1;
+			return ran + 1;
+		}
+#endif
+	}
+
+	return ran;
+}
@@ -0,0 +1,106 @@
+/**
+ * Cheap-8: a chip-8 emulator
+ *
+ * File: c8break.h
+ * License: DWYW - "Do Whatever You Want"
+ *
+ * Debugger breakpoints: a bitmap with a bit for every memory address that is
+ * checked before every opcode and break conditions compiled once into
+ * a tiny stack bytecode (memory watchpoints stop execution through here too,
+ * see storeMemory)
+ */
+
+#ifndef _C8BREAK_H_
+#define _C8BREAK_H_
+
+#include "opcodes.h"
+
+// Maximum number of breakpoints set at the same time
+#define BREAKPOINT_MAX_COUNT		16
+
+// Maximum number of bytecode instructions in a compiled condition
+#define BREAKPOINT_MAX_CODE			32
+
+// Maximum depth of a stack a condition is evaluated on
+#define BREAKPOINT_MAX_STACK		8
+
+// Maximum length of a condition source (with terminating zero)
+#define BREAKPOINT_CONDITION_SIZE	64
+
+// Index of a breakpoint that doesn't exist
+#define BREAKPOINT_NONE				0xFF
+
+// Breakpoint bitmap has a bit for every memory address
+#define BREAKPOINT_MAP_SIZE			(MEMORY_SIZE / 64)
+#define BREAKPOINT_MAP_TEST(map, addr) \
+	(((map)[((addr) & (MEMORY_SIZE - 1)) >> 6] >> ((addr) & 63)) & 1)
+
+// Bytecode instructions of a compiled condition
+typedef enum {
+	BREAK_OP_CONST,     // Pushes arg
+	BREAK_OP_REG,       // Pushes register V[arg]
+	BREAK_OP_I,         // Pushes I
+	BREAK_OP_PC,        // Pushes PC
+	BREAK_OP_SP,        // Pushes SP
+	BREAK_OP_DT,        // Pushes delay timer
+	BREAK_OP_ST,        // Pushes sound timer
+	BREAK_OP_MEM,       // Replaces an address on top of the stack with a byte of memory at it
+	BREAK_OP_EQ,        // Comparisons and logical operations pop two values and push 0 or 1
+	BREAK_OP_NE,
+	BREAK_OP_LT,
+	BREAK_OP_LE,
+	BREAK_OP_GT,
+	BREAK_OP_GE,
+	BREAK_OP_AND,
+	BREAK_OP_OR,
+
+	BREAK_OP_COUNT
+} BreakOpcode;
+
+typedef struct _BreakInstr {
+	BYTE op;                // BreakOpcode
+	WORD arg;               // Constant or register number
+} BreakInstr;
+
+typedef struct _Breakpoint {
+	WORD addr;                                  // Address of an opcode execution stops before
+	char condition[BREAKPOINT_CONDITION_SIZE];  // Condition as it was typed (empty if there's none)
+	BreakInstr code[BREAKPOINT_MAX_CODE];       // Compiled condition
+	BYTE codeLength;                            // Number of instructions in code (0 if there's no condition)
+	QWORD hits;                                 // Number of times execution stopped at it
+} Breakpoint;
+
+/* All breakpoints of a VM (owned by the emulation thread)
+ * Nothing is checked while there are no breakpoints, otherwise opcodes
+ * are run one by one and a single bit is tested before each of them
+ * (conditions are only evaluated at addresses that have a breakpoint)
+ */
+typedef struct _BreakpointSet {
+	QWORD map[BREAKPOINT_MAP_SIZE];             // Bit for every address that has a breakpoint
+	Breakpoint list[BREAKPOINT_MAX_COUNT];
+	BYTE count;
+	BYTE stepOver;          // Next opcode is run even if there's a breakpoint at it
+	BYTE hit;               // Execution has just stopped at a breakpoint (or a watchpoint)
+	BYTE lastHit;           // Breakpoint execution stopped at last (BREAKPOINT_NONE if never)
+	QWORD totalHits;        // Number of times execution stopped at any of them
+} BreakpointSet;
+
+void initBreakpoints(BreakpointSet *set);
+VM_RESULT compileBreakpoint(Breakpoint *bp, WORD addr, const char *condition, const char **error);
+BYTE setBreakpoint(BreakpointSet *set, const Breakpoint *bp);
+void clearBreakpoint(BreakpointSet *set, WORD addr);
+BYTE findBreakpoint(const BreakpointSet *set, WORD addr);
+BYTE testCondition(const Breakpoint *bp, const C8core *core);
+DWORD runUntilBreakpoint(C8core *core, DWORD cycles, BreakpointSet *set);
+
+// Returns non zero if any address within [addr, addr + length) has a breakpoint
+static inline BYTE hasBreakpointInRange(const BreakpointSet *set, WORD addr, WORD length) {
+	for (WORD i = 0; i < length; i++) {
+		if (BREAKPOINT_MAP_TEST(set->map, addr + i))
+			return 1;
+	}
+
+	return 0;
+}
+
+#endif  /* _C8BREAK_H_ */
@@ -139,24 +139,19 @@ static void setAsmstr(Instruction *instr) {
  *  in a more human readable format
  */
 VM_RESULT rawToInstruction(WORD raw, Instruction *out) {
-    BYTE idx = getOpcodeIndex(raw);
-    const Opcode *opcode = &OPCODES[idx];
+    const DecodedOpcode *decoded = decodeOpcode(raw);
 
-	VM_ASSERT(opcode == NULL);
+	VM_ASSERT(decoded->opidx >= OPCODE_COUNT);
 
-	WORD xParam = opcode->xParamMask != PARAMETER_UNUSED ? (raw & opcode->xParamMask) >> 8 : PARAMETER_UNUSED;
-	WORD yParam = opcode->yParamMask != PARAMETER_UNUSED ? (raw & opcode->yParamMask) >> 4 : PARAMETER_UNUSED;
-	WORD nParam = opcode->nParamMask != PARAMETER_UNUSED ? (raw & opcode->nParamMask) : PARAMETER_UNUSED;
-
-    out->op = opcode;
-    out->opidx = idx;
+    out->op = &OPCODES[decoded->opidx];
+    out->opidx = decoded->opidx;
     out->raw = raw;
-    out->xParam = xParam;
-    out->yParam = yParam;
-    out->nParam = nParam;
+    out->xParam = decoded->xParam;
+    out->yParam = decoded->yParam;
+    out->nParam = decoded->nParam;
 
     setAsmstr(out);
-    optostrfn[idx](out);
+    optostrfn[decoded->opidx](out);
 
     return VM_RESULT_SUCCESS;
 }
@@ -8,6 +8,7 @@
  */
 
 #include "c8core.h"
+#include "opcodes.h"
 
 /** loadROM
  *
@@ -40,6 +41,36 @@ VM_RESULT loadROM(C8core *core, FILE *ROM) {
 	return VM_RESULT_SUCCESS;
 }
 
+#if CORE_WATCHPOINTS
+/* Only the first watched store of an opcode is recorded (FX55 can write
+ * a few watched addresses at once), whoever runs opcodes one at a time
+ * clears watchHit after every opcode (see runUntilBreakpoint)
+ */
+void recordWatchedStore(C8core *core, WORD addr, BYTE value) {
+	if (core->watchHit)
+		return;
+
+	core->watchHit = 1;
+	core->watchAddr = addr;
+	core->watchOld = core->memory[addr];
+	core->watchNew = value;
+}
+
+void setWatchpoint(C8core *core, WORD addr, WORD length) {
+	for (DWORD i = addr; i < (DWORD) addr + length && i < MEMORY_SIZE; i++) {
+		if (!WATCH_MAP_TEST(core->watchMap, i))
+			core->watchCount++;
+		core->watchMap[i >> 6] |= (QWORD) 1 << (i & 63);
+	}
+}
+
+void clearWatchpoints(C8core *core) {
+	memset(core->watchMap, 0, sizeof(core->watchMap));
+	core->watchCount = 0;
+	core->watchHit = 0;
+}
+#endif
+
 /** initCore
  *
  * @param: C8core **m_core
@@ -54,6 +85,9 @@ VM_RESULT initCore(C8core **m_core, FILE *ROM) {
 
 	VM_ASSERT(core == NULL);
 
+    // Opcode decode table is shared by all cores and is built only once
+    initDecodeTable();
+
     // Zero all the memory first
 	for (WORD i = 0; i < MEMORY_SIZE; i++) {
 		core->memory[i] = 0;
@@ -80,17 +114,31 @@ VM_RESULT initCore(C8core **m_core, FILE *ROM) {
 	core->tSound = 0;
 	core->keypadState = 0;
 
-    // Zero system clock (in ticks)
-    // TODO: When adding ncurses implementation this needs to change
-	core->prevCycleTicks = SDL_GetTicks64();
-	core->prevTimerTicks = SDL_GetTicks64();
-
     // Zero custom flags
 	core->customFlags = 0;
 
+	core->waitState = CORE_WAIT_NONE;
+
+    // Every core starts with the same random sequence
+	core->randState = CORE_RANDOM_SEED;
+
+    // Nothing is decoded yet so no code pages to track
+	core->codePages = 0;
+	core->dirtyPages = 0;
+
+#if CORE_WATCHPOINTS
+    // Nothing is watched until debugger says so
+	clearWatchpoints(core);
+	core->watchPC = 0;
+	core->watchHits = 0;
+#endif
+
     // Clear the screen (set all pixels to black)
-	for (WORD i = 0; i < SCREEN_RESOLUTION_HEIGHT; i++)
+	for (WORD i = 0; i < SCREEN_RESOLUTION_HEIGHT; i++) {
 		core->gfx[i] = 0;
+		core->prevGfx[i] = 0;
+	}
+	core->dirtyRows = 0;
 
     // Load ROM file into memory
 	VM_ASSERT(loadROM(core, ROM) != VM_RESULT_SUCCESS);
@@ -98,6 +146,35 @@ VM_RESULT initCore(C8core **m_core, FILE *ROM) {
 	return VM_RESULT_SUCCESS;
 }
 
+/** collectChangedRows
+ *
+ * @param core
+ *  Pointer to C8core struct representing a chip-8 system core
+ * @description:
+ *  Returns bitmap of screen rows (bit N for row N) whose contents differ
+ *  from what they were at the previous call, only rows that were marked
+ *  dirty by DXYN or 00E0 are compared so it's meant to be called by
+ *  a renderer once per frame to repaint just the rows that changed
+ */
+DWORD collectChangedRows(C8core *core) {
+	DWORD dirty = core->dirtyRows;
+	DWORD changed = 0;
+
+	core->dirtyRows = 0;
+
+	while (dirty) {
+		BYTE row = __builtin_ctz(dirty);
+		dirty &= dirty - 1;
+
+		if (core->gfx[row] != core->prevGfx[row]) {
+			core->prevGfx[row] = core->gfx[row];
+			changed |= 1u << row;
+		}
+	}
+
+	return changed;
+}
+
 // Free memory allocated for core struct
 // No elaborate description needed
 VM_RESULT destroyCore(C8core **m_core) {
@@ -30,23 +30,49 @@
 #define SCREEN_RESOLUTION_WIDTH		64
 #define SCREEN_RESOLUTION_HEIGHT	32
 #define SCREEN_TOTAL_PIXELS			SCREEN_RESOLUTION_WIDTH * SCREEN_RESOLUTION_HEIGHT
+
+// Bitmask with a bit set for every screen row (see dirtyRows in C8core)
+#define SCREEN_ROWS_ALL				((DWORD) ((1ULL << SCREEN_RESOLUTION_HEIGHT) - 1))
 #define SCREEN_ARRAY_SIZE			SCREEN_TOTAL_PIXELS >> 3
 
+// Memory is split into pages of 64 bytes to keep track of guest writes
+// into memory that holds pre-decoded code (i.e. self modifying code)
+#define MEMORY_PAGE_SHIFT			6
+#define MEMORY_PAGE_COUNT			(MEMORY_SIZE >> MEMORY_PAGE_SHIFT)
+#define MEMORY_PAGE(addr)			((addr) >> MEMORY_PAGE_SHIFT)
+#define MEMORY_PAGE_BIT(page)		((QWORD)1 << (page))
+
+// Memory watchpoints (see storeMemory) are built in unless cheap8 is built
+// with WATCHPOINTS=0, in which case guest stores cost nothing extra at all
+#ifndef CORE_WATCHPOINTS
+#define CORE_WATCHPOINTS			1
+#endif
+
+#if CORE_WATCHPOINTS
+#define WATCH_MAP_SIZE				(MEMORY_SIZE / 64)
+#define WATCH_MAP_TEST(map, addr) \
+	(((map)[((addr) & (MEMORY_SIZE - 1)) >> 6] >> ((addr) & 63)) & 1)
+
+// Non zero if any address of a core is watched
+#define CORE_WATCHING(core)			((core)->watchCount != 0)
+#else
+#define CORE_WATCHING(core)			0
+#endif
+
+// Seed of a core's own pseudo random number generator (see CXNN opcode)
+// Core doesn't use rand() so that two cores running the same ROM
+// produce the same random numbers no matter in which order they are run
+#define CORE_RANDOM_SEED			0x2545F491
+
 // Maximum stack depth
 #define STACK_SIZE					16
 
 // Some constants to control execution speed
 // according to (approximately) how it was in the original machine
-// TODO: probably also needs to change after adding ncurses display support
+// CPU_INSTRUCTIONS_PER_SECOND is only a default and can be changed from command line
 #define CPU_INSTRUCTIONS_PER_SECOND	720
 #define TIMER_DECREASE_FREQUENCY	60
 
-// Number of ticks per cycle and formula to get ticks per timer hit
-// given CORE_TICKS_PER_CYCLE
-#define CORE_TICKS_PER_CYCLE	    5
-#define CORE_TICKS_PER_CYCLE_DBG	80
-#define CORE_TICKS_PER_TIMER		CORE_TICKS_PER_CYCLE * (CPU_INSTRUCTIONS_PER_SECOND / TIMER_DECREASE_FREQUENCY)
-
 // Enum to easily access and identifiy register
 // in a register array in the C8core struct
 typedef enum {
@@ -98,6 +124,17 @@ static const unsigned char fontset[FONTSET_SIZE] = {
   0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
+// Wait states i.e. guest idle patterns where a core does nothing but spin
+// until a timer expires or a key is pressed (see updateWaitState in opcodes.c)
+typedef enum {
+	CORE_WAIT_NONE,     // Core is running
+	CORE_WAIT_KEY,      // FX0A while no key is pressed
+	CORE_WAIT_HALT,     // 1NNN jumping onto itself (nothing ever happens again)
+	CORE_WAIT_DELAY,    // FX07 / 3X00 / 1NNN loop polling delay timer until it expires
+
+	CORE_WAIT_STATE_COUNT
+} CoreWaitState;
+
 // Custom flags (mostly unused at this point)
 #define CUSTOM_FLAG_REDRAW_PENDING	1 << 0
 #define CUSTOM_FLAG_BAD_INPUT		1 << 1
@@ -145,6 +182,8 @@ typedef struct _C8core {
 	WORD stack[STACK_SIZE];					// Stack
 
 	QWORD gfx[SCREEN_RESOLUTION_HEIGHT];	// Array of pixels, pixels are either black or white (zero or one)
+	QWORD prevGfx[SCREEN_RESOLUTION_HEIGHT];	// Contents of gfx as of the last collectChangedRows call
+	DWORD dirtyRows;						// Bitmap of gfx rows that were drawn into since then
 
 	BYTE tDelay;							// Delay 60Hz timer
 	BYTE tSound;							// Sound 60Hz timer
@@ -153,10 +192,66 @@ typedef struct _C8core {
 
 	BYTE customFlags;						// Some custom flags that might come in handy (idk)
 
-	Uint64 prevCycleTicks;					// Ticks (milliseconds) since start til previous cycle
-	Uint64 prevTimerTicks;					// Ticks (milliseconds) since last timer decrease
+	DWORD randState;						// State of a pseudo random number generator
+
+	BYTE waitState;							// CoreWaitState as of the last updateWaitState call
+
+	QWORD codePages;						// Bitmap of memory pages that hold pre-decoded code
+	QWORD dirtyPages;						// Bitmap of code pages that were written to since last check
+
+#if CORE_WATCHPOINTS
+	QWORD watchMap[WATCH_MAP_SIZE];			// Bitmap of watched addresses (set from debugger)
+	WORD watchCount;						// Number of watched addresses
+	BYTE watchHit;							// Watched address was written by the opcode being run
+	WORD watchAddr;							// Watched address that was written last
+	BYTE watchOld;							// Value it had before that write
+	BYTE watchNew;							// Value that was written into it
+	WORD watchPC;							// Address of an opcode that wrote it
+	QWORD watchHits;						// Number of opcodes that wrote into watched addresses
+#endif
 } C8core;
 
+/* Has to be called after every guest write into core memory
+ * Marks pages that were written to as dirty if there is pre-decoded
+ * code in them so that this code is decoded again before it's run
+ * Costs a single check for ROMs that never write into code pages
+ */
+static inline void markMemoryWritten(C8core *core, WORD addr, WORD length) {
+	if (!core->codePages)
+		return;
+
+	for (WORD page = MEMORY_PAGE(addr); page <= MEMORY_PAGE(addr + length - 1) && page < MEMORY_PAGE_COUNT; page++)
+		core->dirtyPages |= MEMORY_PAGE_BIT(page) & core->codePages;
+}
+
+#if CORE_WATCHPOINTS
+// Records a write into a watched address (see storeMemory)
+void recordWatchedStore(C8core *core, WORD addr, BYTE value);
+
+// Watches length bytes of memory starting at addr
+void setWatchpoint(C8core *core, WORD addr, WORD length);
+
+// Stops watching all addresses
+void clearWatchpoints(C8core *core);
+#endif
+
+/* Every guest store into core memory goes through here so that watchpoints
+ * see it, costs a single check while nothing is watched (and nothing at all
+ * when watchpoints aren't built in)
+ * Pages a store hits still have to be marked with markMemoryWritten
+ */
+static inline void storeMemory(C8core *core, WORD addr, BYTE value) {
+#if CORE_WATCHPOINTS
+	if (CORE_WATCHING(core) && WATCH_MAP_TEST(core->watchMap, addr))
+		recordWatchedStore(core, addr, value);
+#endif
+
+	core->memory[addr] = value;
+}
+
+// Returns bitmap of screen rows that changed since the last call
+DWORD collectChangedRows(C8core *core);
+
 // Load a ROM file into core memory
 VM_RESULT loadROM(C8core *core, FILE *ROM);
 
@@ -201,24 +201,133 @@ static inline DebuggerWindow *getadj(DebuggerWindow *cur, BYTE side) {
 }
 
 
-/* Following two consts are used to print a "rotating thingy"
+/* Following const is used to print a "rotating thingy"
  * that you can observer when debugger is in "Running" state
  */
 static const char *rot_chars = "//-\\\\|";
-static const char *cur_rot_char = NULL;
+
+/* Time (in ms) each character of a "rotating thingy" stays on screen */
+#define ROTATING_THINGY_PERIOD  100
+
+/* Returns which character of rot_chars should be on screen right now
+ * It depends on time and not on how often it's called so a window
+ * with a "thingy" in it only has to be redrawn when it actually rotates
+ */
+static inline BYTE getRotatingThingyFrame() {
+    return (SDL_GetTicks() / ROTATING_THINGY_PERIOD) % strlen(rot_chars);
+}
 
 /* Prints a "rotating" window at a _current_ cursor position in
  * a given ncurses window
- * Has to be called from a loop for a "thingy" to actually "rotate"
- * Prints next character from rot_chars each call looping through it
  */
 static void printRotatingThingy(WINDOW *win) {
-    if (!cur_rot_char)
-        cur_rot_char = rot_chars;
-    wprintw(win, "%c", (char)*cur_rot_char);
-    cur_rot_char++;
-    if (!(char)*cur_rot_char)
-        cur_rot_char = rot_chars;
+    wprintw(win, "%c", rot_chars[getRotatingThingyFrame()]);
+}
+
+/* ======================== VERSION STAMPS ========================= */
+
+/* Stamps are FNV-1a hashes of whatever a window is drawn from
+ * Hashing a few hundred bytes is a lot cheaper than redrawing
+ * a window so a stamp is computed on every debugger update
+ */
+#define STAMP_INIT      0xCBF29CE484222325ULL
+#define STAMP_PRIME     0x00000100000001B3ULL
+
+static inline QWORD stampBytes(QWORD stamp, const void *data, size_t size) {
+    const BYTE *bytes = (const BYTE*) data;
+    for (size_t i = 0; i < size; i++)
+        stamp = (stamp ^ bytes[i]) * STAMP_PRIME;
+    return stamp;
+}
+
+static inline QWORD stampValue(QWORD stamp, QWORD value) {
+    return stampBytes(stamp, &value, sizeof(value));
+}
+
+QWORD stampRegisters(Debugger *dbg, DebuggerWindow *window, const C8core *core) {
+    QWORD stamp = stampValue(STAMP_INIT, core->PC);
+    stamp = stampValue(stamp, core->I);
+    stamp = stampValue(stamp, core->SP);
+    return stampBytes(stamp, core->reg, sizeof(core->reg));
+}
+
+/* Memory window follows PC until it's scrolled (touched) */
+QWORD stampMemory(Debugger *dbg, DebuggerWindow *window, const C8core *core) {
+    MemoryWindowData *data = (MemoryWindowData*) window->auxdata;
+    if (data == NULL)
+        return STAMP_INIT;
+
+    WORD start = (window->flags & WINDOW_FLAG_TOUCHED) ? data->addr_start : core->PC;
+    WORD cols = (window->columns - 2) / WINDOW_MEMORY_COLUMN_OFFSET;
+    QWORD first = start > 0 ? start - 1 : 0;
+    QWORD last = (QWORD) start + window->textLines * cols;
+
+    if (last > MEMORY_RANGE_PROGRAM_MAX + 1)
+        last = MEMORY_RANGE_PROGRAM_MAX + 1;
+
+    QWORD stamp = stampValue(STAMP_INIT, core->PC);
+    stamp = stampValue(stamp, start);
+    if (first < last)
+        stamp = stampBytes(stamp, &core->memory[first], last - first);
+
+#if CORE_WATCHPOINTS
+    stamp = stampBytes(stamp, core->watchMap, sizeof(core->watchMap));
+    stamp = stampValue(stamp, core->watchHits);
+#endif
+
+    return stamp;
+}
+
+QWORD stampCustomFlags(Debugger *dbg, DebuggerWindow *window, const C8core *core) {
+    return stampValue(STAMP_INIT, core->customFlags);
+}
+
+/* Disassembly is made once when debugger starts so only the position
+ * and breakpoint marks matter
+ */
+QWORD stampDisasm(Debugger *dbg, DebuggerWindow *window, const C8core *core) {
+    DisasmWindowData *data = (DisasmWindowData*) window->auxdata;
+    if (data == NULL)
+        return STAMP_INIT;
+
+    QWORD stamp = stampValue(STAMP_INIT, core->PC);
+    stamp = stampBytes(stamp, dbg->viewBreakpoints.map, sizeof(dbg->viewBreakpoints.map));
+    return stampValue(stamp, (window->flags & WINDOW_FLAG_TOUCHED) ? data->addr_start : core->PC);
+}
+
+QWORD stampVMdbg(Debugger *dbg, DebuggerWindow *window, const C8core *core) {
+    return stampBytes(STAMP_INIT, core->gfx, sizeof(core->gfx));
+}
+
+QWORD stampPreview(Debugger *dbg, DebuggerWindow *window, const C8core *core) {
+    QWORD stamp = stampValue(STAMP_INIT, core->I);
+    for (BYTE i = 0; i < 10; i++)
+        stamp = stampValue(stamp, core->memory[core->I + i]);
+    return stamp;
+}
+
+QWORD stampStack(Debugger *dbg, DebuggerWindow *window, const C8core *core) {
+    QWORD stamp = stampValue(STAMP_INIT, core->SP);
+    return stampBytes(stamp, core->stack, sizeof(core->stack));
+}
+
+QWORD stampCurrentState(Debugger *dbg, DebuggerWindow *window, const C8core *core) {
+    QWORD stamp = stampValue(STAMP_INIT, dbg->flags & DEBUGGER_FLAG_STEP_MODE);
+    if (!(dbg->flags & DEBUGGER_FLAG_STEP_MODE))
+        stamp = stampValue(stamp, getRotatingThingyFrame());
+    stamp = stampValue(stamp, core->tDelay);
+    stamp = stampValue(stamp, core->tSound);
+    stamp = stampValue(stamp, core->keypadState);
+    stamp = stampValue(stamp, dbg->viewBreakpoints.count);
+    stamp = stampValue(stamp, dbg->viewBreakpoints.totalHits);
+    return stampBytes(stamp, dbg->message, sizeof(dbg->message));
+}
+
+/* Stamp of a window as a whole: it's content and how it's box is drawn */
+static inline QWORD stampWindow(Debugger *dbg, DebuggerWindow *window) {
+    QWORD stamp = window->stampHandler(dbg, window, dbg->core);
+    stamp = stampValue(stamp, dbg->current == window);
+    return stampValue(stamp, dbg->current == window && (dbg->flags & DEBUGGER_FLAG_EDITING));
 }
 
 /* ======================= UPDATE HANDLERS ========================= */
@@ -283,8 +392,16 @@ void updateMemory(Debugger *dbg, DebuggerWindow *window, const C8core* core) {
 
     AUX_DATA->max_cols = (window->columns - 2) / (WINDOW_MEMORY_COLUMN_OFFSET);
 	BYTE memEnd = 0;
+	WORD rows = window->textLines;
+
+#if CORE_WATCHPOINTS
+	// Last line inside the box is taken by watchpoints and the last write they caught
+	BYTE showWatch = CORE_WATCHING(core) || core->watchHits != 0;
+	if (showWatch)
+		rows = window->lines - 2 - WINDOW_CONTENT_Y_OFFSET;
+#endif
 
-	for (WORD i = 0; i < window->textLines; i++) {
+	for (WORD i = 0; i < rows; i++) {
 		for (WORD j = i * AUX_DATA->max_cols, k = 0; j < (i + 1) * AUX_DATA->max_cols; j++, k++) {
 			QWORD nextMem = AUX_DATA->addr_start + j - 1;
 			if (j == i * AUX_DATA->max_cols) {
@@ -298,10 +415,15 @@ void updateMemory(Debugger *dbg, DebuggerWindow *window, const C8core* core) {
 					if (nextMem == core->PC || nextMem == core->PC + 1) {
 						wattron(window->win, COLOR_PAIR(WINDOW_MEMORY_OPCODE_COLOR));
 					}
+#if CORE_WATCHPOINTS
+					if (WATCH_MAP_TEST(core->watchMap, nextMem))
+						wattron(window->win, A_UNDERLINE);
+#endif
 					mvwprintw(window->win, WINDOW_CONTENT_Y_OFFSET + i,
                                 WINDOW_CONTENT_X_OFFSET + (k * WINDOW_MEMORY_COLUMN_OFFSET) + 1,
-							    "%02X ", core->memory[nextMem]);
-					wattroff(window->win, COLOR_PAIR(WINDOW_MEMORY_OPCODE_COLOR));
+							    "%02X", core->memory[nextMem]);
+					wattroff(window->win, COLOR_PAIR(WINDOW_MEMORY_OPCODE_COLOR) | A_UNDERLINE);
+					wprintw(window->win, " ");
 
 				} else {
 					if (!memEnd) {
@@ -320,6 +442,20 @@ void updateMemory(Debugger *dbg, DebuggerWindow *window, const C8core* core) {
 			}
 		}
 	}
+
+#if CORE_WATCHPOINTS
+	if (showWatch) {
+		char status[80];
+		int length = snprintf(status, sizeof(status), "Watching %u bytes", core->watchCount);
+
+		if (core->watchHits != 0)
+			snprintf(status + length, sizeof(status) - length, ", 0x%03X written at 0x%03X: %02X -> %02X",
+						core->watchAddr, core->watchPC, core->watchOld, core->watchNew);
+
+		mvwprintw(window->win, window->lines - 2, WINDOW_CONTENT_X_OFFSET, "%.*s",
+					window->columns - WINDOW_CONTENT_X_OFFSET * 2, status);
+	}
+#endif
 }
 
 /** updateCustomFlags
@@ -408,6 +544,8 @@ void updateDisasm(Debugger *dbg, DebuggerWindow *window, const C8core *core) {
             }
             mvwprintw(window->win, WINDOW_CONTENT_Y_OFFSET + i, WINDOW_CONTENT_X_OFFSET,
                             fmt_selected, current->addr, current->raw, current->asmstr, current->readable);
+            if (BREAKPOINT_MAP_TEST(dbg->viewBreakpoints.map, current->addr))
+                mvwaddch(window->win, WINDOW_CONTENT_Y_OFFSET + i, WINDOW_CONTENT_X_OFFSET, '*');
         } else {
             wattron(window->win, COLOR_PAIR(WINDOW_MEMORY_END_COLOR));
             mvwprintw(window->win, WINDOW_CONTENT_Y_OFFSET + i, WINDOW_CONTENT_X_OFFSET, "N/A");
@@ -534,6 +672,186 @@ void updateCurrentState(Debugger *dbg, DebuggerWindow *window, const C8core *cor
 
     for (BYTE i = 0; i < 16; i++)
         wprintw(window->win, "%u", GET_BIT(core->keypadState, i));
+
+    const BreakpointSet *breakpoints = &dbg->viewBreakpoints;
+    mvwprintw(window->win, WINDOW_CONTENT_Y_OFFSET + 7, WINDOW_CONTENT_X_OFFSET,
+                "Breakpoints: %u", breakpoints->count);
+    if (breakpoints->lastHit != BREAKPOINT_NONE) {
+        const Breakpoint *bp = &breakpoints->list[breakpoints->lastHit];
+        wprintw(window->win, " (0x%03X hit %llu times)", bp->addr, (unsigned long long) bp->hits);
+    }
+
+    mvwprintw(window->win, WINDOW_CONTENT_Y_OFFSET + 8, WINDOW_CONTENT_X_OFFSET, "%.*s",
+                window->columns - WINDOW_CONTENT_X_OFFSET * 2, dbg->message);
+}
+
+/* ==================== SNAPSHOTS AND COMMANDS ===================== */
+
+/* Write end of the wake pipe of the debugger (for the SIGWINCH handler) */
+static int g_wakeFd = -1;
+
+/* SIGWINCH handler that was installed before ours (it's ncurses' one) */
+static struct sigaction g_prevWinchAction;
+
+/* Wakes debugger thread up if it's waiting for input (any thread)
+ * Pipe is non blocking and if it's full debugger is about to wake up anyway
+ */
+static inline void wakeDebugger(int fd) {
+    ssize_t written = write(fd, "", 1);
+    (void) written;
+}
+
+/* Terminal got resized: debugger has to wake up and redraw (ncurses' own
+ * handler is called too so that getch returns KEY_RESIZE)
+ */
+static void handleWinch(int sig) {
+    if (g_wakeFd >= 0)
+        wakeDebugger(g_wakeFd);
+
+    if (g_prevWinchAction.sa_handler != SIG_DFL && g_prevWinchAction.sa_handler != SIG_IGN)
+        g_prevWinchAction.sa_handler(sig);
+}
+
+/** waitForInput
+ *
+ * @param dbg
+ *  Pointer to Debugger struct representing a debugger context
+ * @param timeout
+ *  Longest time to wait (in ms) or -1 to wait for as long as it takes
+ * @description:
+ *  Sleeps until there's a key to read from the terminal, emulation
+ *  publishes a snapshot while execution is held, terminal is resized
+ *  or debugger has to stop (debugger thread only)
+ */
+static void waitForInput(Debugger *dbg, int timeout) {
+    struct pollfd fds[2] = {
+        {.fd = STDIN_FILENO, .events = POLLIN},
+        {.fd = dbg->wakeFds[0], .events = POLLIN}
+    };
+
+    if (poll(fds, 2, timeout) > 0 && (fds[1].revents & POLLIN)) {
+        char drain[64];
+        while (read(dbg->wakeFds[0], drain, sizeof(drain)) > 0);
+    }
+}
+
+/** publishCoreSnapshot
+ *
+ * @param dbg
+ *  Pointer to Debugger struct representing a debugger context
+ * @param core
+ *  Pointer to C8core struct representing a chip-8 system core state
+ * @param breakpoints
+ *  Pointer to breakpoints of a VM (with their hit counts)
+ * @param held
+ *  Non zero if debugger holds execution
+ * @description:
+ *  Copies a core into the snapshot debugger thread reads (emulation thread only)
+ *  Never waits, debugger thread simply retries reading if it catches
+ *  the snapshot in the middle of this copy
+ */
+void publishCoreSnapshot(Debugger *dbg, const C8core *core, const BreakpointSet *breakpoints, BYTE held) {
+    CoreSnapshot *snapshot = &dbg->snapshot;
+
+    // Atomic add is a full barrier so sequence turns odd before anything is copied
+    // and turns even again only after everything is
+    SDL_AtomicAdd(&snapshot->sequence, 1);
+    memcpy(&snapshot->core, core, sizeof(C8core));
+    memcpy(&snapshot->breakpoints, breakpoints, sizeof(BreakpointSet));
+    snapshot->held = held;
+    snapshot->commands = SDL_AtomicGet(&dbg->commands.head);
+    SDL_AtomicAdd(&snapshot->sequence, 1);
+
+    // Debugger thread sleeps while execution is held and only wakes up for this
+    // (running emulation publishes every frame and debugger reads at it's own pace)
+    if (held)
+        wakeDebugger(dbg->wakeFds[1]);
+}
+
+/* Copies the newest snapshot into dbg->view if there is a new one (debugger thread only)
+ * Debugger shows execution as paused or running only once emulation has handled every
+ * command that was sent, so pressing pause twice in a row doesn't flicker
+ */
+static void readCoreSnapshot(Debugger *dbg) {
+    CoreSnapshot *snapshot = &dbg->snapshot;
+    int sequence;
+    BYTE held = 0;
+    DWORD commands = 0;
+
+    do {
+        sequence = SDL_AtomicGet(&snapshot->sequence);
+        if (sequence == dbg->viewSequence)
+            return;
+        if (sequence & 1)
+            continue;
+
+        memcpy(&dbg->view, &snapshot->core, sizeof(C8core));
+        memcpy(&dbg->viewBreakpoints, &snapshot->breakpoints, sizeof(BreakpointSet));
+        held = snapshot->held;
+        commands = snapshot->commands;
+        SDL_MemoryBarrierAcquire();
+    } while ((sequence & 1) || sequence != SDL_AtomicGet(&snapshot->sequence));
+
+    dbg->viewSequence = sequence;
+
+    // Execution has stopped at a breakpoint since the last snapshot
+    const BreakpointSet *breakpoints = &dbg->viewBreakpoints;
+    if (breakpoints->totalHits != dbg->seenHits && breakpoints->lastHit != BREAKPOINT_NONE) {
+        const Breakpoint *bp = &breakpoints->list[breakpoints->lastHit];
+        snprintf(dbg->message, sizeof(dbg->message), "Hit 0x%03X %s", bp->addr, bp->condition);
+    }
+    dbg->seenHits = breakpoints->totalHits;
+
+    if (commands != (DWORD) SDL_AtomicGet(&dbg->commands.tail))
+        return;
+
+    if (held)
+        dbg->flags |= DEBUGGER_FLAG_STEP_MODE;
+    else
+        dbg->flags &= ~DEBUGGER_FLAG_STEP_MODE;
+}
+
+// Sends a command to the emulation thread (debugger thread only), returns 0 if queue is full
+static BYTE pushCommand(Debugger *dbg, const DebuggerCommand *command) {
+    DebuggerCommandQueue *queue = &dbg->commands;
+    unsigned tail = SDL_AtomicGet(&queue->tail);
+    if (tail - (unsigned) SDL_AtomicGet(&queue->head) == DEBUGGER_COMMAND_QUEUE_SIZE)
+        return 0;
+
+    queue->commands[tail & (DEBUGGER_COMMAND_QUEUE_SIZE - 1)] = *command;
+
+    // Atomic add is a full barrier so the command is written before consumer can see it
+    SDL_AtomicAdd(&queue->tail, 1);
+
+    // Emulation waits for SDL events while execution is held
+    SDL_Event wake;
+    SDL_zero(wake);
+    wake.type = dbg->wakeEvent;
+    SDL_PushEvent(&wake);
+    return 1;
+}
+
+/* Sends a command that takes no parameters other than a breakpoint
+ * Breakpoint is only needed by breakpoint commands (NULL for any other one)
+ */
+BYTE pushDebuggerCommand(Debugger *dbg, BYTE type, const Breakpoint *breakpoint) {
+    DebuggerCommand command = {.type = type};
+    if (breakpoint != NULL)
+        command.breakpoint = *breakpoint;
+
+    return pushCommand(dbg, &command);
+}
+
+// Takes the oldest command (emulation thread only), returns 0 if there are none
+BYTE popDebuggerCommand(Debugger *dbg, DebuggerCommand *command) {
+    DebuggerCommandQueue *queue = &dbg->commands;
+    unsigned head = SDL_AtomicGet(&queue->head);
+    if (head == (unsigned) SDL_AtomicGet(&queue->tail))
+        return 0;
+
+    *command = queue->commands[head & (DEBUGGER_COMMAND_QUEUE_SIZE - 1)];
+    SDL_AtomicAdd(&queue->head, 1);
+    return 1;
 }
 
 /* ====================== DEBUGGER MENU HANDLERS =================== */
@@ -577,11 +895,17 @@ void gHandler_select(Debugger *dbg) {
 }
 
 void gHandler_stepin(Debugger *dbg) {
-    dbg->flags |= DEBUGGER_FLAG_NEXT_STEP;
+    if (dbg->flags & DEBUGGER_FLAG_STEP_MODE)
+        pushDebuggerCommand(dbg, DEBUGGER_COMMAND_STEP, NULL);
 }
 
+/* Mode is flipped right away so that the next press flips it back
+ * even before emulation handles the command (see readCoreSnapshot)
+ */
 void gHandler_pauseresume(Debugger *dbg) {
-    dbg->flags ^= DEBUGGER_FLAG_STEP_MODE;
+    if (pushDebuggerCommand(dbg, (dbg->flags & DEBUGGER_FLAG_STEP_MODE) ?
+                DEBUGGER_COMMAND_RESUME : DEBUGGER_COMMAND_PAUSE, NULL))
+        dbg->flags ^= DEBUGGER_FLAG_STEP_MODE;
 }
 
 /* Popup-wise actions handlers */
@@ -650,11 +974,48 @@ void wHandler_mem_goto(Debugger *dbg) {
     dbg->popup = &g_popups[DEBUGGER_POPUP_MEM_GOTO];
 }
 
+void wHandler_mem_watch(Debugger *dbg) {
+    dbg->flags |= DEBUGGER_FLAG_POPUP;
+    dbg->popup = &g_popups[DEBUGGER_POPUP_WATCH];
+}
+
+void wHandler_mem_unwatch(Debugger *dbg) {
+    if (pushDebuggerCommand(dbg, DEBUGGER_COMMAND_CLEAR_WATCHPOINTS, NULL))
+        snprintf(dbg->message, sizeof(dbg->message), "Watchpoints cleared");
+}
+
 void wHandler_dis_goto(Debugger *dbg) {
     dbg->flags |= DEBUGGER_FLAG_POPUP;
     dbg->popup = &g_popups[DEBUGGER_POPUP_DIS_GOTO];
 }
 
+/* Address of an instruction at the top of the disassembly window
+ * (breakpoints are set and deleted there)
+ */
+static WORD getDisasmTopAddress(Debugger *dbg) {
+    DisasmWindowData *data = (DisasmWindowData*) dbg->windows[DEBUG_WINDOW_DISASM]->auxdata;
+    const Instruction *instr = getInstructionAt(data != NULL ? data->addr_start : dbg->core->PC);
+
+    return instr->op != NULL ? instr->addr : dbg->core->PC;
+}
+
+void wHandler_dis_break(Debugger *dbg) {
+    dbg->flags |= DEBUGGER_FLAG_POPUP;
+    dbg->popup = &g_popups[DEBUGGER_POPUP_BREAKPOINT];
+}
+
+void wHandler_dis_unbreak(Debugger *dbg) {
+    Breakpoint bp;
+    WORD addr = getDisasmTopAddress(dbg);
+
+    if (findBreakpoint(&dbg->viewBreakpoints, addr) == BREAKPOINT_NONE)
+        return;
+
+    compileBreakpoint(&bp, addr, NULL, NULL);
+    if (pushDebuggerCommand(dbg, DEBUGGER_COMMAND_CLEAR_BREAKPOINT, &bp))
+        snprintf(dbg->message, sizeof(dbg->message), "Breakpoint at 0x%03X deleted", addr);
+}
+
 /* ================== DEBUGGER POPUP DRAW SAVE EXIT ================ */
 
 /* This function just cleans up after an ncurses FORM object in a popup
@@ -783,6 +1144,165 @@ void wPopupSave_findop(Debugger *dbg, DebuggerPopup *popup) {
     }
 }
 
+/* Draw handler for "Set Breakpoint" popup
+ * Address is filled in with the one at the top of the disassembly window
+ * and condition can be longer than it's field (it scrolls)
+ */
+void wPopupDraw_breakpoint(Debugger *dbg, DebuggerPopup *popup) {
+    char addr[8];
+
+    for (int i = 0; i < DEBUGGER_POPUP_MAX_FIELDS; i++)
+        popup->fields[i] = NULL;
+
+    for (BYTE i = 0; i < popup->field_count; i++) {
+        popup->fields[i] = new_field(1, POPUP_SUB_X_LENGTH, POPUP_SUB_Y_OFFSET + i * 2, POPUP_SUB_X_OFFSET, 0, 0);
+        set_field_fore(popup->fields[i], COLOR_PAIR(MENU_BAR_COLOR));
+        set_field_back(popup->fields[i], COLOR_PAIR(MENU_BAR_COLOR));
+        field_opts_off(popup->fields[i], O_AUTOSKIP);
+    }
+
+    field_opts_off(popup->fields[1], O_STATIC);
+    set_max_field(popup->fields[1], BREAKPOINT_CONDITION_SIZE - 1);
+
+    snprintf(addr, sizeof(addr), "%03X", getDisasmTopAddress(dbg));
+    set_field_buffer(popup->fields[0], 0, addr);
+
+    popup->fields[popup->field_count] = NULL;
+
+    set_form_win(popup->form, dbg->popup_win);
+    set_form_sub(popup->form, dbg->popup_sub);
+    popup->form = new_form(popup->fields);
+    set_current_field(popup->form, popup->fields[1]);
+    post_form(popup->form);
+
+    mvwprintw(dbg->popup_win, 2, 2, "Address: ");
+    mvwprintw(dbg->popup_win, 4, 2, "Condition: ");
+}
+
+/* Parses an address typed into a popup field (hex, padded with spaces)
+ * Returns 0 if the field isn't a number as a whole or is out of memory
+ */
+static BYTE parseAddressField(FIELD *field, WORD *addr) {
+    const char *buffer = field_buffer(field, 0);
+    char *end = NULL;
+    long long value = strtoll(buffer, &end, 16);
+
+    while (end != buffer && *end == ' ')
+        end++;
+
+    if (end == buffer || *end != 0 || value < 0 || value >= MEMORY_SIZE)
+        return 0;
+
+    *addr = (WORD) value;
+    return 1;
+}
+
+/* Save handler for "Set Breakpoint" popup
+ * Condition is compiled right here so that emulation only gets
+ * a breakpoint that is ready to be checked
+ */
+void wPopupSave_breakpoint(Debugger *dbg, DebuggerPopup *popup) {
+    Breakpoint bp;
+    char condition[BREAKPOINT_CONDITION_SIZE];
+    const char *error = NULL;
+
+    if (popup->form) {
+        form_driver(popup->form, REQ_VALIDATION);
+
+        WORD addr = 0;
+        if (!parseAddressField(popup->fields[0], &addr)) {
+            snprintf(dbg->message, sizeof(dbg->message), "Bad address: 0 to 0x%03X can have a breakpoint", MEMORY_SIZE - 1);
+            destroyForm(popup);
+            return;
+        }
+
+        // Field buffer is padded with spaces
+        snprintf(condition, sizeof(condition), "%s", field_buffer(popup->fields[1], 0));
+        for (int i = strlen(condition) - 1; i >= 0 && condition[i] == ' '; i--)
+            condition[i] = 0;
+
+        if (compileBreakpoint(&bp, addr, condition, &error) != VM_RESULT_SUCCESS)
+            snprintf(dbg->message, sizeof(dbg->message), "Bad condition: %s", error);
+        else if (findBreakpoint(&dbg->viewBreakpoints, addr) == BREAKPOINT_NONE
+                && dbg->viewBreakpoints.count >= BREAKPOINT_MAX_COUNT)
+            snprintf(dbg->message, sizeof(dbg->message), "Too many breakpoints");
+        else if (pushDebuggerCommand(dbg, DEBUGGER_COMMAND_SET_BREAKPOINT, &bp))
+            snprintf(dbg->message, sizeof(dbg->message), "Breakpoint set at 0x%03X", addr);
+
+        destroyForm(popup);
+    }
+}
+
+/* Draw handler for "Watch Memory" popup
+ * Address is filled in with the one at the start of the memory window
+ */
+void wPopupDraw_watch(Debugger *dbg, DebuggerPopup *popup) {
+    MemoryWindowData *data = (MemoryWindowData*) dbg->windows[DEBUG_WINDOW_MEMORY]->auxdata;
+    char addr[8];
+
+    for (int i = 0; i < DEBUGGER_POPUP_MAX_FIELDS; i++)
+        popup->fields[i] = NULL;
+
+    for (BYTE i = 0; i < popup->field_count; i++) {
+        popup->fields[i] = new_field(1, POPUP_SUB_X_LENGTH, POPUP_SUB_Y_OFFSET + i * 2, POPUP_SUB_X_OFFSET, 0, 0);
+        set_field_fore(popup->fields[i], COLOR_PAIR(MENU_BAR_COLOR));
+        set_field_back(popup->fields[i], COLOR_PAIR(MENU_BAR_COLOR));
+        field_opts_off(popup->fields[i], O_AUTOSKIP);
+    }
+
+    snprintf(addr, sizeof(addr), "%03X", (data != NULL ? data->addr_start : dbg->core->PC) & (MEMORY_SIZE - 1));
+    set_field_buffer(popup->fields[0], 0, addr);
+    set_field_buffer(popup->fields[1], 0, "1");
+
+    popup->fields[popup->field_count] = NULL;
+
+    set_form_win(popup->form, dbg->popup_win);
+    set_form_sub(popup->form, dbg->popup_sub);
+    popup->form = new_form(popup->fields);
+    set_current_field(popup->form, popup->fields[0]);
+    post_form(popup->form);
+
+    mvwprintw(dbg->popup_win, 2, 2, "Address: ");
+    mvwprintw(dbg->popup_win, 4, 2, "Length: ");
+}
+
+/* Save handler for "Watch Memory" popup */
+void wPopupSave_watch(Debugger *dbg, DebuggerPopup *popup) {
+    DebuggerCommand command = {.type = DEBUGGER_COMMAND_SET_WATCHPOINT};
+
+    if (popup->form) {
+        form_driver(popup->form, REQ_VALIDATION);
+
+        // Both fields have to be numbers as a whole (they are padded with spaces)
+        // and a watched range has to fit between the address and the end of memory
+        if (!parseAddressField(popup->fields[0], &command.addr)) {
+            snprintf(dbg->message, sizeof(dbg->message), "Bad address: 0 to 0x%03X can be watched", MEMORY_SIZE - 1);
+            destroyForm(popup);
+            return;
+        }
+
+        const char *field = field_buffer(popup->fields[1], 0);
+        char *end = NULL;
+        long long length = strtoll(field, &end, 0);
+        while (end != field && *end == ' ')
+            end++;
+
+        if (end == field || *end != 0 || length < 1 || length > MEMORY_SIZE - command.addr) {
+            snprintf(dbg->message, sizeof(dbg->message), "Bad length: 1 to %u bytes can be watched at 0x%03X",
+                        MEMORY_SIZE - command.addr, command.addr);
+            destroyForm(popup);
+            return;
+        }
+
+        command.length = (WORD) length;
+        if (pushCommand(dbg, &command))
+            snprintf(dbg->message, sizeof(dbg->message), "Watching 0x%03X-0x%03X",
+                        command.addr, command.addr + command.length - 1);
+
+        destroyForm(popup);
+    }
+}
+
 /* ==================== DEBUGGER CONTEXT FUNCTIONS ================= */
 
 /* Debugger menu (displayed as a footer in TUI) is just an ncurses window
@@ -811,8 +1331,15 @@ static inline void printOpts(WINDOW *win, const DebuggerMenuOption *opts, BYTE c
  *  It actually in all cases will be equal to dbg->current
  * @description:
  *  Update handler for a debugger menu window
+ *  Menu is only redrawn when selected window or debugger mode changes
  */
 void updateMenu(Debugger *dbg, DebuggerWindow *dwin) {
+    QWORD stamp = stampValue(STAMP_INIT, (QWORD) (uintptr_t) dwin);
+    stamp = stampValue(stamp, dbg->flags & (DEBUGGER_FLAG_POPUP | DEBUGGER_FLAG_EDITING));
+    if (stamp == dbg->menuVersion)
+        return;
+    dbg->menuVersion = stamp;
+
     werase(dbg->menuwin);
     wbkgd(dbg->menuwin, COLOR_PAIR(MENU_BAR_COLOR));
 
@@ -869,78 +1396,166 @@ static void callHandler(Debugger *dbg) {
     }
 }
 
-/** updateDebugger
+/** redrawWindows
  *
  * @param dbg
  *  Pointer to a Debugger struct representing a debugger context
  * @description:
- *  Calls all window update handlers from a given debugger context
- *  therefore updating the whole debugger context
+ *  Redraws only windows whose version stamp changed since they were drawn
+ *  last (or that are damaged) into their ncurses buffers, nothing reaches
+ *  the terminal until update_panels and doupdate are called
+ *  Returns number of windows that were redrawn
  */
-VM_RESULT updateDebugger(Debugger *dbg) {
-    if (!(dbg->flags & DEBUGGER_FLAG_POPUP)) {
-        for (BYTE i = 0; i < DEBUG_WINDOW_COUNT; i++) {
-            if (dbg->windows[i]->win != NULL) {
-                werase(dbg->windows[i]->win);
-                dbg->windows[i]->updateHandler(dbg, dbg->windows[i], dbg->core);
-                drawWindowBox(dbg, dbg->windows[i]);
-                wrefresh(dbg->windows[i]->win);
-            }
-        }
+static BYTE redrawWindows(Debugger *dbg) {
+    BYTE redrawn = 0;
+
+    for (BYTE i = 0; i < DEBUG_WINDOW_COUNT; i++) {
+        DebuggerWindow *window = dbg->windows[i];
+        if (window->win == NULL)
+            continue;
+
+        QWORD stamp = stampWindow(dbg, window);
+        if (stamp == window->version && !(window->flags & WINDOW_FLAG_DAMAGED))
+            continue;
+
+        werase(window->win);
+        window->updateHandler(dbg, window, dbg->core);
+        drawWindowBox(dbg, window);
+
+        // Update handler might have just created window's aux data
+        window->version = stampWindow(dbg, window);
+        window->flags &= ~WINDOW_FLAG_DAMAGED;
+        redrawn++;
     }
 
-    updateMenu(dbg, dbg->current);
+    return redrawn;
+}
 
-    dbg->lastInput = getch();
-    VM_RESULT ret = VM_RESULT_SUCCESS;
+/* Makes every window and the menu redraw on the next update */
+static void damageAll(Debugger *dbg) {
+    for (BYTE i = 0; i < DEBUG_WINDOW_COUNT; i++)
+        dbg->windows[i]->flags |= WINDOW_FLAG_DAMAGED;
+
+    dbg->menuVersion = 0;
+    clearok(curscr, TRUE);
+}
+
+/* Shows a popup that was just invoked and draws it's form
+ * Happens right after a key opens it so that keys which follow
+ * in the same update already go into the form
+ */
+static void showPopup(Debugger *dbg) {
+    curs_set(1);
+    top_panel(dbg->popup_pan);
+    show_panel(dbg->popup_pan);
+    top_panel(dbg->popup_sub_pan);
+    show_panel(dbg->popup_sub_pan);
+    werase(dbg->popup_sub);
+    werase(dbg->popup_win);
+    dbg->popup->hdraw(dbg, dbg->popup);
+    dbg->popup->isDrawn = 1;
+    drawPopupBox(dbg);
+}
+
+/** updateDebugger
+ *
+ * @param dbg
+ *  Pointer to a Debugger struct representing a debugger context
+ * @description:
+ *  Takes the newest core snapshot, handles every key that was pressed
+ *  since the last update and redraws debugger windows whose state changed
+ *  (see redrawWindows), everything that changed reaches the terminal in a
+ *  single doupdate (panels are copied to the virtual screen with wnoutrefresh
+ *  by update_panels), if nothing changed terminal isn't touched at all
+ *  Returns VM_RESULT_EVENT_QUIT once user quits
+ */
+VM_RESULT updateDebugger(Debugger *dbg) {
+    readCoreSnapshot(dbg);
+
+    while ((dbg->lastInput = getch()) != ERR) {
+        if (dbg->lastInput == KEY_RESIZE) {
+            damageAll(dbg);
+            continue;
+        }
 
-    if (dbg->lastInput != ERR) {
         if (!(dbg->flags & DEBUGGER_FLAG_EDITING))
             gNavHandler(dbg);
         else if (dbg->current->menu->navhandler != NULL)
             dbg->current->menu->navhandler(dbg);
 
         callHandler(dbg);
-    }
-
-    if (dbg->flags & DEBUGGER_FLAG_EXIT)
-        return VM_RESULT_EVENT_QUIT;
 
-    if (dbg->flags & DEBUGGER_FLAG_STEP_MODE)
-        ret = VM_RESULT_DBG;
+        if (dbg->flags & DEBUGGER_FLAG_EXIT)
+            return VM_RESULT_EVENT_QUIT;
 
-    if (ret == VM_RESULT_DBG && dbg->flags & DEBUGGER_FLAG_NEXT_STEP) {
-        ret = VM_RESULT_SUCCESS;
-        dbg->flags ^= DEBUGGER_FLAG_NEXT_STEP;
+        if ((dbg->flags & DEBUGGER_FLAG_POPUP) && !dbg->popup->isDrawn)
+            showPopup(dbg);
     }
 
+    BYTE redrawn = 0;
+    if (!(dbg->flags & DEBUGGER_FLAG_POPUP))
+        redrawn = redrawWindows(dbg);
+
+    QWORD menuVersion = dbg->menuVersion;
+    updateMenu(dbg, dbg->current);
+    BYTE menuChanged = menuVersion != dbg->menuVersion;
+
     if (dbg->flags & DEBUGGER_FLAG_POPUP) {
-        curs_set(1);
-        if (!dbg->popup->isDrawn) {
-            top_panel(dbg->popup_pan);
-            show_panel(dbg->popup_pan);
-            top_panel(dbg->popup_sub_pan);
-            show_panel(dbg->popup_sub_pan);
-            werase(dbg->popup_sub);
-            werase(dbg->popup_win);
-            dbg->popup->hdraw(dbg, dbg->popup);
-            dbg->popup->isDrawn = 1;
-            drawPopupBox(dbg);
-        }
         wnoutrefresh(dbg->popup_win);
         wnoutrefresh(dbg->popup_sub);
-    } else {
+    } else if (!panel_hidden(dbg->popup_pan)) {
         curs_set(0);
         werase(dbg->popup_sub);
         werase(dbg->popup_win);
         hide_panel(dbg->popup_sub_pan);
         hide_panel(dbg->popup_pan);
+    } else if (redrawn == 0 && !menuChanged) {
+        return VM_RESULT_SUCCESS;
     }
 
     update_panels();
 	doupdate();
 
-	return ret;
+	return VM_RESULT_SUCCESS;
+}
+
+/** runDebugger
+ *
+ * @param data
+ *  Pointer to a Debugger struct representing a debugger context
+ * @description:
+ *  Debugger thread: while ROM is running it updates debugger refreshRate
+ *  times a second no matter how fast emulation runs (and right away when
+ *  a key is pressed), while execution is held nothing changes on it's own
+ *  so it sleeps until a key is pressed, a step is done or terminal is resized
+ *  Runs until it's told to stop or user quits
+ *  Once debugger is initialized it's the only thread that touches ncurses
+ */
+static int runDebugger(void *data) {
+    Debugger *dbg = (Debugger*) data;
+    Uint32 nextUpdate = SDL_GetTicks();
+
+    while (!SDL_AtomicGet(&dbg->quit)) {
+        if (updateDebugger(dbg) == VM_RESULT_EVENT_QUIT) {
+            // Emulation drains the queue all the time so it can't stay full for long
+            while (!pushDebuggerCommand(dbg, DEBUGGER_COMMAND_QUIT, NULL) && !SDL_AtomicGet(&dbg->quit))
+                SDL_Delay(1);
+            break;
+        }
+
+        if (dbg->flags & DEBUGGER_FLAG_STEP_MODE) {
+            waitForInput(dbg, -1);
+            continue;
+        }
+
+        Uint32 now = SDL_GetTicks();
+        if ((Sint32) (nextUpdate - now) <= 0)
+            nextUpdate = now + dbg->refreshInterval;
+
+        waitForInput(dbg, nextUpdate - now);
+    }
+
+    return 0;
 }
 
 /** initWindow
@@ -958,6 +1573,8 @@ void initWindow(Debugger *dbg, DebuggerWindow *window) {
     generateWindowPos(window);
 
     window->auxdata = NULL;
+    window->version = 0;
+    window->flags |= WINDOW_FLAG_DAMAGED;
 
     window->adj[WINDOW_LEFT] = window->left;
     window->adj[WINDOW_RIGHT] = window->right;
@@ -1031,12 +1648,15 @@ static const DebuggerColorPair dbgColorPairs[WINDOW_COLOR_END_NR] = {
  *  debugger context that is to be initialized
  * @param _core
  *  Pointer to a C8core struct representing a chip-8 system core state
+ * @param refreshRate
+ *  Number of debugger updates per second
  * @description:
  *  Populates Debugger struct corresponding to a given debugger context
- *  with initial data and parameters and calls all init handlers for
- *  all debugger windows in a given debugger context
+ *  with initial data and parameters, calls all init handlers for
+ *  all debugger windows in a given debugger context and starts
+ *  the debugger thread (debugger starts with execution held)
  */
-VM_RESULT initDebugger(Debugger **m_dbg, const C8core *_core) {
+VM_RESULT initDebugger(Debugger **m_dbg, const C8core *_core, BYTE refreshRate) {
 	VM_ASSERT(_core == NULL);
 
 	*m_dbg = NULL;
@@ -1047,8 +1667,29 @@ VM_RESULT initDebugger(Debugger **m_dbg, const C8core *_core) {
     disassemble(_core);
 
 	Debugger *dbg = *m_dbg;
-	dbg->core = _core;
+	dbg->core = &dbg->view;
 	dbg->flags = DEBUGGER_FLAG_STEP_MODE;
+    dbg->thread = NULL;
+    dbg->refreshInterval = 1000 / refreshRate;
+
+    SDL_AtomicSet(&dbg->quit, 0);
+    SDL_AtomicSet(&dbg->commands.head, 0);
+    SDL_AtomicSet(&dbg->commands.tail, 0);
+    dbg->wakeEvent = SDL_RegisterEvents(1);
+    if (dbg->wakeEvent == (Uint32) -1)
+        dbg->wakeEvent = SDL_USEREVENT;
+
+    // Neither side ever blocks on the wake pipe, it only makes poll return
+    VM_ASSERT(pipe(dbg->wakeFds) != 0);
+    fcntl(dbg->wakeFds[0], F_SETFL, O_NONBLOCK);
+    fcntl(dbg->wakeFds[1], F_SETFL, O_NONBLOCK);
+
+    SDL_AtomicSet(&dbg->snapshot.sequence, 0);
+    dbg->viewSequence = -1;
+    dbg->seenHits = 0;
+    dbg->message[0] = 0;
+    initBreakpoints(&dbg->viewBreakpoints);
+    publishCoreSnapshot(dbg, _core, &dbg->viewBreakpoints, 1);
 
     dbg->lastInput = ERR;
 
@@ -1068,10 +1709,12 @@ VM_RESULT initDebugger(Debugger **m_dbg, const C8core *_core) {
     dbg->current = &dbgwnds[DEBUG_WINDOW_DISASM];
 
     initMenu(dbg);
+    dbg->menuVersion = 0;
 	for (BYTE i = 0; i < DEBUG_WINDOW_COUNT; i++) {
         dbg->windows[i] = &dbgwnds[i];
         initWindow(dbg, dbg->windows[i]);
 		dbg->windows[i]->updateHandler = g_debuggerUpdaters[i];
+		dbg->windows[i]->stampHandler = g_debuggerStampers[i];
         dbg->windows[i]->menu = &g_menus[i];
 	}
 
@@ -1091,6 +1734,18 @@ VM_RESULT initDebugger(Debugger **m_dbg, const C8core *_core) {
     update_panels();
 	doupdate();
 
+    // Goes after initscr so that ncurses' SIGWINCH handler is already there to be chained
+    struct sigaction winch;
+    memset(&winch, 0, sizeof(winch));
+    winch.sa_handler = handleWinch;
+    winch.sa_flags = SA_RESTART;
+    sigemptyset(&winch.sa_mask);
+    g_wakeFd = dbg->wakeFds[1];
+    sigaction(SIGWINCH, &winch, &g_prevWinchAction);
+
+    dbg->thread = SDL_CreateThread(runDebugger, "cheap8 debugger", dbg);
+    VM_ASSERT(dbg->thread == NULL);
+
 	return VM_RESULT_SUCCESS;
 }
 
@@ -1100,12 +1755,23 @@ VM_RESULT initDebugger(Debugger **m_dbg, const C8core *_core) {
  *  A reference to a pointer to Debugger struct representing
  *  a debugger context that is to be destroyed
  * @description:
- *  Frees memory and destroys curses interface
+ *  Stops the debugger thread, frees memory and destroys curses interface
  */
 VM_RESULT destroyDebugger(Debugger **m_dbg) {
 	VM_ASSERT(*m_dbg == NULL);
 	Debugger *dbg = *m_dbg;
 
+    if (dbg->thread != NULL) {
+        SDL_AtomicSet(&dbg->quit, 1);
+        wakeDebugger(dbg->wakeFds[1]);
+        SDL_WaitThread(dbg->thread, NULL);
+    }
+
+    sigaction(SIGWINCH, &g_prevWinchAction, NULL);
+    g_wakeFd = -1;
+    close(dbg->wakeFds[0]);
+    close(dbg->wakeFds[1]);
+
     destroyDisassembler();
 
     del_panel(dbg->popup_pan);
@@ -12,6 +12,7 @@
 
 #include "c8core.h"
 #include "opcodes.h"
+#include "c8break.h"
 
 #include <ncurses.h>
 
@@ -20,6 +21,11 @@
 
 #include <locale.h>
 
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
 /* Offsets from screen borders at which to display TUI
  * Probably will both stay equal to 1 since they exist
  * just to not let TUI sort of "stick" awkwardly to the
@@ -100,6 +106,7 @@ typedef struct _DebuggerPopup DebuggerPopup;
 typedef struct _Debugger Debugger;
 
 typedef void (*WINDOW_UPDATE)(Debugger*, DebuggerWindow*, const C8core*);
+typedef QWORD (*WINDOW_STAMP)(Debugger*, DebuggerWindow*, const C8core*);
 typedef void (*POPUP_FORM_DRAW)(Debugger*, DebuggerPopup*);
 typedef void (*POPUP_FORM_SAVE)(Debugger*, DebuggerPopup*);
 
@@ -115,6 +122,15 @@ void updatePreview(Debugger *dbg, DebuggerWindow *window, const C8core *core);
 void updateStack(Debugger *dbg, DebuggerWindow *window, const C8core *core);
 void updateCurrentState(Debugger *dbg, DebuggerWindow *window, const C8core *core);
 
+QWORD stampRegisters(Debugger *dbg, DebuggerWindow *window, const C8core *core);
+QWORD stampMemory(Debugger *dbg, DebuggerWindow *window, const C8core *core);
+QWORD stampCustomFlags(Debugger *dbg, DebuggerWindow *window, const C8core *core);
+QWORD stampDisasm(Debugger *dbg, DebuggerWindow *window, const C8core *core);
+QWORD stampVMdbg(Debugger *dbg, DebuggerWindow *window, const C8core *core);
+QWORD stampPreview(Debugger *dbg, DebuggerWindow *window, const C8core *core);
+QWORD stampStack(Debugger *dbg, DebuggerWindow *window, const C8core *core);
+QWORD stampCurrentState(Debugger *dbg, DebuggerWindow *window, const C8core *core);
+
 /* Holds all update handlers for debugger windows */
 static const WINDOW_UPDATE g_debuggerUpdaters[DEBUG_WINDOW_COUNT] = {
 	updateRegisters,
@@ -127,6 +143,21 @@ static const WINDOW_UPDATE g_debuggerUpdaters[DEBUG_WINDOW_COUNT] = {
     updateCurrentState
 };
 
+/* Holds stamp handlers for debugger windows (in the same order as update handlers)
+ * A stamp handler returns a version stamp (a hash) of everything an update handler
+ * reads, a window is only redrawn when it's stamp changes
+ */
+static const WINDOW_STAMP g_debuggerStampers[DEBUG_WINDOW_COUNT] = {
+	stampRegisters,
+	stampMemory,
+	stampCustomFlags,
+    stampDisasm,
+    stampVMdbg,
+    stampPreview,
+    stampStack,
+    stampCurrentState
+};
+
 void generateWindowPos(DebuggerWindow *dwin);
 
 typedef struct _DebuggerMenuOption {
@@ -150,7 +181,11 @@ void wNavHandler_memory(Debugger *dbg);
 void wNavHandler_disasm(Debugger *dbg);
 
 void wHandler_mem_goto(Debugger *dbg);
+void wHandler_mem_watch(Debugger *dbg);
+void wHandler_mem_unwatch(Debugger *dbg);
 void wHandler_dis_goto(Debugger *dbg);
+void wHandler_dis_break(Debugger *dbg);
+void wHandler_dis_unbreak(Debugger *dbg);
 
 #define GLOBAL_OPTION_COUNT     5
 static const DebuggerMenuOption g_opts[GLOBAL_OPTION_COUNT] = {
@@ -167,14 +202,24 @@ static const DebuggerMenuOption g_popup_opts[POPUP_OPTION_COUNT] = {
     {.name = "OK", .key = 10, .keystr = "ENTER", .handler = pHandler_save}
 };
 
+#if CORE_WATCHPOINTS
+#define WINDOW_MEMORY_OPTION_COUNT  3
+#else
 #define WINDOW_MEMORY_OPTION_COUNT  1
+#endif
 static const DebuggerMenuOption w_mem_opts[WINDOW_MEMORY_OPTION_COUNT] = {
-    {.name = "Goto", .key = 'g', .keystr = "G", .handler = wHandler_mem_goto}
+    {.name = "Goto", .key = 'g', .keystr = "G", .handler = wHandler_mem_goto},
+#if CORE_WATCHPOINTS
+    {.name = "Watch", .key = 'w', .keystr = "W", .handler = wHandler_mem_watch},
+    {.name = "Unwatch All", .key = 'u', .keystr = "U", .handler = wHandler_mem_unwatch}
+#endif
 };
 
-#define WINDOW_DISASM_OPTION_COUNT  1
+#define WINDOW_DISASM_OPTION_COUNT  3
 static const DebuggerMenuOption w_dis_opts[WINDOW_DISASM_OPTION_COUNT] = {
-    {.name = "Goto", .key = 'g', .keystr = "G", .handler = wHandler_dis_goto}
+    {.name = "Goto", .key = 'g', .keystr = "G", .handler = wHandler_dis_goto},
+    {.name = "Breakpoint", .key = 'b', .keystr = "B", .handler = wHandler_dis_break},
+    {.name = "Delete", .key = 'd', .keystr = "D", .handler = wHandler_dis_unbreak}
 };
 
 typedef struct _DebuggerMenu {
@@ -227,6 +272,7 @@ void updateMenu(Debugger *dbg, DebuggerWindow *dwin);
 #define WINDOW_FLAG_READONLY    (1 << 0)
 #define WINDOW_FLAG_PERMANENT   (1 << 1)
 #define WINDOW_FLAG_TOUCHED     (1 << 2)
+#define WINDOW_FLAG_DAMAGED     (1 << 3)    /* Has to be redrawn no matter what it's stamp is */
 
 typedef enum {
     WINDOW_LEFT = 0,
@@ -270,6 +316,11 @@ typedef struct _DebuggerWindow {
 
     /* Pointer to an update function */
 	WINDOW_UPDATE updateHandler;
+
+    /* Pointer to a function that stamps whatever update function reads */
+    WINDOW_STAMP stampHandler;
+
+    QWORD version;          /* Stamp of the state window was last drawn from */
 } DebuggerWindow;
 
 static DebuggerWindow dbgwnds[DEBUG_WINDOW_COUNT] = {
@@ -319,9 +370,17 @@ void wPopupSave_findmem(Debugger *dbg, DebuggerPopup *popup);
 void wPopupDraw_findop(Debugger *dbg, DebuggerPopup *popup);
 void wPopupSave_findop(Debugger *dbg, DebuggerPopup *popup);
 
+void wPopupDraw_breakpoint(Debugger *dbg, DebuggerPopup *popup);
+void wPopupSave_breakpoint(Debugger *dbg, DebuggerPopup *popup);
+
+void wPopupDraw_watch(Debugger *dbg, DebuggerPopup *popup);
+void wPopupSave_watch(Debugger *dbg, DebuggerPopup *popup);
+
 typedef enum {
     DEBUGGER_POPUP_MEM_GOTO = 0,
     DEBUGGER_POPUP_DIS_GOTO,
+    DEBUGGER_POPUP_BREAKPOINT,
+    DEBUGGER_POPUP_WATCH,
 
     NR_DEBUGGER_POPUPS
 } DebuggerPopupType;
@@ -350,6 +409,14 @@ static DebuggerPopup g_popups[NR_DEBUGGER_POPUPS] = {
     /* DEBUGGER_POPUP_DIS_GOTO */ {
         .title = "Go to Instruction at Address", .hdraw = wPopupDraw_findop,
         .hsave = wPopupSave_findop, .field_count = 1
+    },
+    /* DEBUGGER_POPUP_BREAKPOINT */ {
+        .title = "Set Breakpoint", .hdraw = wPopupDraw_breakpoint,
+        .hsave = wPopupSave_breakpoint, .field_count = 2
+    },
+    /* DEBUGGER_POPUP_WATCH */ {
+        .title = "Watch Memory", .hdraw = wPopupDraw_watch,
+        .hsave = wPopupSave_watch, .field_count = 2
     }
 };
 
@@ -365,7 +432,9 @@ static DebuggerPopup g_popups[NR_DEBUGGER_POPUPS] = {
     type *AUX_DATA = (type*)window->auxdata; \
     if (IS_AUX_NEW)
 
-/* Indicates if debugger is paused i.e. in step mode */
+/* Indicates if debugger is paused i.e. in step mode
+ * (as of the last core snapshot, emulation thread decides it)
+ */
 #define DEBUGGER_FLAG_STEP_MODE         (1 << 0)
 
 /* Indicates if there is debugger window selected and probably edited */
@@ -374,9 +443,6 @@ static DebuggerPopup g_popups[NR_DEBUGGER_POPUPS] = {
 /* Indicates if there's an active popup window that should be displayed */
 #define DEBUGGER_FLAG_POPUP             (1 << 5)
 
-/* Indicates if a user requested a next step when in step mode */
-#define DEBUGGER_FLAG_NEXT_STEP         (1 << 6)
-
 /* Indicates if debugger recieved a Quit command from user */
 #define DEBUGGER_FLAG_EXIT              (1 << 7)
 
@@ -385,31 +451,102 @@ static DebuggerPopup g_popups[NR_DEBUGGER_POPUPS] = {
 #define DEBUGGER_MENU_ROWS              S_COLS
 #define DEBUGGER_MENU_COLS              1
 
+/* Range of debugger refresh rates (in Hz) that can be set from command line */
+#define DEBUGGER_MIN_REFRESH_RATE       10
+#define DEBUGGER_MAX_REFRESH_RATE       30
+#define DEBUGGER_DEFAULT_REFRESH_RATE   20
+
+/* Commands debugger thread sends to the emulation thread */
+typedef enum {
+    DEBUGGER_COMMAND_PAUSE = 0,
+    DEBUGGER_COMMAND_RESUME,
+    DEBUGGER_COMMAND_STEP,
+    DEBUGGER_COMMAND_QUIT,
+    DEBUGGER_COMMAND_SET_BREAKPOINT,
+    DEBUGGER_COMMAND_CLEAR_BREAKPOINT,
+    DEBUGGER_COMMAND_SET_WATCHPOINT,
+    DEBUGGER_COMMAND_CLEAR_WATCHPOINTS,
+
+    NR_DEBUGGER_COMMANDS
+} DebuggerCommandType;
+
+typedef struct _DebuggerCommand {
+    BYTE type;                  /* DebuggerCommandType */
+    Breakpoint breakpoint;      /* Compiled breakpoint to set (or just it's address to clear) */
+    WORD addr;                  /* Start of a memory range to watch */
+    WORD length;                /* Number of bytes in it */
+} DebuggerCommand;
+
+/* Must be a power of 2, commands come from keys so it hardly ever fills up */
+#define DEBUGGER_COMMAND_QUEUE_SIZE     32
+
+/* Lock-free single producer single consumer queue of debugger commands
+ * Debugger thread pushes and emulation thread pops, neither ever waits
+ * (head and tail only grow, indices are taken modulo DEBUGGER_COMMAND_QUEUE_SIZE)
+ */
+typedef struct _DebuggerCommandQueue {
+    DebuggerCommand commands[DEBUGGER_COMMAND_QUEUE_SIZE];
+    SDL_atomic_t head;          /* Next command to pop (written by consumer) */
+    SDL_atomic_t tail;          /* Next free slot (written by producer) */
+} DebuggerCommandQueue;
+
+/* Copy of a core that emulation thread publishes for the debugger thread
+ * It's a seqlock: sequence is odd while a copy is being written and a reader
+ * copies it again if sequence was odd or changed while it was copying, so
+ * debugger never sees a core that's half one state and half another
+ * and emulation never waits for debugger
+ */
+typedef struct _CoreSnapshot {
+    SDL_atomic_t sequence;
+    C8core core;
+    BYTE held;                  /* Debugger holds execution */
+    BreakpointSet breakpoints;
+    DWORD commands;             /* Number of commands emulation handled before publishing */
+} CoreSnapshot;
+
 /* A struct (should be a singleton) that defines the whole debugger context */
 typedef struct _Debugger {
     /* Pointer to all DebuggerWindow structs */
 	DebuggerWindow *windows[DEBUG_WINDOW_COUNT];
 
-	const C8core *core;         /* Pointer to a cheap8 core */
+	const C8core *core;         /* Pointer to a core state windows are drawn from (view) */
 	BYTE flags;                 /* 8 debugger flags */
 
     DebuggerWindow *current;    /* Pointer to currently selected window */
     int lastInput;              /* Last keyboard input */
 
     WINDOW *menuwin;            /* ncurses WINDOW handler for debugger menu */
+    QWORD menuVersion;          /* Stamp of the state menu was last drawn from */
 
     DebuggerPopup *popup;       /* Pointer to a current invoked popup menu */
     WINDOW *popup_win;          /* ncurses WINDOW for a current popup */
     WINDOW *popup_sub;          /* ncurses WINDOW for a current popup's subwindow*/
     PANEL *popup_pan;           /* ncurses PANEL for a current popup */
     PANEL *popup_sub_pan;       /* ncurses PANEL for a current popup's subwindow */
+
+    C8core view;                /* Core as of the last snapshot debugger has read */
+    int viewSequence;           /* Sequence number of that snapshot */
+    BreakpointSet viewBreakpoints;  /* Breakpoints as of that snapshot */
+    QWORD seenHits;             /* Breakpoint hits debugger has already told about */
+    char message[BREAKPOINT_CONDITION_SIZE + 32];   /* Last breakpoint message shown in Current State */
+    CoreSnapshot snapshot;      /* Written by emulation thread, read by debugger thread */
+    DebuggerCommandQueue commands;
+    Uint32 wakeEvent;           /* SDL event type pushed after every command to wake emulation up */
+    int wakeFds[2];             /* Pipe that wakes debugger thread up while it waits for input */
+
+    SDL_Thread *thread;         /* Debugger thread, the only one that touches ncurses */
+    SDL_atomic_t quit;          /* Non zero when debugger thread has to stop */
+    Uint32 refreshInterval;     /* Time between debugger updates (in ms) */
 } Debugger;
 
 void initMenu(Debugger *dbg);
 void updateMenu(Debugger *dbg, DebuggerWindow *dwin);
 VM_RESULT updateDebugger(Debugger *dbg);
+void publishCoreSnapshot(Debugger *dbg, const C8core *core, const BreakpointSet *breakpoints, BYTE held);
+BYTE pushDebuggerCommand(Debugger *dbg, BYTE type, const Breakpoint *breakpoint);
+BYTE popDebuggerCommand(Debugger *dbg, DebuggerCommand *command);
 void initWindow(Debugger *dbg, DebuggerWindow *window);
-VM_RESULT initDebugger(Debugger **m_dbg, const C8core *_core);
+VM_RESULT initDebugger(Debugger **m_dbg, const C8core *_core, BYTE refreshRate);
 VM_RESULT destroyDebugger(Debugger **m_dbg);
 
 #endif /* _C8DEBUG_H_ */
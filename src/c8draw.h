@@ -0,0 +1,145 @@
+/**
+ * Cheap-8: a chip-8 emulator
+ *
+ * File: c8draw.h
+ * License: DWYW - "Do Whatever You Want"
+ *
+ * Sprite drawing kernel used by DXYN handlers: sprite rows are turned into
+ * screen row masks and XORed into core->gfx several rows at a time with SSE2
+ * or AVX2 (whichever the compiler targets) with a plain C fallback
+ */
+
+#ifndef _C8DRAW_H_
+#define _C8DRAW_H_
+
+#include "c8core.h"
+
+#if defined(__AVX2__)
+#	include <immintrin.h>
+#	define DRAW_SIMD_AVX2
+#endif
+
+#if defined(__SSE2__)
+#	include <emmintrin.h>
+#	define DRAW_SIMD_SSE2
+#endif
+
+// The tallest sprite DXYN can draw (N is a single nibble)
+#define SPRITE_MAX_HEIGHT	15
+
+// Shift that puts a sprite byte at the leftmost pixel of a screen row
+#define SPRITE_ROW_SHIFT	(SCREEN_RESOLUTION_WIDTH - 8)
+
+/** gatherSpriteRows
+ *
+ * @param rows
+ *  Array of at least SPRITE_MAX_HEIGHT rows to be filled
+ * @param memory
+ *  Memory of a core
+ * @param I
+ *  Address of the first sprite byte
+ * @param count
+ *  Number of sprite bytes
+ * @description:
+ *  Loads sprite bytes as screen rows with a sprite at x = 0
+ *  (sprite that goes over the end of memory continues from it's start)
+ */
+static inline void gatherSpriteRows(QWORD *rows, const BYTE *memory, WORD I, BYTE count) {
+	for (BYTE i = 0; i < count; i++)
+		rows[i] = (QWORD) memory[(I + i) & (MEMORY_SIZE - 1)] << SPRITE_ROW_SHIFT;
+}
+
+/** xorSpriteRows
+ *
+ * @param gfx
+ *  First screen row to draw at
+ * @param rows
+ *  Sprite rows from gatherSpriteRows
+ * @param count
+ *  Number of consecutive screen rows to draw
+ * @param x
+ *  Horizontal coordinate of a sprite (pixels past the right edge are clipped)
+ * @description:
+ *  Shifts sprite rows into place and XORs them into the screen
+ *  Returns non zero value if any of the pixels were turned off (i.e. VF)
+ */
+static inline QWORD xorSpriteRows(QWORD *gfx, const QWORD *rows, BYTE count, BYTE x) {
+	QWORD collision = 0;
+	BYTE i = 0;
+
+#ifdef DRAW_SIMD_AVX2
+	__m128i shift256 = _mm_cvtsi32_si128(x);
+	__m256i hits256 = _mm256_setzero_si256();
+
+	for (; i + 4 <= count; i += 4) {
+		__m256i mask = _mm256_srl_epi64(_mm256_loadu_si256((const __m256i*) &rows[i]), shift256);
+		__m256i screen = _mm256_loadu_si256((const __m256i*) &gfx[i]);
+
+		hits256 = _mm256_or_si256(hits256, _mm256_and_si256(screen, mask));
+		_mm256_storeu_si256((__m256i*) &gfx[i], _mm256_xor_si256(screen, mask));
+	}
+
+	collision |= !_mm256_testz_si256(hits256, hits256);
+#endif
+
+#ifdef DRAW_SIMD_SSE2
+	__m128i shift = _mm_cvtsi32_si128(x);
+	__m128i hits = _mm_setzero_si128();
+
+	for (; i + 2 <= count; i += 2) {
+		__m128i mask = _mm_srl_epi64(_mm_loadu_si128((const __m128i*) &rows[i]), shift);
+		__m128i screen = _mm_loadu_si128((const __m128i*) &gfx[i]);
+
+		hits = _mm_or_si128(hits, _mm_and_si128(screen, mask));
+		_mm_storeu_si128((__m128i*) &gfx[i], _mm_xor_si128(screen, mask));
+	}
+
+	collision |= _mm_movemask_epi8(_mm_cmpeq_epi8(hits, _mm_setzero_si128())) != 0xFFFF;
+#endif
+
+	for (; i < count; i++) {
+		QWORD mask = rows[i] >> x;
+
+		collision |= gfx[i] & mask;
+		gfx[i] ^= mask;
+	}
+
+	return collision;
+}
+
+/** drawSprite
+ *
+ * @param core
+ *  Pointer to C8core struct representing a chip-8 system core
+ * @param x
+ *  Horizontal coordinate (already within the screen)
+ * @param y
+ *  Vertical coordinate (already within the screen)
+ * @param height
+ *  Number of sprite rows (N of DXYN)
+ * @param clip
+ *  Rows past the bottom of the screen are dropped if non zero
+ *  and wrap around to the top otherwise
+ * @description:
+ *  Draws a sprite from memory at I, marks rows it covers in core->dirtyRows
+ *  and returns value for VF
+ */
+static inline BYTE drawSprite(C8core *core, BYTE x, BYTE y, BYTE height, BYTE clip) {
+	QWORD rows[SPRITE_MAX_HEIGHT];
+	gatherSpriteRows(rows, core->memory, core->I, height);
+
+	BYTE below = SCREEN_RESOLUTION_HEIGHT - y;
+	BYTE top = height < below ? height : below;
+
+	QWORD collision = xorSpriteRows(&core->gfx[y], rows, top, x);
+	core->dirtyRows |= (DWORD) ((((QWORD) 1 << top) - 1) << y);
+
+	if (!clip && top < height) {
+		collision |= xorSpriteRows(core->gfx, &rows[top], height - top, x);
+		core->dirtyRows |= (1u << (height - top)) - 1;
+	}
+
+	return collision != 0;
+}
+
+#endif  /* _C8DRAW_H_ */
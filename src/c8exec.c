@@ -0,0 +1,467 @@
+/**
+ * Cheap-8: a chip-8 emulator
+ *
+ * File: c8exec.c
+ * License: DWYW - "Do Whatever You Want"
+ *
+ * Execution engines that run opcodes on a C8core
+ */
+
+#include "c8exec.h"
+
+const ExecEngine ENGINES[ENGINE_COUNT] = {
+	{"interp", runCyclesInterpreter, "Calls an opcode handler through OPCODES for every opcode"},
+	{"threaded", runCycles, "Direct threaded dispatch with operands decoded inline (default)"},
+	{"block", runCyclesBlocks, "Runs whole pre-decoded basic blocks from a cache"},
+	{"jit", runCyclesJit, "Compiles hot blocks into native x86-64 code"},
+	{"diff", runCyclesDiff, "Runs jit engine and checks every run against the interpreter"},
+	{"native", runCyclesNative, "Runs a ROM recompiled with c8recomp (interpreter for any other ROM)"}
+};
+
+/** getEngineByName
+ *
+ * @param name
+ *  Name of an engine (i.e. ExecEngine.name)
+ * @description:
+ *  Looks up an execution engine by it's name
+ *  Returns NULL if there is no engine with a given name
+ */
+const ExecEngine *getEngineByName(const char *name) {
+	for (BYTE i = 0; i < ENGINE_COUNT; i++) {
+		if (strcmp(ENGINES[i].name, name) == 0)
+			return &ENGINES[i];
+	}
+
+	return NULL;
+}
+
+/** runCyclesInterpreter
+ *
+ * @param core
+ *  Pointer to C8core struct representing a chip-8 system core
+ * @param cycles
+ *  Number of opcodes to run
+ * @description:
+ *  Reference engine, fetches each opcode into core->opcode and
+ *  runs it with processOpcode
+ */
+DWORD runCyclesInterpreter(C8core *core, DWORD cycles) {
+	DWORD ran = 0;
+
+	for (; ran < cycles; ran++) {
+		core->opcode = GET_WORD(core->memory[core->PC], core->memory[core->PC + 1]);
+		processOpcode(core);
+	}
+
+	return ran;
+}
+
+// ========================================================================================================
+
+// Opcode parameters extracted straight from a raw opcode word
+#define OP_X(raw)		(((raw) >> 8) & 0x0F)
+#define OP_Y(raw)		(((raw) >> 4) & 0x0F)
+#define OP_N(raw)		((raw) & 0x000F)
+#define OP_NN(raw)		((raw) & 0x00FF)
+#define OP_NNN(raw)		((raw) & 0x0FFF)
+
+// Computed goto is a GNU extension so other compilers get a plain switch
+#if defined(__GNUC__)
+#	define ENGINE_THREADED_DISPATCH
+#endif
+
+/* Calls a regular opcode handler from within runCycles
+ * PC and I are kept in local variables there so they have to be written
+ * back before a handler is called and reloaded after it returns
+ */
+#define CALL_HANDLER(handler, x, y, n) \
+	do { \
+		core->PC = PC; \
+		core->I = I; \
+		handler(core, x, y, n); \
+		PC = core->PC; \
+		I = core->I; \
+	} while (0)
+
+/* Skip next opcode, same rules as in skip opcode handlers in opcodes.c */
+#define SKIP_IF(cond) \
+	do { \
+		if (cond) { \
+			if (PC + OPCODE_SIZE > MEMORY_SIZE) \
+				SET_CUSTOM_FLAG(core, CUSTOM_FLAG_BAD_MEMORY); \
+			else \
+				PC += OPCODE_SIZE; \
+		} \
+	} while (0)
+
+/** runCycles
+ *
+ * @param core
+ *  Pointer to C8core struct representing a chip-8 system core
+ * @param cycles
+ *  Number of opcodes to run
+ * @description:
+ *  Direct threaded engine: every opcode body ends with it's own fetch and
+ *  dispatch to the next opcode body (computed goto), operands are taken
+ *  from a raw opcode word in place and PC and I live in local variables
+ *  for the whole run
+ *  Opcodes that are either rare or heavy just call their regular handlers
+ *  so the architectural effects are exactly the same as with processOpcode
+ *
+ *  Note that core->opcode, core->xParam, core->yParam and core->nParam
+ *  are not maintained by this engine
+ */
+DWORD runCycles(C8core *core, DWORD cycles) {
+	BYTE *V = core->reg;
+	const BYTE *mem = core->memory;
+	WORD PC = core->PC;
+	WORD I = core->I;
+	WORD raw = 0;
+	DWORD ran = 0;
+
+	// Quirk dependent opcodes call handlers of a selected profile, except
+	// for 8XY1-8XY3 where VF reset is a mask that's all ones without it
+	const OPCODE_HANDLER *quirk = g_quirkProfile->handlers;
+	const BYTE keepVF = g_quirkProfile->quirks & QUIRK_VF_RESET ? 0 : 0xFF;
+
+#ifdef ENGINE_THREADED_DISPATCH
+	static const void *labels[OPCODE_COUNT] = {
+		[OP_CLEAR_SCREEN]		= &&L_OP_CLEAR_SCREEN,
+		[OP_RETURN]				= &&L_OP_RETURN,
+		[OP_JUMP]				= &&L_OP_JUMP,
+		[OP_CALL_SUBR]			= &&L_OP_CALL_SUBR,
+		[OP_SKIP_EQ]			= &&L_OP_SKIP_EQ,
+		[OP_SKIP_NEQ]			= &&L_OP_SKIP_NEQ,
+		[OP_SKIP_EQ_REG]		= &&L_OP_SKIP_EQ_REG,
+		[OP_SET_CONST]			= &&L_OP_SET_CONST,
+		[OP_ADD_CONST]			= &&L_OP_ADD_CONST,
+		[OP_SET_REG]			= &&L_OP_SET_REG,
+		[OP_OR_REG]				= &&L_OP_OR_REG,
+		[OP_AND_REG]			= &&L_OP_AND_REG,
+		[OP_XOR_REG]			= &&L_OP_XOR_REG,
+		[OP_ADD_REG]			= &&L_OP_ADD_REG,
+		[OP_SUB_REG]			= &&L_OP_SUB_REG,
+		[OP_SHRIGHT_1]			= &&L_OP_SHRIGHT_1,
+		[OP_REV_SUB_REG]		= &&L_OP_REV_SUB_REG,
+		[OP_SHLEFT_1]			= &&L_OP_SHLEFT_1,
+		[OP_SKIP_NEQ_REG]		= &&L_OP_SKIP_NEQ_REG,
+		[OP_SET_IDX]			= &&L_OP_SET_IDX,
+		[OP_JUMP_FROM_V0]		= &&L_OP_JUMP_FROM_V0,
+		[OP_SET_RANDOM]			= &&L_OP_SET_RANDOM,
+		[OP_DRAW]				= &&L_OP_DRAW,
+		[OP_SKIP_KPRESS]		= &&L_OP_SKIP_KPRESS,
+		[OP_SKIP_NKPRESS]		= &&L_OP_SKIP_NKPRESS,
+		[OP_SAVE_DELAY]			= &&L_OP_SAVE_DELAY,
+		[OP_WAIT_KEY]			= &&L_OP_WAIT_KEY,
+		[OP_SET_DELAY]			= &&L_OP_SET_DELAY,
+		[OP_SET_SOUND]			= &&L_OP_SET_SOUND,
+		[OP_ADD_IDX]			= &&L_OP_ADD_IDX,
+		[OP_SET_IDX_SPRITE]		= &&L_OP_SET_IDX_SPRITE,
+		[OP_SET_BCD]			= &&L_OP_SET_BCD,
+		[OP_DUMP_REGS]			= &&L_OP_DUMP_REGS,
+		[OP_LOAD_REGS]			= &&L_OP_LOAD_REGS,
+		[OP_CALL_MCR]			= &&L_OP_CALL_MCR
+	};
+
+#	define OPCASE(op)	L_##op:
+#	define NEXT() \
+		do { \
+			if (ran == cycles) \
+				goto done; \
+			raw = GET_WORD(mem[PC], mem[PC + 1]); \
+			PC += OPCODE_SIZE; \
+			ran++; \
+			goto *labels[decodeOpcode(raw)->opidx]; \
+		} while (0)
+
+	NEXT();
+#else
+#	define OPCASE(op)	case op:
+#	define NEXT()		continue
+
+	for (;;) {
+		if (ran == cycles)
+			goto done;
+
+		raw = GET_WORD(mem[PC], mem[PC + 1]);
+		PC += OPCODE_SIZE;
+		ran++;
+
+		switch (decodeOpcode(raw)->opidx) {
+#endif
+
+	OPCASE(OP_CLEAR_SCREEN)
+		CALL_HANDLER(handle_OP_CLEAR_SCREEN, 0, 0, 0);
+		NEXT();
+
+	OPCASE(OP_RETURN)
+		if (core->SP > 0) {
+			core->SP -= 1;
+			PC = core->stack[core->SP];
+		} else {
+			SET_CUSTOM_FLAG(core, CUSTOM_FLAG_BAD_SP);
+		}
+		NEXT();
+
+	OPCASE(OP_JUMP)
+		if (OP_NNN(raw) < MEMORY_RANGE_PROGRAM_MIN)
+			SET_CUSTOM_FLAG(core, CUSTOM_FLAG_BAD_MEMORY);
+		else
+			PC = OP_NNN(raw);
+		NEXT();
+
+	OPCASE(OP_CALL_SUBR)
+		if (OP_NNN(raw) < MEMORY_RANGE_PROGRAM_MIN)
+			SET_CUSTOM_FLAG(core, CUSTOM_FLAG_BAD_MEMORY);
+		core->stack[core->SP] = PC;
+		core->SP += 1;
+		PC = OP_NNN(raw);
+		NEXT();
+
+	OPCASE(OP_SKIP_EQ)
+		SKIP_IF(V[OP_X(raw)] == OP_NN(raw));
+		NEXT();
+
+	OPCASE(OP_SKIP_NEQ)
+		SKIP_IF(V[OP_X(raw)] != OP_NN(raw));
+		NEXT();
+
+	OPCASE(OP_SKIP_EQ_REG)
+		SKIP_IF(V[OP_X(raw)] == V[OP_Y(raw)]);
+		NEXT();
+
+	OPCASE(OP_SET_CONST)
+		V[OP_X(raw)] = OP_NN(raw);
+		NEXT();
+
+	OPCASE(OP_ADD_CONST)
+		V[OP_X(raw)] += OP_NN(raw);
+		NEXT();
+
+	OPCASE(OP_SET_REG)
+		V[OP_X(raw)] = V[OP_Y(raw)];
+		NEXT();
+
+	OPCASE(OP_OR_REG)
+		V[OP_X(raw)] |= V[OP_Y(raw)];
+		V[REG_VF] &= keepVF;
+		NEXT();
+
+	OPCASE(OP_AND_REG)
+		V[OP_X(raw)] &= V[OP_Y(raw)];
+		V[REG_VF] &= keepVF;
+		NEXT();
+
+	OPCASE(OP_XOR_REG)
+		V[OP_X(raw)] ^= V[OP_Y(raw)];
+		V[REG_VF] &= keepVF;
+		NEXT();
+
+	OPCASE(OP_ADD_REG) {
+		WORD result = V[OP_X(raw)] + V[OP_Y(raw)];
+		V[REG_VF] = result >= (1 << 8) ? 1 : 0;
+		V[OP_X(raw)] = result & 0xFF;
+		NEXT();
+	}
+
+	OPCASE(OP_SUB_REG)
+		V[REG_VF] = V[OP_X(raw)] > V[OP_Y(raw)] ? 1 : 0;
+		V[OP_X(raw)] -= V[OP_Y(raw)];
+		NEXT();
+
+	OPCASE(OP_SHRIGHT_1)
+		CALL_HANDLER(quirk[OP_SHRIGHT_1], OP_X(raw), OP_Y(raw), PARAMETER_UNUSED);
+		NEXT();
+
+	OPCASE(OP_REV_SUB_REG)
+		V[REG_VF] = V[OP_Y(raw)] > V[OP_X(raw)] ? 1 : 0;
+		V[OP_X(raw)] = V[OP_Y(raw)] - V[OP_X(raw)];
+		NEXT();
+
+	OPCASE(OP_SHLEFT_1)
+		CALL_HANDLER(quirk[OP_SHLEFT_1], OP_X(raw), OP_Y(raw), PARAMETER_UNUSED);
+		NEXT();
+
+	OPCASE(OP_SKIP_NEQ_REG)
+		SKIP_IF(V[OP_X(raw)] != V[OP_Y(raw)]);
+		NEXT();
+
+	OPCASE(OP_SET_IDX)
+		I = OP_NNN(raw);
+		NEXT();
+
+	OPCASE(OP_JUMP_FROM_V0)
+		CALL_HANDLER(quirk[OP_JUMP_FROM_V0], 0, 0, OP_NNN(raw));
+		NEXT();
+
+	OPCASE(OP_SET_RANDOM)
+		CALL_HANDLER(handle_OP_SET_RANDOM, OP_X(raw), 0, OP_NN(raw));
+		NEXT();
+
+	OPCASE(OP_DRAW)
+		CALL_HANDLER(quirk[OP_DRAW], OP_X(raw), OP_Y(raw), OP_N(raw));
+		NEXT();
+
+	OPCASE(OP_SKIP_KPRESS)
+		CALL_HANDLER(handle_OP_SKIP_KPRESS, OP_X(raw), 0, PARAMETER_UNUSED);
+		NEXT();
+
+	OPCASE(OP_SKIP_NKPRESS)
+		CALL_HANDLER(handle_OP_SKIP_NKPRESS, OP_X(raw), 0, PARAMETER_UNUSED);
+		NEXT();
+
+	OPCASE(OP_SAVE_DELAY)
+		V[OP_X(raw)] = core->tDelay;
+		NEXT();
+
+	OPCASE(OP_WAIT_KEY)
+		CALL_HANDLER(handle_OP_WAIT_KEY, OP_X(raw), 0, PARAMETER_UNUSED);
+		NEXT();
+
+	OPCASE(OP_SET_DELAY)
+		core->tDelay = V[OP_X(raw)];
+		NEXT();
+
+	OPCASE(OP_SET_SOUND)
+		core->tSound = V[OP_X(raw)];
+		NEXT();
+
+	OPCASE(OP_ADD_IDX)
+		if (I + V[OP_X(raw)] > MEMORY_SIZE)
+			SET_CUSTOM_FLAG(core, CUSTOM_FLAG_BAD_MEMORY);
+		else
+			I += V[OP_X(raw)];
+		NEXT();
+
+	OPCASE(OP_SET_IDX_SPRITE)
+		I = MEMORY_RANGE_FONTSET_MIN + (FONT_ENTITY_SIZE * V[OP_X(raw)]);
+		NEXT();
+
+	OPCASE(OP_SET_BCD)
+		CALL_HANDLER(handle_OP_SET_BCD, OP_X(raw), 0, PARAMETER_UNUSED);
+		NEXT();
+
+	OPCASE(OP_DUMP_REGS)
+		CALL_HANDLER(quirk[OP_DUMP_REGS], OP_X(raw), 0, PARAMETER_UNUSED);
+		NEXT();
+
+	OPCASE(OP_LOAD_REGS)
+		CALL_HANDLER(quirk[OP_LOAD_REGS], OP_X(raw), 0, PARAMETER_UNUSED);
+		NEXT();
+
+	OPCASE(OP_CALL_MCR)
+		CALL_HANDLER(handle_OP_CALL_MCR, 0, 0, PARAMETER_UNUSED);
+		NEXT();
+
+#ifndef ENGINE_THREADED_DISPATCH
+		}
+	}
+#endif
+
+#undef OPCASE
+#undef NEXT
+
+done:
+	core->PC = PC;
+	core->I = I;
+
+	return ran;
+}
+
+// ========================================================================================================
+
+// Shadow core run by the interpreter next to a core run by runCyclesDiff
+static C8core *g_shadowCore = NULL;
+static const C8core *g_shadowCoreOwner = NULL;
+
+/** diffCores
+ *
+ * @param a
+ *  Pointer to the first C8core struct
+ * @param b
+ *  Pointer to the second C8core struct
+ * @description:
+ *  Compares everything that a ROM can observe or change
+ *  Fields used only by a specific engine or by a VM itself
+ *  (current opcode and parameters, code pages, ticks) are not compared
+ */
+const char *diffCores(const C8core *a, const C8core *b) {
+	if (a->PC != b->PC)
+		return "PC";
+	if (a->I != b->I)
+		return "I";
+	if (a->SP != b->SP)
+		return "SP";
+	if (memcmp(a->reg, b->reg, sizeof(a->reg)) != 0)
+		return "registers";
+	if (memcmp(a->stack, b->stack, sizeof(a->stack)) != 0)
+		return "stack";
+	if (a->tDelay != b->tDelay || a->tSound != b->tSound)
+		return "timers";
+	if (a->customFlags != b->customFlags)
+		return "flags";
+	if (a->randState != b->randState)
+		return "random state";
+	if (memcmp(a->gfx, b->gfx, sizeof(a->gfx)) != 0)
+		return "screen";
+	if (memcmp(a->memory, b->memory, sizeof(a->memory)) != 0)
+		return "memory";
+
+	return NULL;
+}
+
+/** runCyclesDiff
+ *
+ * @param core
+ *  Pointer to C8core struct representing a chip-8 system core
+ * @param cycles
+ *  Number of opcodes to run
+ * @description:
+ *  Differential mode: runs a core with runCyclesJit and then runs the same
+ *  number of opcodes on a shadow copy of a core with runCyclesInterpreter
+ *  If states differ afterwards the mismatch is logged, CUSTOM_FLAG_CRITICAL_ERROR
+ *  is set and shadow core is synced with the main one again
+ *  Timers, keypad and flags are changed by VM between runs so they are
+ *  copied into a shadow core before every run
+ */
+DWORD runCyclesDiff(C8core *core, DWORD cycles) {
+	if (g_shadowCore == NULL) {
+		g_shadowCore = (C8core*) malloc(sizeof(C8core));
+		if (g_shadowCore == NULL)
+			return runCyclesJit(core, cycles);
+	}
+
+	if (g_shadowCoreOwner != core) {
+		memcpy(g_shadowCore, core, sizeof(C8core));
+		g_shadowCoreOwner = core;
+	}
+
+	g_shadowCore->tDelay = core->tDelay;
+	g_shadowCore->tSound = core->tSound;
+	g_shadowCore->keypadState = core->keypadState;
+	g_shadowCore->customFlags = core->customFlags;
+
+	WORD startPC = core->PC;
+	DWORD ran = runCyclesJit(core, cycles);
+	runCyclesInterpreter(g_shadowCore, ran);
+
+	const char *mismatch = diffCores(core, g_shadowCore);
+	if (mismatch != NULL) {
+		logToFile("Engine mismatch in %s after running %u opcodes from 0x%03X (PC 0x%03X vs 0x%03X)\n",
+				mismatch, ran, startPC, core->PC, g_shadowCore->PC);
+		SET_CUSTOM_FLAG(core, CUSTOM_FLAG_CRITICAL_ERROR);
+		memcpy(g_shadowCore, core, sizeof(C8core));
+	}
+
+	return ran;
+}
+
+// Frees memory held by execution engines (block cache, JIT buffer, shadow core)
+void destroyExecEngines() {
+	destroyBlockCache();
+	destroyJit();
+
+	free(g_shadowCore);
+	g_shadowCore = NULL;
+	g_shadowCoreOwner = NULL;
+}
@@ -0,0 +1,60 @@
+/**
+ * Cheap-8: a chip-8 emulator
+ *
+ * File: c8exec.h
+ * License: DWYW - "Do Whatever You Want"
+ *
+ * Execution engines i.e. different ways of running opcodes on a C8core
+ * Each engine is selectable at startup and is used by VM through the
+ * same runner function signature
+ */
+
+#ifndef _C8EXEC_H_
+#define _C8EXEC_H_
+
+#include "opcodes.h"
+#include "c8block.h"
+#include "c8jit.h"
+#include "c8recomp.h"
+
+// Function pointer type for an execution engine entry point
+// Runs at most a given number of opcodes on a core and returns
+// how many opcodes were actually run
+typedef DWORD (*ENGINE_RUNNER)(C8core*, DWORD);
+
+typedef enum {
+	ENGINE_INTERPRETER,     // Fetch, decode and call a handler for every opcode (processOpcode)
+	ENGINE_THREADED,        // Direct threaded dispatch with operands decoded inline
+	ENGINE_BLOCK,           // Runs whole pre-decoded basic blocks from a cache
+	ENGINE_JIT,             // Compiles hot blocks into native code (x86-64 only)
+	ENGINE_DIFF,            // Runs JIT and checks it against the interpreter on a shadow core
+	ENGINE_NATIVE,          // Runs a ROM recompiled ahead of time with c8recomp
+
+	ENGINE_COUNT
+} ExecEngineType;
+
+// Data structure describing a single execution engine
+typedef struct _ExecEngine {
+	const char *name;           // Name used to select an engine from command line
+	ENGINE_RUNNER run;          // Engine entry point
+	const char *description;    // Brief description for a help message
+} ExecEngine;
+
+#define DEFAULT_EXEC_ENGINE     ENGINE_THREADED
+
+extern const ExecEngine ENGINES[ENGINE_COUNT];
+
+// Returns an engine with a given name or NULL if there is no such engine
+const ExecEngine *getEngineByName(const char *name);
+
+DWORD runCyclesInterpreter(C8core *core, DWORD cycles);
+DWORD runCycles(C8core *core, DWORD cycles);
+DWORD runCyclesDiff(C8core *core, DWORD cycles);
+
+// Compares guest visible state of two cores
+// Returns name of the first field that differs or NULL if they are the same
+const char *diffCores(const C8core *a, const C8core *b);
+
+void destroyExecEngines();
+
+#endif  /* _C8EXEC_H_ */
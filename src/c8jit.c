@@ -0,0 +1,631 @@
+/**
+ * Cheap-8: a chip-8 emulator
+ *
+ * File: c8jit.c
+ * License: DWYW - "Do Whatever You Want"
+ *
+ * Dynamic recompiler: blocks from the block cache that were run at least
+ * JIT_HOT_THRESHOLD times are translated into native x86-64 code
+ *
+ * Compiled block is a function void (*)(C8core*) that keeps a pointer to
+ * a core in rbx and up to JIT_CACHED_REGISTERS most used guest registers
+ * in r12 - r15 (all callee saved so they survive calls into C)
+ * Simple opcodes (loads, ALU, index register, timers, skips and jumps) are
+ * emitted inline, everything else is a call into it's regular handler
+ * with guest registers written back to core before and reloaded after
+ */
+
+#include "c8jit.h"
+
+#ifdef JIT_ENABLED
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+// x86-64 register numbers as used in ModRM and REX
+#define HOST_RAX	0
+#define HOST_RCX	1
+#define HOST_RDX	2
+#define HOST_RBX	3
+#define HOST_R12	12
+
+// Short conditional and unconditional jump opcodes
+#define HOST_JE		0x74
+#define HOST_JNE	0x75
+#define HOST_JA		0x77
+#define HOST_JMP	0xEB
+
+// Offsets of core fields addressed from compiled code as [rbx + offset]
+#define CORE_OFFSET_REG(r)		(offsetof(C8core, reg) + (r))
+#define CORE_OFFSET_I			offsetof(C8core, I)
+#define CORE_OFFSET_PC			offsetof(C8core, PC)
+#define CORE_OFFSET_DELAY		offsetof(C8core, tDelay)
+#define CORE_OFFSET_SOUND		offsetof(C8core, tSound)
+#define CORE_OFFSET_FLAGS		offsetof(C8core, customFlags)
+
+// State of a single block compilation
+typedef struct _JitEmitter {
+	BYTE *code;                                 // Start of a native code of a block
+	DWORD size;                                 // Number of bytes emitted so far
+	signed char hostReg[GENERAL_PURPOSE_REGISTERS]; // Host register holding a guest register or -1
+	BYTE cached[JIT_CACHED_REGISTERS];          // Guest registers held in host registers
+	BYTE cachedCount;
+} JitEmitter;
+
+static BYTE *g_jitBuffer = NULL;
+static DWORD g_jitBufferUsed = 0;
+static BYTE g_jitBroken = 0;
+
+// ========================================================================================================
+
+static inline void emit8(JitEmitter *em, BYTE value) {
+	em->code[em->size++] = value;
+}
+
+static inline void emit16(JitEmitter *em, WORD value) {
+	memcpy(&em->code[em->size], &value, sizeof(value));
+	em->size += sizeof(value);
+}
+
+static inline void emit32(JitEmitter *em, DWORD value) {
+	memcpy(&em->code[em->size], &value, sizeof(value));
+	em->size += sizeof(value);
+}
+
+static inline void emit64(JitEmitter *em, QWORD value) {
+	memcpy(&em->code[em->size], &value, sizeof(value));
+	em->size += sizeof(value);
+}
+
+// ModRM for [rbx + disp32] memory operand
+static inline void emitCoreOperand(JitEmitter *em, BYTE reg, DWORD offset) {
+	emit8(em, 0x80 | ((reg & 7) << 3) | HOST_RBX);
+	emit32(em, offset);
+}
+
+// Emits a short jump and returns a position of it's displacement
+static inline DWORD emitJump(JitEmitter *em, BYTE opcode) {
+	emit8(em, opcode);
+	emit8(em, 0);
+	return em->size - 1;
+}
+
+// Points a short jump emitted with emitJump at current position
+static inline void patchJump(JitEmitter *em, DWORD at) {
+	em->code[at] = (BYTE) (em->size - at - 1);
+}
+
+// movzx dst32, Vr
+static void emitLoadV(JitEmitter *em, BYTE dst, BYTE r) {
+	if (em->hostReg[r] >= 0) {
+		emit8(em, 0x41);
+		emit8(em, 0x8B);
+		emit8(em, 0xC0 | (dst << 3) | (em->hostReg[r] & 7));
+	} else {
+		emit8(em, 0x0F);
+		emit8(em, 0xB6);
+		emitCoreOperand(em, dst, CORE_OFFSET_REG(r));
+	}
+}
+
+// Vr = src8
+static void emitStoreV(JitEmitter *em, BYTE r, BYTE src) {
+	if (em->hostReg[r] >= 0) {
+		emit8(em, 0x44);
+		emit8(em, 0x0F);
+		emit8(em, 0xB6);
+		emit8(em, 0xC0 | ((em->hostReg[r] & 7) << 3) | src);
+	} else {
+		emit8(em, 0x88);
+		emitCoreOperand(em, src, CORE_OFFSET_REG(r));
+	}
+}
+
+// Vr = imm8
+static void emitStoreVImm(JitEmitter *em, BYTE r, BYTE value) {
+	if (em->hostReg[r] >= 0) {
+		emit8(em, 0x41);
+		emit8(em, 0xB8 | (em->hostReg[r] & 7));
+		emit32(em, value);
+	} else {
+		emit8(em, 0xC6);
+		emitCoreOperand(em, 0, CORE_OFFSET_REG(r));
+		emit8(em, value);
+	}
+}
+
+// Writes guest registers held in host registers back into core
+static void emitSpill(JitEmitter *em) {
+	for (BYTE i = 0; i < em->cachedCount; i++) {
+		BYTE r = em->cached[i];
+		emit8(em, 0x44);
+		emit8(em, 0x88);
+		emitCoreOperand(em, em->hostReg[r], CORE_OFFSET_REG(r));
+	}
+}
+
+// Loads guest registers that are held in host registers from core
+static void emitReload(JitEmitter *em) {
+	for (BYTE i = 0; i < em->cachedCount; i++) {
+		BYTE r = em->cached[i];
+		emit8(em, 0x44);
+		emit8(em, 0x0F);
+		emit8(em, 0xB6);
+		emitCoreOperand(em, em->hostReg[r], CORE_OFFSET_REG(r));
+	}
+}
+
+// mov word [core->PC], pc
+static void emitSetPC(JitEmitter *em, WORD pc) {
+	emit8(em, 0x66);
+	emit8(em, 0xC7);
+	emitCoreOperand(em, 0, CORE_OFFSET_PC);
+	emit16(em, pc);
+}
+
+// or byte [core->customFlags], flag
+static void emitSetFlag(JitEmitter *em, BYTE flag) {
+	emit8(em, 0x80);
+	emitCoreOperand(em, 1, CORE_OFFSET_FLAGS);
+	emit8(em, flag);
+}
+
+// Binary operation eax = eax <op> ecx where op is an "op r/m32, r32" opcode
+static inline void emitAluEaxEcx(JitEmitter *em, BYTE op) {
+	emit8(em, op);
+	emit8(em, 0xC8);
+}
+
+/* Skips next opcode if a condition that was just compared holds
+ * PC is set to the address of the next opcode first (skipJump is a jump
+ * over a skip taken when condition doesn't hold)
+ */
+static void emitSkip(JitEmitter *em, BYTE skipJump, WORD pc) {
+	emitSetPC(em, pc);
+	DWORD over = emitJump(em, skipJump);
+
+	if (pc + OPCODE_SIZE > MEMORY_SIZE)
+		emitSetFlag(em, CUSTOM_FLAG_BAD_MEMORY);
+	else
+		emitSetPC(em, pc + OPCODE_SIZE);
+
+	patchJump(em, over);
+}
+
+// Calls a regular opcode handler with guest state written back into core
+static void emitHandlerCall(JitEmitter *em, const BlockInstr *instr, WORD pc, BYTE isLast) {
+	emitSpill(em);
+	emitSetPC(em, pc);
+
+	emit8(em, 0x48);	// mov rdi, rbx
+	emit8(em, 0x89);
+	emit8(em, 0xDF);
+	emit8(em, 0xBE);	// mov esi, xParam
+	emit32(em, instr->xParam);
+	emit8(em, 0xBA);	// mov edx, yParam
+	emit32(em, instr->yParam);
+	emit8(em, 0xB9);	// mov ecx, nParam
+	emit32(em, instr->nParam);
+	emit8(em, 0x48);	// mov rax, handler
+	emit8(em, 0xB8);
+	emit64(em, (QWORD) (uintptr_t) instr->handler);
+	emit8(em, 0xFF);	// call rax
+	emit8(em, 0xD0);
+
+	if (!isLast)
+		emitReload(em);
+}
+
+// ========================================================================================================
+
+// Returns non zero if an opcode is emitted inline rather than as a handler call
+static BYTE isInlineOpcode(BYTE opidx) {
+	switch (opidx) {
+	case OP_JUMP:
+	case OP_SKIP_EQ:
+	case OP_SKIP_NEQ:
+	case OP_SKIP_EQ_REG:
+	case OP_SKIP_NEQ_REG:
+	case OP_SET_CONST:
+	case OP_ADD_CONST:
+	case OP_SET_REG:
+	case OP_OR_REG:
+	case OP_AND_REG:
+	case OP_XOR_REG:
+	case OP_ADD_REG:
+	case OP_SUB_REG:
+	case OP_REV_SUB_REG:
+	case OP_SET_IDX:
+	case OP_SAVE_DELAY:
+	case OP_SET_DELAY:
+	case OP_SET_SOUND:
+	case OP_ADD_IDX:
+	case OP_SET_IDX_SPRITE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Picks guest registers used by inline opcodes most often and assigns them host registers
+static void allocateRegisters(JitEmitter *em, const Block *block) {
+	WORD uses[GENERAL_PURPOSE_REGISTERS] = {0};
+
+	for (BYTE i = 0; i < block->length; i++) {
+		const BlockInstr *instr = &block->instrs[i];
+		if (!isInlineOpcode(instr->opidx) || instr->opidx == OP_JUMP || instr->opidx == OP_SET_IDX)
+			continue;
+
+		uses[instr->xParam & 0x0F] += 1;
+
+		if (instr->yParam < GENERAL_PURPOSE_REGISTERS)
+			uses[instr->yParam] += 1;
+
+		if (instr->opidx == OP_ADD_REG || instr->opidx == OP_SUB_REG || instr->opidx == OP_REV_SUB_REG)
+			uses[REG_VF] += 1;
+	}
+
+	memset(em->hostReg, -1, sizeof(em->hostReg));
+	em->cachedCount = 0;
+
+	while (em->cachedCount < JIT_CACHED_REGISTERS) {
+		BYTE best = 0;
+		for (BYTE r = 1; r < GENERAL_PURPOSE_REGISTERS; r++) {
+			if (uses[r] > uses[best])
+				best = r;
+		}
+
+		// Not worth a load and a store around the block
+		if (uses[best] < 2)
+			break;
+
+		em->hostReg[best] = HOST_R12 + em->cachedCount;
+		em->cached[em->cachedCount++] = best;
+		uses[best] = 0;
+	}
+}
+
+// Emits a single inline opcode, returns non zero if it has set PC
+static BYTE emitInline(JitEmitter *em, const BlockInstr *instr, WORD pc) {
+	BYTE x = instr->xParam;
+	BYTE y = instr->yParam;
+	WORD n = instr->nParam;
+
+	switch (instr->opidx) {
+	case OP_JUMP:
+		if (n < MEMORY_RANGE_PROGRAM_MIN) {
+			emitSetFlag(em, CUSTOM_FLAG_BAD_MEMORY);
+			emitSetPC(em, pc);
+		} else {
+			emitSetPC(em, n);
+		}
+		return 1;
+
+	case OP_SKIP_EQ:
+	case OP_SKIP_NEQ:
+		emitLoadV(em, HOST_RAX, x);
+		emit8(em, 0x3D);	// cmp eax, imm32
+		emit32(em, n);
+		emitSkip(em, instr->opidx == OP_SKIP_EQ ? HOST_JNE : HOST_JE, pc);
+		return 1;
+
+	case OP_SKIP_EQ_REG:
+	case OP_SKIP_NEQ_REG:
+		emitLoadV(em, HOST_RAX, x);
+		emitLoadV(em, HOST_RCX, y);
+		emitAluEaxEcx(em, 0x39);	// cmp
+		emitSkip(em, instr->opidx == OP_SKIP_EQ_REG ? HOST_JNE : HOST_JE, pc);
+		return 1;
+
+	case OP_SET_CONST:
+		emitStoreVImm(em, x, (BYTE) n);
+		return 0;
+
+	case OP_ADD_CONST:
+		emitLoadV(em, HOST_RAX, x);
+		emit8(em, 0x05);	// add eax, imm32
+		emit32(em, n);
+		emitStoreV(em, x, HOST_RAX);
+		return 0;
+
+	case OP_SET_REG:
+		emitLoadV(em, HOST_RAX, y);
+		emitStoreV(em, x, HOST_RAX);
+		return 0;
+
+	case OP_OR_REG:
+	case OP_AND_REG:
+	case OP_XOR_REG:
+		emitLoadV(em, HOST_RAX, x);
+		emitLoadV(em, HOST_RCX, y);
+		emitAluEaxEcx(em, instr->opidx == OP_OR_REG ? 0x09 : instr->opidx == OP_AND_REG ? 0x21 : 0x31);
+		emitStoreV(em, x, HOST_RAX);
+
+		// Quirk profile is fixed for the whole run so VF reset is decided here
+		if (g_quirkProfile->quirks & QUIRK_VF_RESET)
+			emitStoreVImm(em, REG_VF, 0);
+		return 0;
+
+	case OP_ADD_REG:
+		emitLoadV(em, HOST_RAX, x);
+		emitLoadV(em, HOST_RCX, y);
+		emitAluEaxEcx(em, 0x01);	// add
+		emit8(em, 0x89);	// mov edx, eax
+		emit8(em, 0xC2);
+		emit8(em, 0xC1);	// shr edx, 8
+		emit8(em, 0xEA);
+		emit8(em, 0x08);
+		emitStoreV(em, REG_VF, HOST_RDX);
+		emitStoreV(em, x, HOST_RAX);
+		return 0;
+
+	// VF is written before subtraction just like in handlers
+	// so VF operand sees the new value
+	case OP_SUB_REG:
+	case OP_REV_SUB_REG: {
+		BYTE lhs = instr->opidx == OP_SUB_REG ? x : y;
+		BYTE rhs = instr->opidx == OP_SUB_REG ? y : x;
+
+		emitLoadV(em, HOST_RAX, lhs);
+		emitLoadV(em, HOST_RCX, rhs);
+		emitAluEaxEcx(em, 0x39);	// cmp
+		emit8(em, 0x0F);	// seta dl
+		emit8(em, 0x97);
+		emit8(em, 0xC2);
+		emitStoreV(em, REG_VF, HOST_RDX);
+		emitLoadV(em, HOST_RAX, lhs);
+		emitLoadV(em, HOST_RCX, rhs);
+		emitAluEaxEcx(em, 0x29);	// sub
+		emitStoreV(em, x, HOST_RAX);
+		return 0;
+	}
+
+	case OP_SET_IDX:
+		emit8(em, 0x66);	// mov word [core->I], imm16
+		emit8(em, 0xC7);
+		emitCoreOperand(em, 0, CORE_OFFSET_I);
+		emit16(em, n);
+		return 0;
+
+	case OP_SAVE_DELAY:
+		emit8(em, 0x0F);	// movzx eax, byte [core->tDelay]
+		emit8(em, 0xB6);
+		emitCoreOperand(em, HOST_RAX, CORE_OFFSET_DELAY);
+		emitStoreV(em, x, HOST_RAX);
+		return 0;
+
+	case OP_SET_DELAY:
+	case OP_SET_SOUND:
+		emitLoadV(em, HOST_RAX, x);
+		emit8(em, 0x88);	// mov byte [core->tDelay / core->tSound], al
+		emitCoreOperand(em, HOST_RAX, instr->opidx == OP_SET_DELAY ? CORE_OFFSET_DELAY : CORE_OFFSET_SOUND);
+		return 0;
+
+	case OP_ADD_IDX: {
+		emit8(em, 0x0F);	// movzx eax, word [core->I]
+		emit8(em, 0xB7);
+		emitCoreOperand(em, HOST_RAX, CORE_OFFSET_I);
+		emitLoadV(em, HOST_RCX, x);
+		emitAluEaxEcx(em, 0x01);	// add
+		emit8(em, 0x3D);	// cmp eax, MEMORY_SIZE
+		emit32(em, MEMORY_SIZE);
+		DWORD bad = emitJump(em, HOST_JA);
+		emit8(em, 0x66);	// mov word [core->I], ax
+		emit8(em, 0x89);
+		emitCoreOperand(em, HOST_RAX, CORE_OFFSET_I);
+		DWORD done = emitJump(em, HOST_JMP);
+		patchJump(em, bad);
+		emitSetFlag(em, CUSTOM_FLAG_BAD_MEMORY);
+		patchJump(em, done);
+		return 0;
+	}
+
+	case OP_SET_IDX_SPRITE:
+		emitLoadV(em, HOST_RAX, x);
+		emit8(em, 0x8D);	// lea eax, [rax + rax * 4 + MEMORY_RANGE_FONTSET_MIN]
+		emit8(em, 0x44);
+		emit8(em, 0x80);
+		emit8(em, MEMORY_RANGE_FONTSET_MIN);
+		emit8(em, 0x66);	// mov word [core->I], ax
+		emit8(em, 0x89);
+		emitCoreOperand(em, HOST_RAX, CORE_OFFSET_I);
+		return 0;
+
+	default:
+		return 0;
+	}
+}
+
+/** compileBlock
+ *
+ * @param block
+ *  Pointer to a cached block to be compiled
+ * @description:
+ *  Translates a block into native code in the JIT buffer
+ *  Caller has to make sure there is at least JIT_MAX_BLOCK_CODE bytes
+ *  left in the buffer
+ *  Returns NULL if there is no JIT buffer
+ */
+BLOCK_NATIVE compileBlock(Block *block) {
+	if (g_jitBuffer == NULL)
+		return NULL;
+
+	JitEmitter em;
+	em.code = g_jitBuffer + g_jitBufferUsed;
+	em.size = 0;
+
+	allocateRegisters(&em, block);
+
+	// Five pushes keep stack aligned to 16 bytes for handler calls
+	emit8(&em, 0x53);			// push rbx
+	emit8(&em, 0x41);			// push r12
+	emit8(&em, 0x54);
+	emit8(&em, 0x41);			// push r13
+	emit8(&em, 0x55);
+	emit8(&em, 0x41);			// push r14
+	emit8(&em, 0x56);
+	emit8(&em, 0x41);			// push r15
+	emit8(&em, 0x57);
+	emit8(&em, 0x48);			// mov rbx, rdi
+	emit8(&em, 0x89);
+	emit8(&em, 0xFB);
+
+	emitReload(&em);
+
+	BYTE pcSet = 0;
+	BYTE lastIsCall = 0;
+
+	for (BYTE i = 0; i < block->length; i++) {
+		const BlockInstr *instr = &block->instrs[i];
+		WORD pc = block->start + (i + 1) * OPCODE_SIZE;
+		BYTE isLast = i + 1 == block->length;
+
+		if (isInlineOpcode(instr->opidx)) {
+			pcSet = emitInline(&em, instr, pc);
+			lastIsCall = 0;
+		} else {
+			emitHandlerCall(&em, instr, pc, isLast);
+			pcSet = 1;
+			lastIsCall = 1;
+		}
+	}
+
+	if (!pcSet)
+		emitSetPC(&em, block->end);
+
+	if (!lastIsCall)
+		emitSpill(&em);
+
+	emit8(&em, 0x41);			// pop r15
+	emit8(&em, 0x5F);
+	emit8(&em, 0x41);			// pop r14
+	emit8(&em, 0x5E);
+	emit8(&em, 0x41);			// pop r13
+	emit8(&em, 0x5D);
+	emit8(&em, 0x41);			// pop r12
+	emit8(&em, 0x5C);
+	emit8(&em, 0x5B);			// pop rbx
+	emit8(&em, 0xC3);			// ret
+
+	// Next block starts 16 bytes aligned
+	g_jitBufferUsed = (g_jitBufferUsed + em.size + 15) & ~15;
+
+	return (BLOCK_NATIVE) (void*) em.code;
+}
+
+// Allocates an executable buffer for compiled blocks (only once)
+static void initJit() {
+	if (g_jitBuffer != NULL || g_jitBroken)
+		return;
+
+	void *buffer = mmap(NULL, JIT_BUFFER_SIZE,
+			PROT_READ | PROT_WRITE | PROT_EXEC,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (buffer == MAP_FAILED) {
+		g_jitBroken = 1;
+		return;
+	}
+
+	g_jitBuffer = (BYTE*) buffer;
+	g_jitBufferUsed = 0;
+}
+
+// Drops all compiled code (and all cached blocks pointing to it)
+void flushJit(const C8core *core) {
+	resetBlockCache(core);
+	g_jitBufferUsed = 0;
+}
+
+// Frees an executable buffer
+void destroyJit() {
+	if (g_jitBuffer != NULL)
+		munmap(g_jitBuffer, JIT_BUFFER_SIZE);
+
+	g_jitBuffer = NULL;
+	g_jitBufferUsed = 0;
+}
+
+#else
+
+BLOCK_NATIVE compileBlock(Block *block) {
+	return NULL;
+}
+
+static void initJit() {
+}
+
+void flushJit(const C8core *core) {
+	resetBlockCache(core);
+}
+
+void destroyJit() {
+}
+
+#endif  /* JIT_ENABLED */
+
+// ========================================================================================================
+
+/** runCyclesJit
+ *
+ * @param core
+ *  Pointer to C8core struct representing a chip-8 system core
+ * @param cycles
+ *  Number of opcodes to run
+ * @description:
+ *  Same as runCyclesBlocks but counts how many times each block was run
+ *  and compiles it once it gets hot, compiled blocks are only run when
+ *  the whole block fits into a given number of cycles
+ *  Writes into code pages drop blocks in invalidateDirtyBlocks together
+ *  with their native code (the space is reclaimed on the next flush)
+ */
+DWORD runCyclesJit(C8core *core, DWORD cycles) {
+	DWORD ran = 0;
+
+	initJit();
+	claimBlockCache(core);
+
+	while (ran < cycles) {
+		if (core->dirtyPages)
+			invalidateDirtyBlocks(core);
+
+		Block *block = getBlock(core, core->PC);
+
+		if (block == NULL) {
+			core->opcode = GET_WORD(core->memory[core->PC], core->memory[core->PC + 1]);
+			processOpcode(core);
+			ran += 1;
+			continue;
+		}
+
+		if (block->native != NULL && block->length <= cycles - ran) {
+			block->native(core);
+			ran += block->length;
+			continue;
+		}
+
+		DWORD count = block->length;
+		if (block->length + block->tail <= cycles - ran) {
+			count = runFusedBlock(core, block);
+		} else {
+			if (count > cycles - ran)
+				count = cycles - ran;
+
+			runBlock(core, block, count);
+		}
+
+		ran += count;
+
+		if (block->native == NULL && ++block->hits == JIT_HOT_THRESHOLD) {
+#ifdef JIT_ENABLED
+			if (g_jitBufferUsed + JIT_MAX_BLOCK_CODE > JIT_BUFFER_SIZE) {
+				flushJit(core);
+				continue;
+			}
+#endif
+			block->native = compileBlock(block);
+		}
+	}
+
+	return ran;
+}
@@ -0,0 +1,42 @@
+/**
+ * Cheap-8: a chip-8 emulator
+ *
+ * File: c8jit.h
+ * License: DWYW - "Do Whatever You Want"
+ *
+ * Dynamic recompiler that translates hot basic blocks (see c8block.h)
+ * into native x86-64 code
+ */
+
+#ifndef _C8JIT_H_
+#define _C8JIT_H_
+
+#include "c8block.h"
+
+// JIT is only available for x86-64 hosts with System V calling convention
+// Everywhere else the jit engine runs blocks just like the block engine does
+#if defined(__x86_64__) && !defined(_WIN32)
+#	define JIT_ENABLED
+#endif
+
+// Number of times a block has to be run before it's compiled
+#define JIT_HOT_THRESHOLD		16
+
+// Size of an executable buffer holding all the compiled blocks
+// All blocks are flushed at once when it runs out of space
+#define JIT_BUFFER_SIZE			(1 << 20)
+
+// Upper bound of native code size for a single block
+#define JIT_MAX_BLOCK_CODE		(BLOCK_MAX_LENGTH * 128 + 128)
+
+// Number of guest registers V0 - VF that can be held in host registers
+#define JIT_CACHED_REGISTERS	4
+
+BLOCK_NATIVE compileBlock(Block *block);
+
+void flushJit(const C8core *core);
+void destroyJit();
+
+DWORD runCyclesJit(C8core *core, DWORD cycles);
+
+#endif  /* _C8JIT_H_ */
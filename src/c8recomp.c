@@ -0,0 +1,508 @@
+/**
+ * Cheap-8: a chip-8 emulator
+ *
+ * File: c8recomp.c
+ * License: DWYW - "Do Whatever You Want"
+ *
+ * Ahead of time (static) recompiler and an execution engine for
+ * recompiled ROMs
+ *
+ * Recompiler walks all code reachable from the entry point following jumps,
+ * calls and skips, splits it into basic blocks and writes every block as
+ * a C function that does exactly what opcode handlers would do
+ * Generated source is compiled and linked together with the rest of
+ * cheap8 (see "make native") which gives a ROM that runs without any
+ * fetching and decoding at all
+ *
+ * Code that recompiler can't see (BNNN targets) and code in pages that
+ * ROM has written into (self modifying code) is run by the interpreter
+ */
+
+#include "c8recomp.h"
+#include "c8comp.h"
+
+#if defined(__GNUC__)
+__attribute__((weak))
+#endif
+const RecompiledROM *const g_recompiledROM = NULL;
+
+// ========================================================================================================
+
+// Names of opcode handlers as they are written into generated source
+// (quirk dependent ones are suffixed with a name of a quirk profile)
+static const char *const g_handlerNames[OPCODE_COUNT] = {
+	[OP_CLEAR_SCREEN]			= "handle_OP_CLEAR_SCREEN",
+	[OP_RETURN]					= "handle_OP_RETURN",
+	[OP_JUMP]					= "handle_OP_JUMP",
+	[OP_CALL_SUBR]				= "handle_OP_CALL_SUBR",
+	[OP_SKIP_EQ]				= "handle_OP_SKIP_EQ",
+	[OP_SKIP_NEQ]				= "handle_OP_SKIP_NEQ",
+	[OP_SKIP_EQ_REG]			= "handle_OP_SKIP_EQ_REG",
+	[OP_SET_CONST]				= "handle_OP_SET_CONST",
+	[OP_ADD_CONST]				= "handle_OP_ADD_CONST",
+	[OP_SET_REG]				= "handle_OP_SET_REG",
+	[OP_OR_REG]					= "handle_OP_OR_REG",
+	[OP_AND_REG]				= "handle_OP_AND_REG",
+	[OP_XOR_REG]				= "handle_OP_XOR_REG",
+	[OP_ADD_REG]				= "handle_OP_ADD_REG",
+	[OP_SUB_REG]				= "handle_OP_SUB_REG",
+	[OP_SHRIGHT_1]				= "handle_OP_SHRIGHT_1",
+	[OP_REV_SUB_REG]			= "handle_OP_REV_SUB_REG",
+	[OP_SHLEFT_1]				= "handle_OP_SHLEFT_1",
+	[OP_SKIP_NEQ_REG]			= "handle_OP_SKIP_NEQ_REG",
+	[OP_SET_IDX]				= "handle_OP_SET_IDX",
+	[OP_JUMP_FROM_V0]			= "handle_OP_JUMP_FROM_V0",
+	[OP_SET_RANDOM]				= "handle_OP_SET_RANDOM",
+	[OP_DRAW]					= "handle_OP_DRAW",
+	[OP_SKIP_KPRESS]			= "handle_OP_SKIP_KPRESS",
+	[OP_SKIP_NKPRESS]			= "handle_OP_SKIP_NKPRESS",
+	[OP_SAVE_DELAY]				= "handle_OP_SAVE_DELAY",
+	[OP_WAIT_KEY]				= "handle_OP_WAIT_KEY",
+	[OP_SET_DELAY]				= "handle_OP_SET_DELAY",
+	[OP_SET_SOUND]				= "handle_OP_SET_SOUND",
+	[OP_ADD_IDX]				= "handle_OP_ADD_IDX",
+	[OP_SET_IDX_SPRITE]			= "handle_OP_SET_IDX_SPRITE",
+	[OP_SET_BCD]				= "handle_OP_SET_BCD",
+	[OP_DUMP_REGS]				= "handle_OP_DUMP_REGS",
+	[OP_LOAD_REGS]				= "handle_OP_LOAD_REGS",
+	[OP_CALL_MCR]				= "handle_OP_CALL_MCR"
+};
+
+// Returns non zero if an opcode is translated into C in place
+// rather than into a call to it's handler
+static BYTE isInlineOpcode(BYTE opidx) {
+	switch (opidx) {
+	case OP_JUMP:
+	case OP_SKIP_EQ:
+	case OP_SKIP_NEQ:
+	case OP_SKIP_EQ_REG:
+	case OP_SKIP_NEQ_REG:
+	case OP_SET_CONST:
+	case OP_ADD_CONST:
+	case OP_SET_REG:
+	case OP_OR_REG:
+	case OP_AND_REG:
+	case OP_XOR_REG:
+	case OP_ADD_REG:
+	case OP_SUB_REG:
+	case OP_REV_SUB_REG:
+	case OP_SET_IDX:
+	case OP_SAVE_DELAY:
+	case OP_SET_DELAY:
+	case OP_SET_SOUND:
+	case OP_ADD_IDX:
+	case OP_SET_IDX_SPRITE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Adds an address to a list of addresses to visit (if it wasn't visited yet)
+static void visitAddress(BYTE *flags, WORD *pending, WORD *pendingCount, DWORD addr, BYTE leader) {
+	if (addr + 1 >= MEMORY_SIZE)
+		return;
+
+	if (leader)
+		flags[addr] |= RECOMP_ADDR_LEADER;
+
+	if (flags[addr] & RECOMP_ADDR_CODE)
+		return;
+
+	flags[addr] |= RECOMP_ADDR_CODE;
+	pending[(*pendingCount)++] = addr;
+}
+
+/** discoverCode
+ *
+ * @param core
+ *  Pointer to C8core struct with a ROM loaded into memory
+ * @param flags
+ *  Array of MEMORY_SIZE RECOMP_ADDR_* flags to be filled
+ * @description:
+ *  Marks all opcodes reachable from MEMORY_RANGE_PROGRAM_MIN and all addresses
+ *  that start a block (jump and call targets, return addresses and addresses
+ *  right after skips and other block terminators)
+ */
+static void discoverCode(const C8core *core, BYTE *flags) {
+	WORD pending[MEMORY_SIZE];
+	WORD pendingCount = 0;
+
+	memset(flags, 0, MEMORY_SIZE);
+	visitAddress(flags, pending, &pendingCount, MEMORY_RANGE_PROGRAM_MIN, 1);
+
+	while (pendingCount > 0) {
+		WORD addr = pending[--pendingCount];
+		const DecodedOpcode *decoded = decodeOpcode(GET_WORD(core->memory[addr], core->memory[addr + 1]));
+		DWORD next = addr + OPCODE_SIZE;
+
+		switch (decoded->opidx) {
+		case OP_RETURN:
+		case OP_JUMP_FROM_V0:
+			break;
+
+		case OP_JUMP:
+			if (decoded->nParam < MEMORY_RANGE_PROGRAM_MIN)
+				visitAddress(flags, pending, &pendingCount, next, 1);
+			else
+				visitAddress(flags, pending, &pendingCount, decoded->nParam, 1);
+			break;
+
+		case OP_CALL_SUBR:
+			visitAddress(flags, pending, &pendingCount, decoded->nParam, 1);
+			visitAddress(flags, pending, &pendingCount, next, 1);
+			break;
+
+		case OP_SKIP_EQ:
+		case OP_SKIP_NEQ:
+		case OP_SKIP_EQ_REG:
+		case OP_SKIP_NEQ_REG:
+		case OP_SKIP_KPRESS:
+		case OP_SKIP_NKPRESS:
+			visitAddress(flags, pending, &pendingCount, next, 1);
+			visitAddress(flags, pending, &pendingCount, next + OPCODE_SIZE, 1);
+			break;
+
+		case OP_WAIT_KEY:
+			visitAddress(flags, pending, &pendingCount, addr, 1);
+			visitAddress(flags, pending, &pendingCount, next, 1);
+			break;
+
+		default:
+			visitAddress(flags, pending, &pendingCount, next, isBlockTerminator(decoded->opidx));
+			break;
+		}
+	}
+}
+
+// ========================================================================================================
+
+/** writeOpcode
+ *
+ * @param out
+ *  File to write to
+ * @param decoded
+ *  Pre-decoded opcode to be translated
+ * @param pc
+ *  Value of PC while the opcode runs (i.e. address of the next opcode)
+ * @description:
+ *  Writes C statements that do the same thing an opcode handler does
+ *  Returns non zero if written code sets PC
+ */
+static BYTE writeOpcode(FILE *out, const DecodedOpcode *decoded, WORD pc) {
+	BYTE x = (BYTE) decoded->xParam;
+	BYTE y = (BYTE) decoded->yParam;
+	WORD n = decoded->nParam;
+
+	if (!isInlineOpcode(decoded->opidx)) {
+		fprintf(out, "\tcore->PC = 0x%03X;\n", pc);
+		fprintf(out, "\t%s%s%s(core, 0x%X, 0x%X, 0x%X);\n",
+				g_handlerNames[decoded->opidx],
+				isQuirkOpcode(decoded->opidx) ? "_" : "",
+				isQuirkOpcode(decoded->opidx) ? g_quirkProfile->name : "",
+				x, y, n);
+		return 1;
+	}
+
+	switch (decoded->opidx) {
+	case OP_JUMP:
+		if (n < MEMORY_RANGE_PROGRAM_MIN) {
+			fprintf(out, "\tSET_CUSTOM_FLAG(core, CUSTOM_FLAG_BAD_MEMORY);\n");
+			fprintf(out, "\tcore->PC = 0x%03X;\n", pc);
+		} else {
+			fprintf(out, "\tcore->PC = 0x%03X;\n", n);
+		}
+		return 1;
+
+	case OP_SKIP_EQ:
+	case OP_SKIP_NEQ:
+	case OP_SKIP_EQ_REG:
+	case OP_SKIP_NEQ_REG: {
+		char rhs[8];
+		if (decoded->opidx == OP_SKIP_EQ || decoded->opidx == OP_SKIP_NEQ)
+			sprintf(rhs, "0x%02X", n);
+		else
+			sprintf(rhs, "V[0x%X]", y);
+
+		const char *cmp = decoded->opidx == OP_SKIP_EQ || decoded->opidx == OP_SKIP_EQ_REG ? "==" : "!=";
+
+		fprintf(out, "\tcore->PC = 0x%03X;\n", pc);
+		if (pc + OPCODE_SIZE > MEMORY_SIZE)
+			fprintf(out, "\tif (V[0x%X] %s %s)\n\t\tSET_CUSTOM_FLAG(core, CUSTOM_FLAG_BAD_MEMORY);\n", x, cmp, rhs);
+		else
+			fprintf(out, "\tif (V[0x%X] %s %s)\n\t\tcore->PC = 0x%03X;\n", x, cmp, rhs, (unsigned) (pc + OPCODE_SIZE));
+		return 1;
+	}
+
+	case OP_SET_CONST:
+		fprintf(out, "\tV[0x%X] = 0x%02X;\n", x, n);
+		break;
+	case OP_ADD_CONST:
+		fprintf(out, "\tV[0x%X] += 0x%02X;\n", x, n);
+		break;
+	case OP_SET_REG:
+		fprintf(out, "\tV[0x%X] = V[0x%X];\n", x, y);
+		break;
+	case OP_OR_REG:
+		fprintf(out, "\tV[0x%X] |= V[0x%X];\n", x, y);
+		if (g_quirkProfile->quirks & QUIRK_VF_RESET)
+			fprintf(out, "\tV[0xF] = 0;\n");
+		break;
+	case OP_AND_REG:
+		fprintf(out, "\tV[0x%X] &= V[0x%X];\n", x, y);
+		if (g_quirkProfile->quirks & QUIRK_VF_RESET)
+			fprintf(out, "\tV[0xF] = 0;\n");
+		break;
+	case OP_XOR_REG:
+		fprintf(out, "\tV[0x%X] ^= V[0x%X];\n", x, y);
+		if (g_quirkProfile->quirks & QUIRK_VF_RESET)
+			fprintf(out, "\tV[0xF] = 0;\n");
+		break;
+	case OP_ADD_REG:
+		fprintf(out, "\t{\n\t\tWORD result = V[0x%X] + V[0x%X];\n", x, y);
+		fprintf(out, "\t\tV[0xF] = result >= (1 << 8) ? 1 : 0;\n");
+		fprintf(out, "\t\tV[0x%X] = result & 0xFF;\n\t}\n", x);
+		break;
+	case OP_SUB_REG:
+		fprintf(out, "\tV[0xF] = V[0x%X] > V[0x%X] ? 1 : 0;\n", x, y);
+		fprintf(out, "\tV[0x%X] -= V[0x%X];\n", x, y);
+		break;
+	case OP_REV_SUB_REG:
+		fprintf(out, "\tV[0xF] = V[0x%X] > V[0x%X] ? 1 : 0;\n", y, x);
+		fprintf(out, "\tV[0x%X] = V[0x%X] - V[0x%X];\n", x, y, x);
+		break;
+	case OP_SET_IDX:
+		fprintf(out, "\tcore->I = 0x%03X;\n", n);
+		break;
+	case OP_SAVE_DELAY:
+		fprintf(out, "\tV[0x%X] = core->tDelay;\n", x);
+		break;
+	case OP_SET_DELAY:
+		fprintf(out, "\tcore->tDelay = V[0x%X];\n", x);
+		break;
+	case OP_SET_SOUND:
+		fprintf(out, "\tcore->tSound = V[0x%X];\n", x);
+		break;
+	case OP_ADD_IDX:
+		fprintf(out, "\tif (core->I + V[0x%X] > MEMORY_SIZE)\n", x);
+		fprintf(out, "\t\tSET_CUSTOM_FLAG(core, CUSTOM_FLAG_BAD_MEMORY);\n");
+		fprintf(out, "\telse\n\t\tcore->I += V[0x%X];\n", x);
+		break;
+	case OP_SET_IDX_SPRITE:
+		fprintf(out, "\tcore->I = MEMORY_RANGE_FONTSET_MIN + (FONT_ENTITY_SIZE * V[0x%X]);\n", x);
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+// Writes a string as a C string literal
+static void writeStringLiteral(FILE *out, const char *str) {
+	fputc('"', out);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fputc('\\', out);
+		fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
+/** recompileROM
+ *
+ * @param core
+ *  Pointer to C8core struct with a ROM loaded into memory
+ * @param imageSize
+ *  Size of a ROM image (starting at MEMORY_RANGE_PROGRAM_MIN) in bytes
+ * @param name
+ *  Name of a ROM to be saved in generated source
+ * @param out
+ *  File to write generated C source to
+ * @description:
+ *  Discovers reachable code, splits it into blocks and writes C source
+ *  with one function per block, a copy of a ROM image and RecompiledROM
+ *  struct describing it all as g_recompiledROM
+ *  Code is generated for a quirk profile selected at the moment
+ */
+VM_RESULT recompileROM(const C8core *core, WORD imageSize, const char *name, FILE *out) {
+	VM_ASSERT(core == NULL || out == NULL);
+	VM_ASSERT(imageSize > MEMORY_SIZE - MEMORY_RANGE_PROGRAM_MIN);
+
+	BYTE flags[MEMORY_SIZE];
+	BYTE lengths[MEMORY_SIZE];
+	discoverCode(core, flags);
+
+	fprintf(out, "/**\n * Generated by c8recomp, do not edit\n */\n\n");
+	fprintf(out, "#include \"c8recomp.h\"\n\n");
+	fprintf(out, "#define V (core->reg)\n\n");
+
+	fprintf(out, "static const BYTE image[] = {");
+	for (WORD i = 0; i < imageSize; i++)
+		fprintf(out, "%s0x%02X,", i % 12 == 0 ? "\n\t" : " ", core->memory[MEMORY_RANGE_PROGRAM_MIN + i]);
+	fprintf(out, "\n};\n");
+
+	WORD blockCount = 0;
+
+	// Leaders are visited in ascending order so that a leader added
+	// when a block is split is still visited later
+	for (DWORD start = 0; start < MEMORY_SIZE; start++) {
+		if (!(flags[start] & RECOMP_ADDR_LEADER) || !(flags[start] & RECOMP_ADDR_CODE))
+			continue;
+
+		fprintf(out, "\nstatic void block_%03X(C8core *core) {\n", start);
+
+		DWORD addr = start;
+		BYTE length = 0;
+		BYTE pcSet = 0;
+
+		for (;;) {
+			WORD raw = GET_WORD(core->memory[addr], core->memory[addr + 1]);
+			const DecodedOpcode *decoded = decodeOpcode(raw);
+
+			Instruction instr;
+			rawToInstruction(raw, &instr);
+			fprintf(out, "\t// 0x%03X: %s\n", addr, instr.asmstr);
+
+			pcSet = writeOpcode(out, decoded, addr + OPCODE_SIZE);
+			addr += OPCODE_SIZE;
+			length += 1;
+
+			if (isBlockTerminator(decoded->opidx))
+				break;
+
+			if (addr + 1 >= MEMORY_SIZE || !(flags[addr] & RECOMP_ADDR_CODE) || (flags[addr] & RECOMP_ADDR_LEADER))
+				break;
+
+			if (length == RECOMP_MAX_BLOCK_LENGTH) {
+				flags[addr] |= RECOMP_ADDR_LEADER;
+				break;
+			}
+		}
+
+		if (!pcSet)
+			fprintf(out, "\tcore->PC = 0x%03X;\n", addr);
+
+		fprintf(out, "}\n");
+
+		lengths[start] = length;
+		blockCount += 1;
+	}
+
+	fprintf(out, "\nstatic const RecompiledBlock blocks[] = {\n");
+	for (DWORD start = 0; start < MEMORY_SIZE; start++) {
+		if (!(flags[start] & RECOMP_ADDR_LEADER) || !(flags[start] & RECOMP_ADDR_CODE))
+			continue;
+
+		fprintf(out, "\t{0x%03X, %u, block_%03X},\n", start, lengths[start], start);
+	}
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "static const RecompiledROM rom = {\n");
+	fprintf(out, "\t");
+	writeStringLiteral(out, name);
+	fprintf(out, ", \"%s\", image, sizeof(image), blocks, %u\n", g_quirkProfile->name, blockCount);
+	fprintf(out, "};\n\n");
+	fprintf(out, "const RecompiledROM *const g_recompiledROM = &rom;\n");
+
+	return VM_RESULT_SUCCESS;
+}
+
+// ========================================================================================================
+
+// Recompiled blocks indexed by address of their first opcode
+static const RecompiledBlock *g_nativeBlocks[MEMORY_SIZE];
+static QWORD g_nativeBlockPages[MEMORY_SIZE];
+static const C8core *g_nativeCore = NULL;
+
+// Pages that ROM has written into, recompiled blocks in them are never run again
+static QWORD g_nativeTaintedPages = 0;
+
+/** claimNativeBlocks
+ *
+ * @param core
+ *  Pointer to C8core struct representing a chip-8 system core
+ * @description:
+ *  Fills g_nativeBlocks with blocks of a recompiled ROM if there is one
+ *  and a core runs exactly the same ROM it was recompiled from with
+ *  the same quirk profile
+ *  Pages with recompiled code are marked as code pages of a core so that
+ *  writes into them are noticed
+ */
+static void claimNativeBlocks(C8core *core) {
+	if (g_nativeCore == core)
+		return;
+
+	g_nativeCore = core;
+	g_nativeTaintedPages = 0;
+	memset(g_nativeBlocks, 0, sizeof(g_nativeBlocks));
+
+	core->codePages = 0;
+	core->dirtyPages = 0;
+
+	const RecompiledROM *rom = g_recompiledROM;
+	if (rom == NULL || strcmp(rom->quirks, g_quirkProfile->name) != 0)
+		return;
+
+	if (memcmp(&core->memory[MEMORY_RANGE_PROGRAM_MIN], rom->image, rom->imageSize) != 0)
+		return;
+
+	for (DWORD addr = MEMORY_RANGE_PROGRAM_MIN + rom->imageSize; addr < MEMORY_SIZE; addr++) {
+		if (core->memory[addr] != 0)
+			return;
+	}
+
+	for (WORD i = 0; i < rom->blockCount; i++) {
+		const RecompiledBlock *block = &rom->blocks[i];
+		WORD end = block->start + block->length * OPCODE_SIZE;
+		QWORD pages = 0;
+
+		for (WORD page = MEMORY_PAGE(block->start); page <= MEMORY_PAGE(end - 1); page++)
+			pages |= MEMORY_PAGE_BIT(page);
+
+		g_nativeBlocks[block->start] = block;
+		g_nativeBlockPages[block->start] = pages;
+		core->codePages |= pages;
+	}
+}
+
+/** runCyclesNative
+ *
+ * @param core
+ *  Pointer to C8core struct representing a chip-8 system core
+ * @param cycles
+ *  Number of opcodes to run
+ * @description:
+ *  Runs recompiled blocks of a ROM linked into the executable
+ *  Falls back to processOpcode for every opcode that doesn't start a
+ *  recompiled block, for blocks that don't fit into a given number of cycles
+ *  and for blocks in pages that were written to
+ *  Without a recompiled ROM this is just the interpreter
+ */
+DWORD runCyclesNative(C8core *core, DWORD cycles) {
+	DWORD ran = 0;
+
+	claimNativeBlocks(core);
+
+	while (ran < cycles) {
+		if (core->dirtyPages) {
+			g_nativeTaintedPages |= core->dirtyPages;
+			core->dirtyPages = 0;
+		}
+
+		const RecompiledBlock *block = core->PC < MEMORY_SIZE ? g_nativeBlocks[core->PC] : NULL;
+
+		if (block != NULL && block->length <= cycles - ran
+				&& !(g_nativeBlockPages[core->PC] & g_nativeTaintedPages)) {
+			block->run(core);
+			ran += block->length;
+			continue;
+		}
+
+		core->opcode = GET_WORD(core->memory[core->PC], core->memory[core->PC + 1]);
+		processOpcode(core);
+		ran += 1;
+	}
+
+	return ran;
+}
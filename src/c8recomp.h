@@ -0,0 +1,51 @@
+/**
+ * Cheap-8: a chip-8 emulator
+ *
+ * File: c8recomp.h
+ * License: DWYW - "Do Whatever You Want"
+ *
+ * Ahead of time (static) recompiler that translates reachable code of
+ * a ROM into C source and an execution engine that runs such code
+ */
+
+#ifndef _C8RECOMP_H_
+#define _C8RECOMP_H_
+
+#include "c8block.h"
+
+// Maximum number of opcodes in a single recompiled block
+// (kept short so that a block fits into a VM run budget)
+#define RECOMP_MAX_BLOCK_LENGTH		BLOCK_MAX_LENGTH
+
+// Flags of each memory address during code discovery
+#define RECOMP_ADDR_CODE			1 << 0	// Address is a start of a reachable opcode
+#define RECOMP_ADDR_LEADER			1 << 1	// Address is a start of a block
+
+// Single block of a recompiled ROM
+typedef struct _RecompiledBlock {
+	WORD start;             // Address of the first opcode
+	WORD length;            // Number of opcodes in a block
+	BLOCK_NATIVE run;       // Runs the whole block
+} RecompiledBlock;
+
+// A ROM translated into C by c8recomp (see src/tools/c8recomp.c)
+typedef struct _RecompiledROM {
+	const char *name;               // Name of a ROM (file name it was recompiled from)
+	const char *quirks;             // Name of a quirk profile a ROM was recompiled with
+	const BYTE *image;              // Original ROM image
+	WORD imageSize;                 // Size of a ROM image in bytes
+	const RecompiledBlock *blocks;  // All recompiled blocks
+	WORD blockCount;                // Number of recompiled blocks
+} RecompiledROM;
+
+/* ROM linked into the executable (NULL in a regular build)
+ * Generated source defines it and overrides the default NULL definition
+ * which is a weak symbol for that reason
+ */
+extern const RecompiledROM *const g_recompiledROM;
+
+VM_RESULT recompileROM(const C8core *core, WORD imageSize, const char *name, FILE *out);
+
+DWORD runCyclesNative(C8core *core, DWORD cycles);
+
+#endif  /* _C8RECOMP_H_ */
@@ -9,6 +9,8 @@
 
 #include "input.h"
 
+#include <string.h>
+
 const BYTE KEYPAD_MAP[KEYPAD_KEY_COUNT] = {
 	SDL_SCANCODE_1,
 	SDL_SCANCODE_2,
@@ -28,22 +30,135 @@ const BYTE KEYPAD_MAP[KEYPAD_KEY_COUNT] = {
 	SDL_SCANCODE_V
 };
 
-const char *g_keypadReadable = "123QWEASDZXC4RFV";
+WORD g_keymap[KEYMAP_SIZE];
+char g_keypadReadable[KEYPAD_KEY_COUNT + 1];
 
-// Convert raw input handled by SDL2 library to a bit that is set corresponding
-// to a key on a chip-8 keypad which is:
-// 1 2 3 4
-// Q W E R
-// A S D F
-// Z X C V
-//
-// TODO: Add support for other media libraries (probably only curses)
-WORD getKeyBitmask(SDL_Scancode scancode) {
+// Shows the first host key bound to every chip-8 key ('?' if it has no single character name)
+static void updateKeypadReadable() {
 	for (BYTE i = 0; i < KEYPAD_KEY_COUNT; i++) {
-		if (KEYPAD_MAP[i] == scancode) {
-			return 1 << i;
+		g_keypadReadable[i] = '?';
+
+		for (WORD scancode = 0; scancode < KEYMAP_SIZE; scancode++) {
+			if (g_keymap[scancode] & (1 << i)) {
+				const char *name = SDL_GetScancodeName(scancode);
+				if (name != NULL && name[0] != '\0' && name[1] == '\0')
+					g_keypadReadable[i] = name[0];
+				break;
+			}
 		}
 	}
 
-	return WRONG_INPUT;
+	g_keypadReadable[KEYPAD_KEY_COUNT] = '\0';
+}
+
+// Builds the default keymap out of KEYPAD_MAP
+void initKeymap() {
+	memset(g_keymap, 0, sizeof(g_keymap));
+
+	for (BYTE i = 0; i < KEYPAD_KEY_COUNT; i++)
+		g_keymap[KEYPAD_MAP[i]] |= 1 << i;
+
+	updateKeypadReadable();
+}
+
+/** bindKeypadKey
+ *
+ * @param binding
+ *  A string like "A = Space, Left" which is a chip-8 key (hex digit)
+ *  and a comma separated list of SDL key names
+ * @description:
+ *  Binds a chip-8 key to given host keys only (keys it was bound to
+ *  before are unbound), an empty list leaves it unbound
+ *  Returns VM_RESULT_ERROR if a binding can't be parsed
+ */
+VM_RESULT bindKeypadKey(const char *binding) {
+	char buffer[KEYMAP_MAX_LINE];
+	if (strlen(binding) >= sizeof(buffer))
+		return VM_RESULT_ERROR;
+	strcpy(buffer, binding);
+
+	char *separator = strchr(buffer, '=');
+	if (separator == NULL)
+		return VM_RESULT_ERROR;
+	*separator = '\0';
+
+	char *end = NULL;
+	long key = strtol(buffer, &end, 16);
+	if (end == buffer)
+		return VM_RESULT_ERROR;
+	while (*end == ' ' || *end == '\t')
+		end++;
+	if (*end != '\0' || key < 0 || key >= KEYPAD_KEY_COUNT)
+		return VM_RESULT_ERROR;
+
+	// Names are checked before anything is changed so a bad binding changes nothing
+	SDL_Scancode scancodes[KEYMAP_SIZE];
+	WORD count = 0;
+
+	for (char *name = strtok(separator + 1, ","); name != NULL; name = strtok(NULL, ",")) {
+		while (*name == ' ' || *name == '\t')
+			name++;
+		char *last = name + strlen(name);
+		while (last > name && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\n' || last[-1] == '\r'))
+			*--last = '\0';
+		if (*name == '\0')
+			continue;
+
+		SDL_Scancode scancode = SDL_GetScancodeFromName(name);
+		if (scancode == SDL_SCANCODE_UNKNOWN || scancode >= KEYMAP_SIZE || count == KEYMAP_SIZE)
+			return VM_RESULT_ERROR;
+		scancodes[count++] = scancode;
+	}
+
+	for (WORD scancode = 0; scancode < KEYMAP_SIZE; scancode++)
+		g_keymap[scancode] &= ~(1 << key);
+	for (WORD i = 0; i < count; i++)
+		g_keymap[scancodes[i]] |= 1 << key;
+
+	updateKeypadReadable();
+	return VM_RESULT_SUCCESS;
+}
+
+/** loadKeymap
+ *
+ * @param fileName
+ *  Path to a keymap file
+ * @description:
+ *  Reads bindings (see bindKeypadKey) from a file, one per line, blank lines
+ *  and lines starting with # are skipped, chip-8 keys that aren't mentioned
+ *  keep their bindings
+ *  Returns VM_RESULT_ERROR if a file can't be read or has a bad binding in it
+ */
+VM_RESULT loadKeymap(const char *fileName) {
+	FILE *file = fopen(fileName, "r");
+	if (file == NULL)
+		return VM_RESULT_ERROR;
+
+	char line[KEYMAP_MAX_LINE];
+	VM_RESULT result = VM_RESULT_SUCCESS;
+
+	while (result == VM_RESULT_SUCCESS && fgets(line, sizeof(line), file) != NULL) {
+		char *text = line;
+		while (*text == ' ' || *text == '\t')
+			text++;
+
+		if (*text == '#' || *text == '\n' || *text == '\r' || *text == '\0')
+			continue;
+
+		result = bindKeypadKey(text);
+	}
+
+	fclose(file);
+	return result;
+}
+
+// Convert raw input handled by SDL2 library to bits that are set corresponding
+// to keys on a chip-8 keypad (see g_keymap)
+//
+// TODO: Add support for other media libraries (probably only curses)
+WORD getKeyBitmask(SDL_Scancode scancode) {
+	if ((int) scancode < 0 || scancode >= KEYMAP_SIZE || g_keymap[scancode] == 0)
+		return WRONG_INPUT;
+
+	return g_keymap[scancode];
 }
@@ -15,6 +15,15 @@
 #define KEYPAD_KEY_COUNT		16
 #define WRONG_INPUT				0xFFFF
 
+// Keymap is indexed by SDL scancodes (there are SDL_NUM_SCANCODES of them)
+#define KEYMAP_SIZE				512
+
+// Longest line of a keymap file
+#define KEYMAP_MAX_LINE			256
+
+// Key events that can wait in a VM for the next frame (see KeyEvent)
+#define KEY_EVENT_QUEUE_SIZE	32
+
 #define INPUT_DEBUG_STEP_MODE	SDL_SCANCODE_M				// A key to enter debug step-by-step mode
 #define INPUT_DEBUG_NEXT_STEP	SDL_SCANCODE_RIGHTBRACKET	// A key to step into in step-by-step mode
 #define INPUT_QUIT				SDL_SCANCODE_ESCAPE			// Quit emulator
@@ -27,8 +36,26 @@
  * Z X C V
  */
 extern const BYTE KEYPAD_MAP[KEYPAD_KEY_COUNT];
-extern const char *g_keypadReadable;
 
+/* Keypad bits for every scancode (0 if a key isn't mapped), built by initKeymap
+ * and changed by bindKeypadKey so a key event is a single lookup
+ * Any number of host keys can be bound to the same chip-8 key
+ */
+extern WORD g_keymap[KEYMAP_SIZE];
+
+// A host key for each chip-8 key (0 to F) as shown by the debugger
+extern char g_keypadReadable[KEYPAD_KEY_COUNT + 1];
+
+// Keypad change stamped with the opcode of a frame it has to happen before
+typedef struct _KeyEvent {
+	DWORD cycle;                // Opcodes of a frame to run before the change
+	WORD key;                   // Keypad bits
+	BYTE down;                  // Non zero if keys were pressed
+} KeyEvent;
+
+void initKeymap();
+VM_RESULT bindKeypadKey(const char *binding);
+VM_RESULT loadKeymap(const char *fileName);
 WORD getKeyBitmask(SDL_Scancode scancode);
 
 #endif  /* _INPUT_H_ */
@@ -2,6 +2,7 @@
 
 // To parse command line arguments with getopt
 #include <unistd.h>
+#include <getopt.h>
 
 #define DEMO_ROM_FILE	"../chip8-roms/demos/Maze [David Winter, 199x].ch8"
 #define DEMO_ROM_NAME	"Maze"
@@ -10,32 +11,146 @@
 
 struct program_param {
     const char letter;
+    const char *name;
     const char description[1 << 9];
     const BYTE is_bool;
 };
 
 const struct program_param param_debug_on = {
     .letter = 'd',
+    .name = "debug",
     .description = "Usage: -d; When specified it launches emulator along with a debugger",
     .is_bool = 1,
 };
 
+const struct program_param param_debug_rate = {
+    .letter = 'D',
+    .name = "debug-rate",
+    .description = "Usage: -D [HZ]; Debugger refresh rate (10 to 30, default is 20)",
+    .is_bool = 0,
+};
+
 const struct program_param param_rom_path = {
     .letter = 'r',
+    .name = "rom",
     .description = "Usage: -r [PATH_TO_ROM]; Specify which ROM image to run, runs a Maze demo if left empty",
     .is_bool = 0,
 };
 
+const struct program_param param_engine = {
+    .letter = 'e',
+    .name = "engine",
+    .description = "Usage: -e [ENGINE]; Select execution engine: interp, threaded (default), block, jit, diff, native",
+    .is_bool = 0,
+};
+
+const struct program_param param_ips = {
+    .letter = 'i',
+    .name = "ips",
+    .description = "Usage: -i [COUNT]; Run COUNT instructions per second (1 to 100000000, default is 720)",
+    .is_bool = 0,
+};
+
+const struct program_param param_quirks = {
+    .letter = 'q',
+    .name = "quirks",
+    .description = "Usage: -q [PROFILE]; Select quirk profile: vip, chip48, schip, modern (default)",
+    .is_bool = 0,
+};
+
+const struct program_param param_vsync = {
+    .letter = 'v',
+    .name = "vsync",
+    .description = "Usage: -v; Sync presenting frames to display's vertical blank",
+    .is_bool = 1,
+};
+
+const struct program_param param_stats = {
+    .letter = 'S',
+    .name = "stats",
+    .description = "Usage: -S; Print frame timing stats (emulation jitter, present time and latency) on exit",
+    .is_bool = 1,
+};
+
+const struct program_param param_persistence = {
+    .letter = 'p',
+    .name = "persistence",
+    .description = "Usage: -p; Fade pixels out over a few frames like a CRT phosphor does (reduces flicker)",
+    .is_bool = 1,
+};
+
+const struct program_param param_tone = {
+    .letter = 't',
+    .name = "tone",
+    .description = "Usage: -t [HZ]; Beep tone in Hz (20 to 10000, default is 175)",
+    .is_bool = 0,
+};
+
+const struct program_param param_volume = {
+    .letter = 'V',
+    .name = "volume",
+    .description = "Usage: -V [PERCENT]; Beep volume (0 to 100, default is 8)",
+    .is_bool = 0,
+};
+
+const struct program_param param_keymap = {
+    .letter = 'k',
+    .name = "keymap",
+    .description = "Usage: -k [FILE]; Load keypad bindings from FILE (one \"KEY = Name, Name\" per line)",
+    .is_bool = 0,
+};
+
+const struct program_param param_key = {
+    .letter = 'K',
+    .name = "key",
+    .description = "Usage: -K [KEY=NAMES]; Bind chip-8 KEY (0 to F) to comma separated SDL key names",
+    .is_bool = 0,
+};
+
+const struct program_param param_headless = {
+    .letter = 'H',
+    .name = "headless",
+    .description = "Usage: -H; Run without video, audio and debugger at maximum speed and print final state of a core",
+    .is_bool = 1,
+};
+
+const struct program_param param_cycles = {
+    .letter = 'c',
+    .name = "cycles",
+    .description = "Usage: -c [COUNT]; Stop after running COUNT opcodes (headless only)",
+    .is_bool = 0,
+};
+
+const struct program_param param_frames = {
+    .letter = 'f',
+    .name = "frames",
+    .description = "Usage: -f [COUNT]; Stop after COUNT frames i.e. timer ticks at 60Hz (headless only)",
+    .is_bool = 0,
+};
+
+const struct program_param param_screen = {
+    .letter = 's',
+    .name = "screen",
+    .description = "Usage: -s; Also print the screen along with the final state (headless only)",
+    .is_bool = 1,
+};
+
 const struct program_param param_help = {
     .letter = 'h',
+    .name = "help",
     .description = "Show this help message",
     .is_bool = 1,
 };
 
-#define PROGRAM_PARAM_COUNT 3
+#define PROGRAM_PARAM_COUNT 18
 
-const struct program_param* const params[PROGRAM_PARAM_COUNT] = {&param_debug_on, &param_rom_path, &param_help};
-const char *getopt_param_string = "dr:h";
+const struct program_param* const params[PROGRAM_PARAM_COUNT] = {
+    &param_debug_on, &param_debug_rate, &param_rom_path, &param_engine, &param_ips,
+    &param_quirks, &param_vsync, &param_stats, &param_persistence, &param_tone,
+    &param_volume, &param_keymap, &param_key, &param_headless, &param_cycles,
+    &param_frames, &param_screen, &param_help
+};
+const char *getopt_param_string = "dD:r:e:i:q:vSpt:V:k:K:Hc:f:sh";
 
 /* ====================== PROGRAM DESCRIPTION ===================== */
 
@@ -66,33 +181,182 @@ void print_help() {
             current_version->description);
 
     for (BYTE i = 0; i < PROGRAM_PARAM_COUNT; i++) {
-        printf("\t-%c, %s\n",
+        printf("\t-%c, --%s: %s\n",
                 params[i]->letter,
+                params[i]->name,
                 params[i]->description);
     }
 
+    printf("Quirk profiles:\n");
+    for (BYTE i = 0; i < QUIRK_PROFILE_COUNT; i++)
+        printf("\t%s: %s\n", QUIRK_PROFILES[i].name, QUIRK_PROFILES[i].description);
+
     printf("\n");
 }
 
+// Builds options for getopt_long out of program params (last one is all zeroes)
+void build_long_options(struct option *options) {
+    for (BYTE i = 0; i < PROGRAM_PARAM_COUNT; i++) {
+        options[i].name = params[i]->name;
+        options[i].has_arg = params[i]->is_bool ? no_argument : required_argument;
+        options[i].flag = NULL;
+        options[i].val = params[i]->letter;
+    }
+
+    memset(&options[PROGRAM_PARAM_COUNT], 0, sizeof(struct option));
+}
+
+// Parses a positive number for a count option, returns 0 if it's not valid
+QWORD parse_count(const char *arg) {
+    char *end = NULL;
+    unsigned long long count = strtoull(arg, &end, 0);
+
+    if (end == arg || *end != '\0' || arg[0] == '-')
+        return 0;
+
+    return count;
+}
+
 /* ====================== PROGRAM MAIN ENTRY ====================== */
 
 int main (int argc, char **argv) {
 	VM *Chip8VirtualMachine;
     char ROMFile[1 << 9] = "";
 
-    BYTE vmFlags = 0;
+    VMConfig vmConfig = {
+        .flags = 0,
+        .engine = &ENGINES[DEFAULT_EXEC_ENGINE],
+        .ROMImage = NULL,
+        .ROMImageSize = 0,
+        .cycleLimit = 0,
+        .frameLimit = 0,
+        .ips = CPU_INSTRUCTIONS_PER_SECOND,
+        .quirks = NULL,
+        .tone = AUDIO_DEFAULT_TONE,
+        .volume = AUDIO_DEFAULT_VOLUME,
+        .debugRate = DEBUGGER_DEFAULT_REFRESH_RATE
+    };
+    BYTE engineSelected = 0;
+
+    struct option long_options[PROGRAM_PARAM_COUNT + 1];
+    build_long_options(long_options);
+
+    // Defaults first so that -k and -K only change what they mention
+    initKeymap();
 
     int opt;
-    while ((opt = getopt(argc, argv, getopt_param_string)) != -1) {
+    while ((opt = getopt_long(argc, argv, getopt_param_string, long_options, NULL)) != -1) {
         switch(opt) {
             case 'd':
-                vmFlags |= VM_FLAG_DEBUGGER;
+                vmConfig.flags |= VM_FLAG_DEBUGGER;
                 printf("Opening debugger...\n");
                 break;
+            case 'D': {
+                QWORD rate = parse_count(optarg);
+                if (rate < DEBUGGER_MIN_REFRESH_RATE || rate > DEBUGGER_MAX_REFRESH_RATE) {
+                    printf("Error: \"%s\" is not a valid debugger refresh rate\n\n", optarg);
+                    print_help();
+                    return 1;
+                }
+                vmConfig.debugRate = rate;
+                break;
+            }
             case 'r':
                 if (optarg)
                     strcpy(ROMFile, optarg);
                 break;
+            case 'e':
+                vmConfig.engine = getEngineByName(optarg);
+                engineSelected = 1;
+                if (vmConfig.engine == NULL) {
+                    printf("Error: unknown execution engine \"%s\"\n\n", optarg);
+                    print_help();
+                    return 1;
+                }
+                break;
+            case 'i': {
+                QWORD ips = parse_count(optarg);
+                if (ips < SCHEDULER_MIN_IPS || ips > SCHEDULER_MAX_IPS) {
+                    printf("Error: \"%s\" is not a valid number of instructions per second\n\n", optarg);
+                    print_help();
+                    return 1;
+                }
+                vmConfig.ips = ips;
+                break;
+            }
+            case 'q':
+                vmConfig.quirks = getQuirkProfileByName(optarg);
+                if (vmConfig.quirks == NULL) {
+                    printf("Error: unknown quirk profile \"%s\"\n\n", optarg);
+                    print_help();
+                    return 1;
+                }
+                break;
+            case 'v':
+                vmConfig.flags |= VM_FLAG_VSYNC;
+                break;
+            case 'S':
+                vmConfig.flags |= VM_FLAG_FRAME_STATS;
+                break;
+            case 'p':
+                vmConfig.flags |= VM_FLAG_PERSISTENCE;
+                break;
+            case 't': {
+                QWORD tone = parse_count(optarg);
+                if (tone < AUDIO_MIN_TONE || tone > AUDIO_MAX_TONE) {
+                    printf("Error: \"%s\" is not a valid beep tone\n\n", optarg);
+                    print_help();
+                    return 1;
+                }
+                vmConfig.tone = tone;
+                break;
+            }
+            case 'k':
+                if (loadKeymap(optarg) != VM_RESULT_SUCCESS) {
+                    printf("Error: can't load keymap from \"%s\"\n\n", optarg);
+                    print_help();
+                    return 1;
+                }
+                break;
+            case 'K':
+                if (bindKeypadKey(optarg) != VM_RESULT_SUCCESS) {
+                    printf("Error: \"%s\" is not a valid key binding\n\n", optarg);
+                    print_help();
+                    return 1;
+                }
+                break;
+            case 'V': {
+                QWORD volume = parse_count(optarg);
+                if ((volume == 0 && strcmp(optarg, "0") != 0) || volume > AUDIO_MAX_VOLUME) {
+                    printf("Error: \"%s\" is not a valid beep volume\n\n", optarg);
+                    print_help();
+                    return 1;
+                }
+                vmConfig.volume = volume;
+                break;
+            }
+            case 'H':
+                vmConfig.flags |= VM_FLAG_HEADLESS;
+                break;
+            case 'c':
+                vmConfig.cycleLimit = parse_count(optarg);
+                if (vmConfig.cycleLimit == 0) {
+                    printf("Error: \"%s\" is not a valid number of cycles\n\n", optarg);
+                    print_help();
+                    return 1;
+                }
+                break;
+            case 'f':
+                vmConfig.frameLimit = parse_count(optarg);
+                if (vmConfig.frameLimit == 0) {
+                    printf("Error: \"%s\" is not a valid number of frames\n\n", optarg);
+                    print_help();
+                    return 1;
+                }
+                break;
+            case 's':
+                vmConfig.flags |= VM_FLAG_PRINT_SCREEN;
+                break;
             case 'h':
                 print_help();
                 return 0;
@@ -100,23 +364,39 @@ int main (int argc, char **argv) {
             default:
                 printf("Error: unknown option -%c\n\n", opt);
                 print_help();
-                return 0;
+                return 1;
         }
     }
 
-	if (strcmp(ROMFile, "") == 0) {
+    if ((vmConfig.flags & VM_FLAG_HEADLESS) && (vmConfig.flags & VM_FLAG_DEBUGGER)) {
+        printf("Warning: debugger is not available in headless mode\n");
+        vmConfig.flags &= ~VM_FLAG_DEBUGGER;
+    }
+
+	if (strcmp(ROMFile, "") == 0 && g_recompiledROM != NULL) {
+        // Executable was built with "make native" so it runs it's own ROM
+        vmConfig.ROMImage = g_recompiledROM->image;
+        vmConfig.ROMImageSize = g_recompiledROM->imageSize;
+        if (!engineSelected)
+            vmConfig.engine = &ENGINES[ENGINE_NATIVE];
+        if (vmConfig.quirks == NULL)
+            vmConfig.quirks = getQuirkProfileByName(g_recompiledROM->quirks);
+        snprintf(ROMFile, sizeof(ROMFile), "%s", g_recompiledROM->name);
+	} else if (strcmp(ROMFile, "") == 0) {
 		strcpy(ROMFile, DEMO_ROM_FILE);
 	} else if (access(ROMFile, F_OK) != 0) {
         printf("Error: Provided ROM file \"%s\" doesn't exist\n\n", ROMFile);
         print_help();
-        return 0;
+        return 1;
     }
 
     printf("Using ROM \"%s\"...\n", ROMFile);
 
     VM_RESULT vmRunResult = VM_RESULT_SUCCESS;
-	if (initVM(&Chip8VirtualMachine, ROMFile, vmFlags) == VM_RESULT_SUCCESS) {
+	if (initVM(&Chip8VirtualMachine, ROMFile, &vmConfig) == VM_RESULT_SUCCESS) {
 		vmRunResult = runVM(Chip8VirtualMachine);
+	} else {
+		vmRunResult = VM_RESULT_ERROR;
 	}
 
     if (vmRunResult == VM_RESULT_EVENT_SIGINT)
@@ -124,5 +404,7 @@ int main (int argc, char **argv) {
 
 	destroyVM(&Chip8VirtualMachine);
 
-	return 0;
+    // Non zero exit code lets scripts (and CI) notice a ROM that crashed the core
+    // (bad arguments and a missing ROM above exit with 1 too, only -h exits with 0)
+	return vmRunResult == VM_RESULT_ERROR ? 1 : 0;
 }
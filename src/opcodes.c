@@ -8,6 +8,7 @@
  */
 
 #include "opcodes.h"
+#include "c8draw.h"
 
 const Opcode OPCODES[OPCODE_COUNT] = {
 	{0xFFFF, 0x00E0, PARAMETER_UNUSED, PARAMETER_UNUSED, PARAMETER_UNUSED, handle_OP_CLEAR_SCREEN,
@@ -30,31 +31,31 @@ const Opcode OPCODES[OPCODE_COUNT] = {
             "add", "Adds NN to VX"},
 	{0xF00F, 0x8000, 0x0F00, 0x00F0, PARAMETER_UNUSED, handle_OP_SET_REG,
             "vset", "Sets VX to VY"},
-	{0xF00F, 0x8001, 0x0F00, 0x00F0, PARAMETER_UNUSED, handle_OP_OR_REG,
+	{0xF00F, 0x8001, 0x0F00, 0x00F0, PARAMETER_UNUSED, NULL,
             "vor", "Sets VX |= VY"},
-	{0xF00F, 0x8002, 0x0F00, 0x00F0, PARAMETER_UNUSED, handle_OP_AND_REG,
+	{0xF00F, 0x8002, 0x0F00, 0x00F0, PARAMETER_UNUSED, NULL,
             "vand", "Sets VX &= VY"},
-	{0xF00F, 0x8003, 0x0F00, 0x00F0, PARAMETER_UNUSED, handle_OP_XOR_REG,
+	{0xF00F, 0x8003, 0x0F00, 0x00F0, PARAMETER_UNUSED, NULL,
             "vxor", "Sets VX ^= VY"},
 	{0xF00F, 0x8004, 0x0F00, 0x00F0, PARAMETER_UNUSED, handle_OP_ADD_REG,
             "add", "Adds VY to VX"},
 	{0xF00F, 0x8005, 0x0F00, 0x00F0, PARAMETER_UNUSED, handle_OP_SUB_REG,
             "sub", "Subtracts VY from VX"},
-	{0xF00F, 0x8006, 0x0F00, 0x00F0, PARAMETER_UNUSED, handle_OP_SHRIGHT_1,
+	{0xF00F, 0x8006, 0x0F00, 0x00F0, PARAMETER_UNUSED, NULL,
             "shr", "Stores LSB of VX in VF and shifts VX right by VY"},
 	{0xF00F, 0x8007, 0x0F00, 0x00F0, PARAMETER_UNUSED, handle_OP_REV_SUB_REG,
             "subr", "Sets VX = VY - VX"},
-	{0xF00F, 0x800E, 0x0F00, 0x00F0, PARAMETER_UNUSED, handle_OP_SHLEFT_1,
+	{0xF00F, 0x800E, 0x0F00, 0x00F0, PARAMETER_UNUSED, NULL,
             "shl", "Stores MSB of VX in VF and shifts VX left by VY"},
 	{0xF00F, 0x9000, 0x0F00, 0x00F0, PARAMETER_UNUSED, handle_OP_SKIP_NEQ_REG,
             "vsneq", "Skip instruction if VX != VY"},
 	{0xF000, 0xA000, PARAMETER_UNUSED, PARAMETER_UNUSED, 0x0FFF, handle_OP_SET_IDX,
             "iset", "Sets I = NNN"},
-	{0xF000, 0xB000, PARAMETER_UNUSED, PARAMETER_UNUSED, 0x0FFF, handle_OP_JUMP_FROM_V0,
+	{0xF000, 0xB000, PARAMETER_UNUSED, PARAMETER_UNUSED, 0x0FFF, NULL,
             "vjmp", "Jumps to address V0 + NNN"},
 	{0xF000, 0xC000, 0x0F00, PARAMETER_UNUSED, 0x00FF, handle_OP_SET_RANDOM,
             "rand", "Sets VX = rand() & NN"},
-	{0xF000, 0xD000, 0x0F00, 0x00F0, 0x000F, handle_OP_DRAW,
+	{0xF000, 0xD000, 0x0F00, 0x00F0, 0x000F, NULL,
             "draw", "Draws a sprite at coordinate VX, VY with a width of 8 and height of N"},
 	{0xF0FF, 0xE09E, 0x0F00, PARAMETER_UNUSED, PARAMETER_UNUSED, handle_OP_SKIP_KPRESS,
             "skey", "Skip next insturction if a key stored in VX is pressed"},
@@ -74,9 +75,9 @@ const Opcode OPCODES[OPCODE_COUNT] = {
             "vispr", "Sets I to the location of the sprite for the character in VX"},
 	{0xF0FF, 0xF033, 0x0F00, PARAMETER_UNUSED, PARAMETER_UNUSED, handle_OP_SET_BCD,
             "bcd", "Save binary-coded decimal of VX at I, I+1, I+2"},
-	{0xF0FF, 0xF055, 0x0F00, PARAMETER_UNUSED, PARAMETER_UNUSED, handle_OP_DUMP_REGS,
+	{0xF0FF, 0xF055, 0x0F00, PARAMETER_UNUSED, PARAMETER_UNUSED, NULL,
             "save", "Stores V0 to VX (including VX) in memory starting at address I"},
-	{0xF0FF, 0xF065, 0x0F00, PARAMETER_UNUSED, PARAMETER_UNUSED, handle_OP_LOAD_REGS,
+	{0xF0FF, 0xF065, 0x0F00, PARAMETER_UNUSED, PARAMETER_UNUSED, NULL,
             "load", "Loads V0 to VX from memory starting from address I"},
 	{0xFFFF, 0x0000, PARAMETER_UNUSED, PARAMETER_UNUSED, PARAMETER_UNUSED, handle_OP_CALL_MCR,
             "nop", "Calls machine code routine NNN"}
@@ -84,43 +85,111 @@ const Opcode OPCODES[OPCODE_COUNT] = {
 
 // ========================================================================================================
 
-// Converts and opcode mask into an opcode id from OpcodeDescription enum
-inline BYTE getOpcodeIndex(WORD raw) {
-    for (BYTE i = 0; i < OPCODE_COUNT; i++) {
-		if ((raw & OPCODES[i].opcodeMask) == OPCODES[i].opcodeId) {
-            return i;
+DecodedOpcode g_decodeTable[DECODE_TABLE_SIZE];
+static BYTE g_decodeTableInit = 0;
+
+/** initDecodeTable
+ *
+ * @description:
+ *  Matches every possible opcode word against OPCODES once (in the same order
+ *  as OPCODES is declared so that first match wins) and saves the handler
+ *  (of a selected quirk profile) and already extracted parameters in g_decodeTable
+ */
+void initDecodeTable() {
+	if (g_decodeTableInit)
+		return;
+
+	for (DWORD raw = 0; raw < DECODE_TABLE_SIZE; raw++) {
+		BYTE idx = OP_CALL_MCR;
+
+		for (BYTE i = 0; i < OPCODE_COUNT; i++) {
+			if ((raw & OPCODES[i].opcodeMask) == OPCODES[i].opcodeId) {
+				idx = i;
+				break;
+			}
 		}
+
+		const Opcode *opcode = &OPCODES[idx];
+		DecodedOpcode *decoded = &g_decodeTable[raw];
+
+		decoded->handler = g_quirkProfile->handlers[idx];
+		decoded->opidx = idx;
+		decoded->xParam = opcode->xParamMask != PARAMETER_UNUSED ? (raw & opcode->xParamMask) >> 8 : PARAMETER_UNUSED;
+		decoded->yParam = opcode->yParamMask != PARAMETER_UNUSED ? (raw & opcode->yParamMask) >> 4 : PARAMETER_UNUSED;
+		decoded->nParam = opcode->nParamMask != PARAMETER_UNUSED ? (raw & opcode->nParamMask) : PARAMETER_UNUSED;
 	}
-    return OP_CALL_MCR;
+
+	g_decodeTableInit = 1;
 }
 
-// Applies all necessary masks to a current opcode (i.e. the one pointed
-// to by core->PC register) and then calls this opcode's handler
-void processOpcode(C8core *core) {
-	WORD xParam = PARAMETER_UNUSED;
-	WORD yParam = PARAMETER_UNUSED;
-	WORD nParam = PARAMETER_UNUSED;
-	const Opcode *opcode = NULL;
-	WORD opcodeRaw = core->opcode;
+// Converts and opcode mask into an opcode id from OpcodeDescription enum
+inline BYTE getOpcodeIndex(WORD raw) {
+	return decodeOpcode(raw)->opidx;
+}
 
-    BYTE idx = getOpcodeIndex(opcodeRaw);
-    opcode = &OPCODES[idx];
+// Returns raw opcode at a given address (zero if it's out of memory)
+static inline WORD peekOpcode(const C8core *core, WORD addr) {
+	if (addr + 1 >= MEMORY_SIZE)
+		return 0;
 
-	if (opcode == NULL) {
-		SET_CUSTOM_FLAG(core, CUSTOM_FLAG_BAD_OPCODE);
-		return;
+	return GET_WORD(core->memory[addr], core->memory[addr + 1]);
+}
+
+/** updateWaitState
+ *
+ * @param core
+ *  Pointer to C8core struct representing a chip-8 system core
+ * @description:
+ *  Looks at opcodes at core->PC for guest idle patterns, saves the result
+ *  in core->waitState and returns it (see CoreWaitState)
+ *  Patterns are only reported when running them for any number of cycles
+ *  changes nothing but PC within a loop, timers and (for CORE_WAIT_DELAY)
+ *  the register delay timer is read into, so that a VM can skip over them
+ */
+BYTE updateWaitState(C8core *core) {
+	WORD pc = core->PC;
+	WORD raw = peekOpcode(core, pc);
+	const DecodedOpcode *decoded = decodeOpcode(raw);
+
+	core->waitState = CORE_WAIT_NONE;
+
+	if (pc < MEMORY_RANGE_PROGRAM_MIN)
+		return core->waitState;
+
+	switch (decoded->opidx) {
+	case OP_WAIT_KEY:
+		if (core->keypadState == 0)
+			core->waitState = CORE_WAIT_KEY;
+		break;
+	case OP_JUMP:
+		if (decoded->nParam == pc)
+			core->waitState = CORE_WAIT_HALT;
+		break;
+	case OP_SAVE_DELAY:
+		// FX07; 3X00; 1NNN (back to FX07)
+		if (core->tDelay > 0
+				&& peekOpcode(core, pc + OPCODE_SIZE) == (0x3000 | (decoded->xParam << 8))
+				&& peekOpcode(core, pc + 2 * OPCODE_SIZE) == (0x1000 | pc))
+			core->waitState = CORE_WAIT_DELAY;
+		break;
+	default:
+		break;
 	}
 
-	xParam = opcode->xParamMask != PARAMETER_UNUSED ? (opcodeRaw & opcode->xParamMask) >> 8 : PARAMETER_UNUSED;
-	yParam = opcode->yParamMask != PARAMETER_UNUSED ? (opcodeRaw & opcode->yParamMask) >> 4 : PARAMETER_UNUSED;
-	nParam = opcode->nParamMask != PARAMETER_UNUSED ? (opcodeRaw & opcode->nParamMask) : PARAMETER_UNUSED;
+	return core->waitState;
+}
+
+// Looks up a current opcode (i.e. the one pointed to by core->PC register)
+// in a decode table and then calls this opcode's handler
+void processOpcode(C8core *core) {
+	const DecodedOpcode *decoded = decodeOpcode(core->opcode);
 
-	core->xParam = xParam;
-	core->yParam = yParam;
-	core->nParam = nParam;
+	core->xParam = decoded->xParam;
+	core->yParam = decoded->yParam;
+	core->nParam = decoded->nParam;
 
 	core->PC += OPCODE_SIZE;
-	opcode->handler(core, (BYTE) xParam, (BYTE) yParam, nParam);
+	decoded->handler(core, (BYTE) decoded->xParam, (BYTE) decoded->yParam, decoded->nParam);
 }
 
 // ========================================================================================================
@@ -136,6 +205,7 @@ void handle_OP_CALL_MCR(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
 
 void handle_OP_CLEAR_SCREEN(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
 	memset(core->gfx, 0, sizeof(QWORD) * SCREEN_RESOLUTION_HEIGHT);
+	core->dirtyRows = SCREEN_ROWS_ALL;
 	SET_CUSTOM_FLAG(core, CUSTOM_FLAG_CLEAR_SCREEN);
 }
 
@@ -212,16 +282,31 @@ void handle_OP_SET_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
 	core->reg[xParam] = core->reg[yParam];
 }
 
-void handle_OP_OR_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
+/* Handlers of opcodes that behave differently on different chip-8 implementations
+ * take a set of QUIRK_* flags as the last parameter which is always a constant
+ * Actual handlers are instantiated from these for every quirk profile (see
+ * DEFINE_QUIRK_HANDLERS below) so all the quirk checks are resolved at compile time
+ */
+
+static inline void quirk_OP_OR_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam, BYTE quirks) {
 	core->reg[xParam] |= core->reg[yParam];
+
+	if (quirks & QUIRK_VF_RESET)
+		core->reg[REG_VF] = 0;
 }
 
-void handle_OP_AND_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
+static inline void quirk_OP_AND_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam, BYTE quirks) {
 	core->reg[xParam] &= core->reg[yParam];
+
+	if (quirks & QUIRK_VF_RESET)
+		core->reg[REG_VF] = 0;
 }
 
-void handle_OP_XOR_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
+static inline void quirk_OP_XOR_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam, BYTE quirks) {
 	core->reg[xParam] ^= core->reg[yParam];
+
+	if (quirks & QUIRK_VF_RESET)
+		core->reg[REG_VF] = 0;
 }
 
 void handle_OP_ADD_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
@@ -235,9 +320,12 @@ void handle_OP_SUB_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
 	core->reg[xParam] -= core->reg[yParam];
 }
 
-void handle_OP_SHRIGHT_1(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
-	core->reg[REG_VF] = (core->reg[xParam] & (1 << 0));
-	core->reg[xParam] >>= core->reg[yParam];
+// VF is written last so that it holds the shifted out bit even if X is F
+static inline void quirk_OP_SHRIGHT_1(C8core *core, BYTE xParam, BYTE yParam, WORD nParam, BYTE quirks) {
+	BYTE value = core->reg[quirks & QUIRK_SHIFT_VX ? xParam : yParam];
+
+	core->reg[xParam] = value >> 1;
+	core->reg[REG_VF] = value & (1 << 0);
 }
 
 void handle_OP_REV_SUB_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
@@ -245,9 +333,11 @@ void handle_OP_REV_SUB_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam)
 	core->reg[xParam] = core->reg[yParam] - core->reg[xParam];
 }
 
-void handle_OP_SHLEFT_1(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
-	core->reg[REG_VF] = (core->reg[xParam] & (1 << 7));
-	core->reg[xParam] <<= core->reg[yParam];
+static inline void quirk_OP_SHLEFT_1(C8core *core, BYTE xParam, BYTE yParam, WORD nParam, BYTE quirks) {
+	BYTE value = core->reg[quirks & QUIRK_SHIFT_VX ? xParam : yParam];
+
+	core->reg[xParam] = value << 1;
+	core->reg[REG_VF] = value >> 7;
 }
 
 void handle_OP_SKIP_NEQ_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
@@ -264,8 +354,9 @@ void handle_OP_SET_IDX(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
 	core->I = nParam;
 }
 
-void handle_OP_JUMP_FROM_V0(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
-	WORD targetAddr = core->reg[REG_V0] + nParam;
+// With QUIRK_JUMP_VX opcode is read as BXNN i.e. register is the highest nibble of NNN
+static inline void quirk_OP_JUMP_FROM_V0(C8core *core, BYTE xParam, BYTE yParam, WORD nParam, BYTE quirks) {
+	WORD targetAddr = core->reg[quirks & QUIRK_JUMP_VX ? nParam >> 8 : REG_V0] + nParam;
 	if (targetAddr > MEMORY_SIZE) {
 		SET_CUSTOM_FLAG(core, CUSTOM_FLAG_BAD_MEMORY);
 		return;
@@ -273,19 +364,34 @@ void handle_OP_JUMP_FROM_V0(C8core *core, BYTE xParam, BYTE yParam, WORD nParam)
 	core->PC = targetAddr;
 }
 
+// Xorshift32 step of a core's own random number generator
+static inline DWORD nextRandom(C8core *core) {
+	DWORD state = core->randState;
+
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+
+	core->randState = state;
+	return state;
+}
+
 void handle_OP_SET_RANDOM(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
-	core->reg[xParam] = (rand() % (1 << 7)) & nParam;
+	core->reg[xParam] = (nextRandom(core) % (1 << 7)) & nParam;
 }
 
-/** handle_OP_DRAW
+/** quirk_OP_DRAW
  *
  * In this implementation of a chip-8 system emulator the screen is percieved by
  * the program as an array of uint64 so therefore each bit (set or unset) represents
  * a pixel on a 32 by 64 screen (white or black)
  *
- * That's why the logic might seem counterintuitive at the first glance
+ * The whole sprite is drawn at once by drawSprite (see c8draw.h)
+ *
+ * Sprites that go over the bottom of the screen either wrap around to the top
+ * or are clipped with QUIRK_CLIP (sprites are always clipped at the right edge)
  */
-void handle_OP_DRAW(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
+static inline void quirk_OP_DRAW(C8core *core, BYTE xParam, BYTE yParam, WORD nParam, BYTE quirks) {
 	if (nParam == 0) {
 		return;
 	}
@@ -296,49 +402,7 @@ void handle_OP_DRAW(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
 	BYTE x = core->reg[xParam] % SCREEN_RESOLUTION_WIDTH;
 	BYTE y = core->reg[yParam] % SCREEN_RESOLUTION_HEIGHT;
 
-	BYTE height = y + nParam;
-
-    // This flag signalizes if the portion (or the whole) sprite is overlapping the screen
-    // height, in which case we would paint it appropriately (which is overlapping the screen)
-	BYTE hasVerticalOverlap = (height - 1) > SCREEN_RESOLUTION_HEIGHT ? 1 : 0;
-
-	if (hasVerticalOverlap) {
-		height = height - 1 - SCREEN_RESOLUTION_HEIGHT;
-	}
-
-	core->reg[REG_VF] = 0;
-
-    // Iterating over bytes representing sprite pixel rows
-	for (BYTE sprite = 0; sprite < nParam; sprite++) {
-		QWORD newScreenRow = 0;
-        QWORD newUpdateRow = 0;
-        QWORD qsprite = core->memory[core->I + sprite];
-
-        // If we overlap the screen vertically
-		if (x + 8 > SCREEN_RESOLUTION_WIDTH)
-            // Then draw the remainder starting from the left (overlap it visually)
-			newScreenRow |= qsprite >> (x + 8 - SCREEN_RESOLUTION_WIDTH);
-		else
-            // Otherwise draw the sprite row normally
-			newScreenRow |= qsprite << (SCREEN_RESOLUTION_WIDTH - x - 8);
-
-		QWORD savedScreenRow = core->gfx[y];
-		core->gfx[y] ^= newScreenRow;
-
-        // If any of the bits on the screen that the sprite was drawn over were set
-		if ((savedScreenRow | newScreenRow) != core->gfx[y]) {
-            // then we need to set VF register
-			core->reg[REG_VF] = 1;
-		}
-
-		y += 1;
-		if (y == height) {
-			y = 0;
-			if (hasVerticalOverlap) {
-				height = nParam - height;
-			}
-		}
-	}
+	core->reg[REG_VF] = drawSprite(core, x, y, nParam, quirks & QUIRK_CLIP);
 
 	SET_CUSTOM_FLAG(core, CUSTOM_FLAG_REDRAW_PENDING);
 }
@@ -420,14 +484,24 @@ void handle_OP_SET_BCD(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
 
 	BYTE val = core->reg[xParam];
 
-	core->memory[core->I + 2] = val % 10;
+	storeMemory(core, core->I + 2, val % 10);
 	val /= 10;
-	core->memory[core->I + 1] = val % 10;
+	storeMemory(core, core->I + 1, val % 10);
 	val /= 10;
-	core->memory[core->I] = val % 10;
+	storeMemory(core, core->I, val % 10);
+
+	markMemoryWritten(core, core->I, 3);
 }
 
-void handle_OP_DUMP_REGS(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
+// Returns how much I is increased by after FX55 and FX65
+static inline WORD quirkMemoryIncrement(BYTE xParam, BYTE quirks) {
+	if (quirks & QUIRK_MEMORY_KEEP)
+		return 0;
+
+	return quirks & QUIRK_MEMORY_X ? xParam : xParam + 1;
+}
+
+static inline void quirk_OP_DUMP_REGS(C8core *core, BYTE xParam, BYTE yParam, WORD nParam, BYTE quirks) {
     if (xParam > GENERAL_PURPOSE_REGISTERS) {
         SET_CUSTOM_FLAG(core, CUSTOM_FLAG_BAD_OPCODE);
         return;
@@ -439,10 +513,13 @@ void handle_OP_DUMP_REGS(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
 	}
 
 	for (BYTE i = 0; i <= xParam; i++)
-		core->memory[core->I + i] = core->reg[i];
+		storeMemory(core, core->I + i, core->reg[i]);
+
+	markMemoryWritten(core, core->I, xParam + 1);
+	core->I += quirkMemoryIncrement(xParam, quirks);
 }
 
-void handle_OP_LOAD_REGS(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
+static inline void quirk_OP_LOAD_REGS(C8core *core, BYTE xParam, BYTE yParam, WORD nParam, BYTE quirks) {
     if (xParam > GENERAL_PURPOSE_REGISTERS) {
         SET_CUSTOM_FLAG(core, CUSTOM_FLAG_BAD_OPCODE);
         return;
@@ -455,4 +532,152 @@ void handle_OP_LOAD_REGS(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
 
 	for (BYTE i = 0; i <= xParam; i++)
 		core->reg[i] = core->memory[core->I + i];
+
+	core->I += quirkMemoryIncrement(xParam, quirks);
+}
+
+// ========================================================================================================
+
+#define DEFINE_QUIRK_HANDLER(op, profile, quirks) \
+	void handle_##op##_##profile(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) { \
+		quirk_##op(core, xParam, yParam, nParam, quirks); \
+	}
+
+// Instantiates handlers of all quirk dependent opcodes for a given profile
+#define DEFINE_QUIRK_HANDLERS(profile, quirks) \
+	DEFINE_QUIRK_HANDLER(OP_OR_REG, profile, quirks) \
+	DEFINE_QUIRK_HANDLER(OP_AND_REG, profile, quirks) \
+	DEFINE_QUIRK_HANDLER(OP_XOR_REG, profile, quirks) \
+	DEFINE_QUIRK_HANDLER(OP_SHRIGHT_1, profile, quirks) \
+	DEFINE_QUIRK_HANDLER(OP_SHLEFT_1, profile, quirks) \
+	DEFINE_QUIRK_HANDLER(OP_JUMP_FROM_V0, profile, quirks) \
+	DEFINE_QUIRK_HANDLER(OP_DRAW, profile, quirks) \
+	DEFINE_QUIRK_HANDLER(OP_DUMP_REGS, profile, quirks) \
+	DEFINE_QUIRK_HANDLER(OP_LOAD_REGS, profile, quirks)
+
+DEFINE_QUIRK_HANDLERS(vip, QUIRKS_VIP)
+DEFINE_QUIRK_HANDLERS(chip48, QUIRKS_CHIP48)
+DEFINE_QUIRK_HANDLERS(schip, QUIRKS_SCHIP)
+DEFINE_QUIRK_HANDLERS(modern, QUIRKS_MODERN)
+
+// Full handler set of a profile (OPCODES order) for QuirkProfile.handlers
+#define QUIRK_PROFILE_HANDLERS(profile) { \
+	[OP_CLEAR_SCREEN]		= handle_OP_CLEAR_SCREEN, \
+	[OP_RETURN]				= handle_OP_RETURN, \
+	[OP_JUMP]				= handle_OP_JUMP, \
+	[OP_CALL_SUBR]			= handle_OP_CALL_SUBR, \
+	[OP_SKIP_EQ]			= handle_OP_SKIP_EQ, \
+	[OP_SKIP_NEQ]			= handle_OP_SKIP_NEQ, \
+	[OP_SKIP_EQ_REG]		= handle_OP_SKIP_EQ_REG, \
+	[OP_SET_CONST]			= handle_OP_SET_CONST, \
+	[OP_ADD_CONST]			= handle_OP_ADD_CONST, \
+	[OP_SET_REG]			= handle_OP_SET_REG, \
+	[OP_OR_REG]				= handle_OP_OR_REG_##profile, \
+	[OP_AND_REG]			= handle_OP_AND_REG_##profile, \
+	[OP_XOR_REG]			= handle_OP_XOR_REG_##profile, \
+	[OP_ADD_REG]			= handle_OP_ADD_REG, \
+	[OP_SUB_REG]			= handle_OP_SUB_REG, \
+	[OP_SHRIGHT_1]			= handle_OP_SHRIGHT_1_##profile, \
+	[OP_REV_SUB_REG]		= handle_OP_REV_SUB_REG, \
+	[OP_SHLEFT_1]			= handle_OP_SHLEFT_1_##profile, \
+	[OP_SKIP_NEQ_REG]		= handle_OP_SKIP_NEQ_REG, \
+	[OP_SET_IDX]			= handle_OP_SET_IDX, \
+	[OP_JUMP_FROM_V0]		= handle_OP_JUMP_FROM_V0_##profile, \
+	[OP_SET_RANDOM]			= handle_OP_SET_RANDOM, \
+	[OP_DRAW]				= handle_OP_DRAW_##profile, \
+	[OP_SKIP_KPRESS]		= handle_OP_SKIP_KPRESS, \
+	[OP_SKIP_NKPRESS]		= handle_OP_SKIP_NKPRESS, \
+	[OP_SAVE_DELAY]			= handle_OP_SAVE_DELAY, \
+	[OP_WAIT_KEY]			= handle_OP_WAIT_KEY, \
+	[OP_SET_DELAY]			= handle_OP_SET_DELAY, \
+	[OP_SET_SOUND]			= handle_OP_SET_SOUND, \
+	[OP_ADD_IDX]			= handle_OP_ADD_IDX, \
+	[OP_SET_IDX_SPRITE]		= handle_OP_SET_IDX_SPRITE, \
+	[OP_SET_BCD]			= handle_OP_SET_BCD, \
+	[OP_DUMP_REGS]			= handle_OP_DUMP_REGS_##profile, \
+	[OP_LOAD_REGS]			= handle_OP_LOAD_REGS_##profile, \
+	[OP_CALL_MCR]			= handle_OP_CALL_MCR \
+}
+
+const QuirkProfile QUIRK_PROFILES[QUIRK_PROFILE_COUNT] = {
+	{"vip", QUIRKS_VIP, QUIRK_PROFILE_HANDLERS(vip),
+		"COSMAC VIP: VF reset by 8XY1-3, shifts of VY, I += X + 1, clipping"},
+	{"chip48", QUIRKS_CHIP48, QUIRK_PROFILE_HANDLERS(chip48),
+		"CHIP-48: shifts of VX, I += X, clipping, BXNN"},
+	{"schip", QUIRKS_SCHIP, QUIRK_PROFILE_HANDLERS(schip),
+		"SUPER-CHIP 1.1: shifts of VX, I unchanged, clipping, BXNN"},
+	{"modern", QUIRKS_MODERN, QUIRK_PROFILE_HANDLERS(modern),
+		"Octo and most modern ROMs: shifts of VY, I += X + 1, wrapping (default)"}
+};
+
+const QuirkProfile *g_quirkProfile = &QUIRK_PROFILES[DEFAULT_QUIRK_PROFILE];
+
+// Returns a quirk profile with a given name or NULL if there is no such profile
+const QuirkProfile *getQuirkProfileByName(const char *name) {
+	for (BYTE i = 0; i < QUIRK_PROFILE_COUNT; i++) {
+		if (strcmp(QUIRK_PROFILES[i].name, name) == 0)
+			return &QUIRK_PROFILES[i];
+	}
+
+	return NULL;
+}
+
+// Returns non zero if behaviour of an opcode depends on a quirk profile
+BYTE isQuirkOpcode(BYTE opidx) {
+	return OPCODES[opidx].handler == NULL;
+}
+
+/** selectQuirkProfile
+ *
+ * @param profile
+ *  Quirk profile to run opcodes with
+ * @description:
+ *  Makes every engine use handlers of a given profile by patching them into
+ *  the decode table, has to be called before any opcode is run because
+ *  engines cache handlers and code generated for them
+ */
+void selectQuirkProfile(const QuirkProfile *profile) {
+	g_quirkProfile = profile;
+
+	if (!g_decodeTableInit)
+		return;
+
+	for (DWORD raw = 0; raw < DECODE_TABLE_SIZE; raw++)
+		g_decodeTable[raw].handler = profile->handlers[g_decodeTable[raw].opidx];
+}
+
+// ========================================================================================================
+
+void handle_FUSED_SET_CONST_PAIR(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
+	core->reg[xParam] = nParam & 0xFF;
+	core->reg[yParam] = nParam >> 8;
+}
+
+void handle_FUSED_SET_IDX_DRAW(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
+	core->I = nParam & 0x0FFF;
+	g_quirkProfile->handlers[OP_DRAW](core, xParam, yParam, nParam >> 12);
+}
+
+// Jump is only fused if it's target is valid and isn't the address right
+// after the jump so the loop either skips the jump or takes it
+void handle_FUSED_COUNT_LOOP(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
+	core->reg[xParam] += 1;
+
+	if (core->reg[xParam] == yParam) {
+		core->PC += OPCODE_SIZE;
+		return;
+	}
+
+	core->PC = nParam;
+}
+
+// Load is not run if BCD has just overwritten it
+void handle_FUSED_BCD_LOAD(C8core *core, BYTE xParam, BYTE yParam, WORD nParam) {
+	handle_OP_SET_BCD(core, xParam, 0, PARAMETER_UNUSED);
+
+	if (core->I <= nParam + 1 && core->I + 2 >= nParam)
+		return;
+
+	core->PC += OPCODE_SIZE;
+	g_quirkProfile->handlers[OP_LOAD_REGS](core, yParam, 0, PARAMETER_UNUSED);
 }
@@ -29,7 +29,7 @@ typedef struct _Opcode {
 	WORD xParamMask;        // Bitmask that's used to extract the X (register 1 number) parameter
 	WORD yParamMask;        // Bitmask that's used to extract the Y (register 2 number) parameter
 	WORD nParamMask;        // Bitmask that's used to extract the N (constant) parameter
-	OPCODE_HANDLER handler; // Function pointer to an opcode handling function
+	OPCODE_HANDLER handler; // Function pointer to an opcode handling function (NULL if it depends on quirks)
 
     // chip-8 assembler command corresponding to
     // this opcode
@@ -79,8 +79,79 @@ typedef enum {
 	OPCODE_COUNT
 } OpcodeDescription;
 
+/* Pre-decoded form of a raw opcode word
+ * Every one of 65536 possible words has an entry in g_decodeTable so decoding
+ * an opcode is a single indexed load instead of a scan over OPCODES
+ */
+typedef struct _DecodedOpcode {
+	OPCODE_HANDLER handler; // Handler of the matching opcode
+	BYTE opidx;             // Index of the matching opcode in OPCODES
+	WORD xParam;            // Extracted X parameter (or PARAMETER_UNUSED)
+	WORD yParam;            // Extracted Y parameter (or PARAMETER_UNUSED)
+	WORD nParam;            // Extracted N parameter (or PARAMETER_UNUSED)
+} DecodedOpcode;
+
+#define DECODE_TABLE_SIZE	(1 << 16)
+
+extern DecodedOpcode g_decodeTable[DECODE_TABLE_SIZE];
+
+/* Quirks: behaviour of some opcodes differs between chip-8 implementations
+ * and ROMs written for one of them may not work on another
+ */
+#define QUIRK_VF_RESET		1 << 0	// 8XY1, 8XY2 and 8XY3 set VF to 0
+#define QUIRK_SHIFT_VX		1 << 1	// 8XY6 and 8XYE shift VX in place instead of VX = VY shifted
+#define QUIRK_MEMORY_X		1 << 2	// FX55 and FX65 increase I by X (instead of X + 1)
+#define QUIRK_MEMORY_KEEP	1 << 3	// FX55 and FX65 leave I unchanged
+#define QUIRK_CLIP			1 << 4	// Sprites are clipped at the bottom of the screen instead of wrapping
+#define QUIRK_JUMP_VX		1 << 5	// BNNN is BXNN and jumps to VX + XNN instead of V0 + NNN
+
+#define QUIRKS_VIP			(QUIRK_VF_RESET | QUIRK_CLIP)
+#define QUIRKS_CHIP48		(QUIRK_SHIFT_VX | QUIRK_MEMORY_X | QUIRK_CLIP | QUIRK_JUMP_VX)
+#define QUIRKS_SCHIP		(QUIRK_SHIFT_VX | QUIRK_MEMORY_KEEP | QUIRK_CLIP | QUIRK_JUMP_VX)
+#define QUIRKS_MODERN		0
+
+typedef enum {
+	QUIRK_PROFILE_VIP,
+	QUIRK_PROFILE_CHIP48,
+	QUIRK_PROFILE_SCHIP,
+	QUIRK_PROFILE_MODERN,
+	QUIRK_PROFILE_COUNT
+} QuirkProfileType;
+
+#define DEFAULT_QUIRK_PROFILE	QUIRK_PROFILE_MODERN
+
+/* Named set of quirks with a full set of opcode handlers specialized for it
+ * Handlers of quirk dependent opcodes are instantiated per profile at compile
+ * time so selecting a profile doesn't add any branches to the handlers
+ */
+typedef struct _QuirkProfile {
+	const char *name;                       // Name of a profile used on a command line
+	BYTE quirks;                            // QUIRK_* flags of a profile
+	OPCODE_HANDLER handlers[OPCODE_COUNT];  // Handlers of all opcodes (OPCODES order)
+	const char *description;                // Brief description for --help
+} QuirkProfile;
+
+extern const QuirkProfile QUIRK_PROFILES[QUIRK_PROFILE_COUNT];
+
+// Profile that all engines currently run opcodes with
+extern const QuirkProfile *g_quirkProfile;
+
+const QuirkProfile *getQuirkProfileByName(const char *name);
+void selectQuirkProfile(const QuirkProfile *profile);
+BYTE isQuirkOpcode(BYTE opidx);
+
+// Builds g_decodeTable from OPCODES, safe to call more than once
+void initDecodeTable();
+
+// Returns pre-decoded opcode for a given raw opcode word
+static inline const DecodedOpcode *decodeOpcode(WORD raw) {
+	return &g_decodeTable[raw];
+}
+
 BYTE getOpcodeIndex(WORD raw);
 
+BYTE updateWaitState(C8core *core);
+
 void processOpcode(C8core *core);
 
 void handle_OP_CLEAR_SCREEN(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
@@ -93,20 +164,13 @@ void handle_OP_SKIP_EQ_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 void handle_OP_SET_CONST(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 void handle_OP_ADD_CONST(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 void handle_OP_SET_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
-void handle_OP_OR_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
-void handle_OP_AND_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
-void handle_OP_XOR_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 void handle_OP_ADD_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 void handle_OP_SUB_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
-void handle_OP_SHRIGHT_1(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 void handle_OP_REV_SUB_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
-void handle_OP_SHLEFT_1(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 void handle_OP_SKIP_NEQ_REG(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 void handle_OP_SET_IDX(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
-void handle_OP_JUMP_FROM_V0(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 void handle_OP_SET_RANDOM(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 void handle_OP_SET_RANDOM(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
-void handle_OP_DRAW(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 void handle_OP_SKIP_KPRESS(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 void handle_OP_SKIP_NKPRESS(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 void handle_OP_SAVE_DELAY(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
@@ -116,10 +180,49 @@ void handle_OP_SET_SOUND(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 void handle_OP_ADD_IDX(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 void handle_OP_SET_IDX_SPRITE(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 void handle_OP_SET_BCD(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
-void handle_OP_DUMP_REGS(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
-void handle_OP_LOAD_REGS(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 void handle_OP_CALL_MCR(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
 
+#define DECLARE_QUIRK_HANDLER(op, profile) \
+	void handle_##op##_##profile(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
+
+// Handlers of quirk dependent opcodes, one set per profile (see opcodes.c)
+#define DECLARE_QUIRK_HANDLERS(profile) \
+	DECLARE_QUIRK_HANDLER(OP_OR_REG, profile) \
+	DECLARE_QUIRK_HANDLER(OP_AND_REG, profile) \
+	DECLARE_QUIRK_HANDLER(OP_XOR_REG, profile) \
+	DECLARE_QUIRK_HANDLER(OP_SHRIGHT_1, profile) \
+	DECLARE_QUIRK_HANDLER(OP_SHLEFT_1, profile) \
+	DECLARE_QUIRK_HANDLER(OP_JUMP_FROM_V0, profile) \
+	DECLARE_QUIRK_HANDLER(OP_DRAW, profile) \
+	DECLARE_QUIRK_HANDLER(OP_DUMP_REGS, profile) \
+	DECLARE_QUIRK_HANDLER(OP_LOAD_REGS, profile)
+
+DECLARE_QUIRK_HANDLERS(vip)
+DECLARE_QUIRK_HANDLERS(chip48)
+DECLARE_QUIRK_HANDLERS(schip)
+DECLARE_QUIRK_HANDLERS(modern)
+
+/* Fused handlers (superinstructions) that run a common sequence of opcodes
+ * in a single dispatch, used by the block cache (see fuseBlock in c8block.c)
+ * Parameters of all fused opcodes are packed into xParam, yParam and nParam
+ * and have the very same effect as running each opcode with it's own handler
+ *
+ * Handlers with a "tail" also run the first opcode of the next block when
+ * it's allowed and advance PC over it themselves
+ */
+
+// 6XNN + 6YNN; nParam = NN of the first opcode | NN of the second opcode << 8
+void handle_FUSED_SET_CONST_PAIR(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
+
+// ANNN + DXYN; nParam = NNN | N << 12
+void handle_FUSED_SET_IDX_DRAW(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
+
+// 7X01 + 3XNN + tail 1NNN; yParam = NN, nParam = NNN
+void handle_FUSED_COUNT_LOOP(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
+
+// FX33 + tail FX65; xParam = X of FX33, yParam = X of FX65, nParam = address of FX65
+void handle_FUSED_BCD_LOAD(C8core *core, BYTE xParam, BYTE yParam, WORD nParam);
+
 extern const Opcode OPCODES[OPCODE_COUNT];
 
 #endif  /* _OPCODES_H_ */
@@ -0,0 +1,80 @@
+/**
+ * Cheap-8: a chip-8 emulator
+ *
+ * File: tools/c8recomp.c
+ * License: DWYW - "Do Whatever You Want"
+ *
+ * Command line tool that recompiles a ROM into C source (see c8recomp.h)
+ * Usage: c8recomp ROM_FILE [OUTPUT_FILE [QUIRKS]]
+ * Output goes to stdout if OUTPUT_FILE is not specified (or is "-")
+ * QUIRKS is a name of a quirk profile to generate code for
+ */
+
+#include "c8recomp.h"
+
+// Returns a file name without directories
+static const char *getBaseName(const char *path) {
+    const char *name = strrchr(path, '/');
+    return name != NULL ? name + 1 : path;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 4) {
+        printf("Usage: %s ROM_FILE [OUTPUT_FILE [QUIRKS]]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc == 4) {
+        const QuirkProfile *profile = getQuirkProfileByName(argv[3]);
+        if (profile == NULL) {
+            printf("Error: unknown quirk profile \"%s\"\n", argv[3]);
+            return 1;
+        }
+        selectQuirkProfile(profile);
+    }
+
+    FILE *ROM = fopen(argv[1], "rb");
+    if (ROM == NULL) {
+        printf("Error: can't open ROM file \"%s\"\n", argv[1]);
+        return 1;
+    }
+
+    fseek(ROM, 0, SEEK_END);
+    long imageSize = ftell(ROM);
+    rewind(ROM);
+
+    if (imageSize <= 0) {
+        printf("Error: ROM file \"%s\" is empty\n", argv[1]);
+        fclose(ROM);
+        return 1;
+    }
+
+    // Same as loadROM, whatever doesn't fit into memory is ignored
+    if (imageSize > MEMORY_SIZE - MEMORY_RANGE_PROGRAM_MIN)
+        imageSize = MEMORY_SIZE - MEMORY_RANGE_PROGRAM_MIN;
+
+    C8core *core = NULL;
+    VM_RESULT result = initCore(&core, ROM);
+    fclose(ROM);
+
+    if (result != VM_RESULT_SUCCESS) {
+        printf("Error: failed to load ROM \"%s\"\n", argv[1]);
+        return 1;
+    }
+
+    FILE *out = argc >= 3 && strcmp(argv[2], "-") != 0 ? fopen(argv[2], "w") : stdout;
+    if (out == NULL) {
+        printf("Error: can't open output file \"%s\"\n", argv[2]);
+        destroyCore(&core);
+        return 1;
+    }
+
+    result = recompileROM(core, (WORD) imageSize, getBaseName(argv[1]), out);
+
+    if (out != stdout)
+        fclose(out);
+
+    destroyCore(&core);
+
+    return result == VM_RESULT_SUCCESS ? 0 : 1;
+}
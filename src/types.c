@@ -17,9 +17,10 @@ void logToFile(char *ffmt, ...) {
     va_start(ap, ffmt);
     
     FILE *logFile = fopen(DEFAULT_LOG_FILE, "ab+");
-    if (logFile)
+    if (logFile) {
         vfprintf(logFile, ffmt, ap);
+        fclose(logFile);
+    }
 
     va_end(ap);
-    fclose(logFile);
 }
@@ -9,20 +9,358 @@
 
 #include "vm.h"
 
+#include <signal.h>
+
+// ============================== Frame Mailbox Functions ==============================
+
+void initMailbox(FrameMailbox *mailbox) {
+	memset(mailbox->slots, 0, sizeof(mailbox->slots));
+	mailbox->back = 0;
+	mailbox->front = 1;
+	SDL_AtomicSet(&mailbox->shared, 2);
+}
+
+// Returns a slot emulation can write the next frame into
+FrameSnapshot *getBackSnapshot(FrameMailbox *mailbox) {
+	return &mailbox->slots[mailbox->back];
+}
+
+// Makes the back slot the newest frame and takes whatever slot was shared instead
+// (exchange is a full barrier so the snapshot is complete before renderer can see it)
+void publishSnapshot(FrameMailbox *mailbox) {
+	int shared = SDL_AtomicSet(&mailbox->shared, mailbox->back | FRAME_MAILBOX_FRESH);
+	mailbox->back = shared & FRAME_MAILBOX_INDEX_MASK;
+}
+
+BYTE hasFreshSnapshot(FrameMailbox *mailbox) {
+	return (SDL_AtomicGet(&mailbox->shared) & FRAME_MAILBOX_FRESH) != 0;
+}
+
+// Returns the newest published frame or NULL if there is nothing new since the last call
+const FrameSnapshot *takeSnapshot(FrameMailbox *mailbox) {
+	if (!hasFreshSnapshot(mailbox))
+		return NULL;
+
+	int shared = SDL_AtomicSet(&mailbox->shared, mailbox->front);
+	mailbox->front = shared & FRAME_MAILBOX_INDEX_MASK;
+
+	return &mailbox->slots[mailbox->front];
+}
+
+// Records how far the length of a frame that has just ended was from the ideal one
+// (lastFrameStart is set to 0 when emulation is paused so that a pause isn't counted)
+void recordFrameStart(FrameStats *stats, Uint64 now) {
+	if (stats->lastFrameStart != 0) {
+		Uint64 ideal = stats->frequency / TIMER_DECREASE_FREQUENCY;
+		Uint64 length = now - stats->lastFrameStart;
+		Uint64 jitter = length > ideal ? length - ideal : ideal - length;
+
+		stats->jitterSum += jitter;
+		if (jitter > stats->jitterMax)
+			stats->jitterMax = jitter;
+	}
+
+	stats->frames += 1;
+	stats->lastFrameStart = now;
+}
+
+#define STATS_US(ticks)		((double) (ticks) * 1000000.0 / stats->frequency)
+#define STATS_AVG(sum, n)	((n) > 0 ? STATS_US(sum) / (n) : 0.0)
+
+void printFrameStats(const FrameStats *stats, FILE *out) {
+	fprintf(out, "frames: %llu emulated, %llu published, %llu taken, %llu presented\n",
+			(unsigned long long) stats->frames,
+			(unsigned long long) stats->published,
+			(unsigned long long) stats->taken,
+			(unsigned long long) stats->presented);
+	fprintf(out, "frame jitter: avg %.1f us, max %.1f us\n",
+			STATS_AVG(stats->jitterSum, stats->frames > 1 ? stats->frames - 1 : 0),
+			STATS_US(stats->jitterMax));
+	fprintf(out, "present time: avg %.1f us, max %.1f us\n",
+			STATS_AVG(stats->presentSum, stats->presented),
+			STATS_US(stats->presentMax));
+	fprintf(out, "publish to present latency: avg %.1f us, max %.1f us\n",
+			STATS_AVG(stats->latencySum, stats->presented),
+			STATS_US(stats->latencyMax));
+}
+
+#undef STATS_US
+#undef STATS_AVG
+
+// ============================ Phosphor Persistence Functions ============================
+
+// Intensity a pixel has after one decay step for every possible intensity
+static BYTE g_decayLUT[PHOSPHOR_FULL + 1];
+
+void initPhosphor(Phosphor *phosphor, Uint64 frequency) {
+	for (WORD i = 0; i <= PHOSPHOR_FULL; i++)
+		g_decayLUT[i] = (i * PHOSPHOR_DECAY) >> 8;
+
+	memset(phosphor->intensity, 0, sizeof(phosphor->intensity));
+	memset(phosphor->fading, 0, sizeof(phosphor->fading));
+	phosphor->fadingRows = 0;
+	phosphor->decayInterval = frequency / TIMER_DECREASE_FREQUENCY;
+	phosphor->nextDecay = 0;
+}
+
+// Pixel of a screen row that a given bit of it stands for (most significant bit is x = 0)
+#define PHOSPHOR_PIXEL(row, bit)	((row) * SCREEN_RESOLUTION_WIDTH + 63 - (bit))
+
+/** updatePhosphor
+ *
+ * @param phosphor
+ *  A pointer to a Phosphor struct to be updated
+ * @param shown
+ *  Screen that was drawn last
+ * @param screen
+ *  Screen to be drawn now
+ * @param rows
+ *  Bitmap of rows that differ between the two screens
+ * @param now
+ *  Current performance counter value
+ * @description:
+ *  Lights pixels that were turned on and starts fading pixels that were
+ *  turned off, only changed pixels are touched
+ */
+void updatePhosphor(Phosphor *phosphor, const QWORD *shown, const QWORD *screen, DWORD rows, Uint64 now) {
+	if (phosphor->fadingRows == 0)
+		phosphor->nextDecay = now + phosphor->decayInterval;
+
+	for (DWORD left = rows; left != 0; left &= left - 1) {
+		BYTE row = __builtin_ctz(left);
+		QWORD turnedOn = screen[row] & ~shown[row];
+
+		for (QWORD bits = turnedOn; bits != 0; bits &= bits - 1)
+			phosphor->intensity[PHOSPHOR_PIXEL(row, __builtin_ctzll(bits))] = PHOSPHOR_FULL;
+
+		phosphor->fading[row] = (phosphor->fading[row] & ~turnedOn) | (shown[row] & ~screen[row]);
+		if (phosphor->fading[row] != 0)
+			phosphor->fadingRows |= 1u << row;
+		else
+			phosphor->fadingRows &= ~(1u << row);
+	}
+}
+
+/** decayPhosphor
+ *
+ * @param phosphor
+ *  A pointer to a Phosphor struct to be updated
+ * @param now
+ *  Current performance counter value
+ * @description:
+ *  Runs every decay step that is due (one per 1/60 of a second) on fading
+ *  pixels only, pixels that reach 0 stop fading
+ *  Returns bitmap of rows to be repainted (0 if no step was due)
+ */
+DWORD decayPhosphor(Phosphor *phosphor, Uint64 now) {
+	if (phosphor->fadingRows == 0 || now < phosphor->nextDecay)
+		return 0;
+
+	Uint64 steps = (now - phosphor->nextDecay) / phosphor->decayInterval + 1;
+	phosphor->nextDecay += steps * phosphor->decayInterval;
+	if (steps > PHOSPHOR_MAX_STEPS)
+		steps = PHOSPHOR_MAX_STEPS;
+
+	DWORD rows = phosphor->fadingRows;
+
+	for (DWORD left = rows; left != 0; left &= left - 1) {
+		BYTE row = __builtin_ctz(left);
+
+		for (QWORD bits = phosphor->fading[row]; bits != 0; bits &= bits - 1) {
+			BYTE bit = __builtin_ctzll(bits);
+			BYTE *intensity = &phosphor->intensity[PHOSPHOR_PIXEL(row, bit)];
+
+			for (Uint64 i = 0; i < steps; i++)
+				*intensity = g_decayLUT[*intensity];
+
+			if (*intensity == 0)
+				phosphor->fading[row] &= ~((QWORD) 1 << bit);
+		}
+
+		if (phosphor->fading[row] == 0)
+			phosphor->fadingRows &= ~(1u << row);
+	}
+
+	return rows;
+}
+
+#undef PHOSPHOR_PIXEL
+
 // ============================= Video Interface Functions =============================
 
+// Eight pixels for every possible byte of a screen row (most significant bit first)
+static DWORD g_pixelLUT[1 << 8][8];
+
+// Gray pixel for every possible phosphor intensity
+static DWORD g_grayLUT[PHOSPHOR_FULL + 1];
+
+static void initPixelLUT() {
+	for (WORD byte = 0; byte < (1 << 8); byte++)
+		for (BYTE bit = 0; bit < 8; bit++)
+			g_pixelLUT[byte][bit] = (byte & (0x80 >> bit)) ? VIDEO_WHITE_PIXEL : VIDEO_BLACK_PIXEL;
+
+	for (WORD i = 0; i <= PHOSPHOR_FULL; i++)
+		g_grayLUT[i] = ((DWORD) i << 24) | ((DWORD) i << 16) | ((DWORD) i << 8) | 0xFF;
+}
+
+// Expands a single screen row into 64 pixels, a byte (8 pixels) at a time
+static inline void expandRow(DWORD *pixels, QWORD row) {
+	for (BYTE i = 0; i < sizeof(QWORD); i++)
+		memcpy(&pixels[i * 8], g_pixelLUT[(row >> (56 - i * 8)) & 0xFF], sizeof(g_pixelLUT[0]));
+}
+
+// Turns a single row of phosphor intensities into 64 gray pixels
+static inline void expandPhosphorRow(DWORD *pixels, const BYTE *intensity) {
+	for (BYTE x = 0; x < SCREEN_RESOLUTION_WIDTH; x++)
+		pixels[x] = g_grayLUT[intensity[x]];
+}
+
+/** initRenderer
+ *
+ * @param interface
+ *  A pointer to VideoInterface struct with a window already created
+ * @description:
+ *  Creates renderer and texture, has to be called from the thread
+ *  that's going to render (SDL renderers aren't thread safe)
+ */
+static VM_RESULT initRenderer(VideoInterface *interface) {
+	interface->renderer = SDL_CreateRenderer(
+			interface->window,
+			VIDEO_DEFAULT_RENDER_INDEX,
+			VIDEO_DEFAULT_RENDER_FLAGS | (interface->vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
+
+	VM_ASSERT(interface->renderer == NULL);
+
+    // Texture has one texel per chip-8 pixel and is scaled up
+    // to the whole window by a single SDL_RenderCopy
+    interface->texture = SDL_CreateTexture(
+            interface->renderer,
+            VIDEO_PIXEL_FORMAT,
+            SDL_TEXTUREACCESS_STREAMING,
+            SCREEN_RESOLUTION_WIDTH,
+            SCREEN_RESOLUTION_HEIGHT);
+
+	VM_ASSERT(interface->texture == NULL);
+
+    clearScreen(interface);
+
+	return VM_RESULT_SUCCESS;
+}
+
+/** renderFrames
+ *
+ * @param data
+ *  A pointer to VideoInterface struct
+ * @description:
+ *  Render thread: presents the newest published frame whenever there is one
+ *  (and a display is ready for it), repaints only rows that differ from what
+ *  it presented last so frames it never took don't matter
+ *  With persistence on it also wakes up every 1/60 of a second while
+ *  any pixels are fading to repaint rows they are in
+ */
+static int renderFrames(void *data) {
+	VideoInterface *interface = (VideoInterface*) data;
+	FrameStats *stats = &interface->stats;
+	Phosphor *phosphor = &interface->phosphor;
+	QWORD shown[SCREEN_RESOLUTION_HEIGHT] = {0};
+
+	VM_RESULT result = initRenderer(interface);
+	SDL_AtomicSet(&interface->renderState, result);
+	SDL_SemPost(interface->renderStarted);
+
+	if (result != VM_RESULT_SUCCESS)
+		return 1;
+
+	while (!SDL_AtomicGet(&interface->quit)) {
+		Uint64 now = SDL_GetPerformanceCounter();
+		BYTE isFresh = hasFreshSnapshot(&interface->mailbox);
+		BYTE isFading = interface->persistence && phosphor->fadingRows != 0;
+
+		if (!isFresh && (!isFading || now < phosphor->nextDecay)) {
+            // Fading pixels have to be decayed even if emulation draws nothing
+            // (destroyVideoInterface posts the signal too so an idle wait ends on quit)
+			if (isFading)
+				SDL_SemWaitTimeout(interface->frameSignal,
+						(phosphor->nextDecay - now) * 1000 / stats->frequency + 1);
+			else
+				SDL_SemWait(interface->frameSignal);
+			continue;
+		}
+
+        // Frame stays in the mailbox (and might get replaced by a newer one)
+        // until a display slower than 60Hz can show it, thread sleeps until
+        // then (a newer frame or quit only wake it up to check again)
+		if (!isPresentDue(interface)) {
+			Uint64 due = interface->nextPresent;
+			now = SDL_GetPerformanceCounter();
+			if (due > now)
+				SDL_SemWaitTimeout(interface->frameSignal, (due - now) * 1000 / stats->frequency + 1);
+			continue;
+		}
+
+		const FrameSnapshot *snapshot = isFresh ? takeSnapshot(&interface->mailbox) : NULL;
+		DWORD rows = 0;
+
+		if (snapshot != NULL) {
+			stats->taken += 1;
+
+			for (BYTE i = 0; i < SCREEN_RESOLUTION_HEIGHT; i++) {
+				if (snapshot->gfx[i] != shown[i])
+					rows |= 1u << i;
+			}
+
+			if (interface->persistence)
+				updatePhosphor(phosphor, shown, snapshot->gfx, rows, now);
+
+			memcpy(shown, snapshot->gfx, sizeof(shown));
+		}
+
+		if (interface->persistence)
+			rows |= decayPhosphor(phosphor, now);
+
+		if (rows == 0)
+			continue;
+
+		Uint64 start = SDL_GetPerformanceCounter();
+		redrawScreen(interface, shown, rows);
+		Uint64 end = SDL_GetPerformanceCounter();
+
+		stats->presented += 1;
+		stats->presentSum += end - start;
+		if (end - start > stats->presentMax)
+			stats->presentMax = end - start;
+
+		if (snapshot != NULL) {
+			stats->latencySum += end - snapshot->publishedAt;
+			if (end - snapshot->publishedAt > stats->latencyMax)
+				stats->latencyMax = end - snapshot->publishedAt;
+		}
+	}
+
+	SDL_DestroyTexture(interface->texture);
+	SDL_DestroyRenderer(interface->renderer);
+
+	return 0;
+}
+
 /** initVideoInterface
  *
  * @param m_interface
  *  A reference to a pointer to struct VideoInterface to be initialized
+ * @param vsync
+ *  Presents are synced to display's vertical blank if non zero
+ * @param printStats
+ *  Frame timing stats are printed when interface is destroyed if non zero
+ * @param persistence
+ *  Pixels fade out over a few frames instead of turning off at once if non zero
  * @description
  *  Initializes the VideoInterface structure and prepares it for use with
- *  selected video mode
+ *  selected video mode, creates a window and starts the render thread
  *  TODO:   Right now the only supported interface is SDL2
  *          In the future the should be a (probably) curses interface
  *          CLI video output option
  */
-VM_RESULT initVideoInterface(VideoInterface **m_interface) {
+VM_RESULT initVideoInterface(VideoInterface **m_interface, BYTE vsync, BYTE printStats, BYTE persistence) {
 	if (SDL_Init(SDL_INIT_VIDEO) != 0) {
 		return VM_RESULT_ERROR;
 	}
@@ -36,12 +374,26 @@ VM_RESULT initVideoInterface(VideoInterface **m_interface) {
 	interface->resolutionHeight = VIDEO_DEFAULT_RESOLUTION_HEIGHT;
 	interface->isFullScreen = 0;
 	interface->windowFlags = VIDEO_DEFAULT_FLAGS;
-	interface->pixelWidth = interface->resolutionWidth / SCREEN_RESOLUTION_WIDTH;
-	interface->pixelHeight = interface->resolutionHeight / SCREEN_RESOLUTION_HEIGHT;
 	interface->windowTitle = VIDEO_DEFAULT_WINDOW_TITLE;
+	interface->vsync = vsync;
+	interface->printStats = printStats;
+	interface->persistence = persistence;
 
 	interface->window = NULL;
 	interface->renderer = NULL;
+	interface->texture = NULL;
+	interface->renderThread = NULL;
+
+	initMailbox(&interface->mailbox);
+	memset(&interface->stats, 0, sizeof(interface->stats));
+	interface->stats.frequency = SDL_GetPerformanceFrequency();
+	initPhosphor(&interface->phosphor, interface->stats.frequency);
+
+	SDL_AtomicSet(&interface->quit, 0);
+	interface->frameSignal = SDL_CreateSemaphore(0);
+	interface->renderStarted = SDL_CreateSemaphore(0);
+
+	VM_ASSERT(interface->frameSignal == NULL || interface->renderStarted == NULL);
 
 	interface->window = SDL_CreateWindow(
 			interface->windowTitle,
@@ -53,86 +405,138 @@ VM_RESULT initVideoInterface(VideoInterface **m_interface) {
 
 	VM_ASSERT(interface->window == NULL);
 
-	interface->renderer = SDL_CreateRenderer(
-			interface->window,
-			VIDEO_DEFAULT_RENDER_INDEX,
-			VIDEO_DEFAULT_RENDER_FLAGS);
+    // Display slower than 60Hz can't show every emulated frame anyway so
+    // frames in between presents are coalesced (dirty rows keep piling up)
+    SDL_DisplayMode mode;
+    if (SDL_GetWindowDisplayMode(interface->window, &mode) == 0 && mode.refresh_rate > 0)
+        interface->refreshRate = mode.refresh_rate;
+    else
+        interface->refreshRate = VIDEO_DEFAULT_REFRESH_RATE;
 
-    SDL_SetRenderDrawBlendMode(interface->renderer, SDL_BLENDMODE_BLEND);
-    clearScreen(interface);
+    if (interface->refreshRate < TIMER_DECREASE_FREQUENCY)
+        interface->presentInterval = SDL_GetPerformanceFrequency() / interface->refreshRate;
+    else
+        interface->presentInterval = 0;
+    interface->nextPresent = 0;
 
-	VM_ASSERT(interface->renderer == NULL);
+    initPixelLUT();
+
+	interface->renderThread = SDL_CreateThread(renderFrames, "cheap8 render", interface);
+	VM_ASSERT(interface->renderThread == NULL);
+
+	SDL_SemWait(interface->renderStarted);
+	VM_ASSERT(SDL_AtomicGet(&interface->renderState) != VM_RESULT_SUCCESS);
 
 	return VM_RESULT_SUCCESS;
 }
 
-// Clears the screen of a given VideoInterface
+/** isPresentDue
+ *
+ * @param interface
+ *  A pointer to a VideoInterface struct to be used
+ * @description:
+ *  Returns non zero if a new picture can be presented now, on displays that
+ *  refresh at 60Hz or faster it's always true and otherwise it's true about
+ *  refreshRate times a second (a present that's due is considered to be done)
+ *  Called by the render thread only
+ */
+BYTE isPresentDue(VideoInterface *interface) {
+    if (interface->presentInterval == 0)
+        return 1;
+
+    QWORD now = SDL_GetPerformanceCounter();
+    if (now < interface->nextPresent)
+        return 0;
+
+    interface->nextPresent += interface->presentInterval;
+    if (interface->nextPresent < now)
+        interface->nextPresent = now;
+
+    return 1;
+}
+
+// Clears the screen of a given VideoInterface (render thread only)
 // TODO: add support for curses VideoInterface later
 VM_RESULT clearScreen(VideoInterface *interface) {
 	VM_ASSERT(interface == NULL);
 
+    for (WORD i = 0; i < SCREEN_TOTAL_PIXELS; i++)
+        interface->pixels[i] = VIDEO_BLACK_PIXEL;
+
+    SDL_UpdateTexture(interface->texture, NULL, interface->pixels, VIDEO_PITCH);
+
     SDL_SetRenderDrawColor(interface->renderer, VIDEO_BLACK_PIXEL_RGBO);
     SDL_RenderClear(interface->renderer);
+    SDL_RenderCopy(interface->renderer, interface->texture, NULL, NULL);
     SDL_RenderPresent(interface->renderer);
 
 	return VM_RESULT_SUCCESS;
 }
 
-/** redrawPixel
+/** redrawScreen
  *
  * @param interface
- *  A pointer to VideoInterface struct to be used for output
+ *  A pointer to a VideoInterface struct to be used
  * @param screen
- *  Array of 64-bit long values representing screen row (size of 32 or 64 if hires)
- * @param row
- *  Row of a pixel to redraw
- * @param col
- *  Col of a pixel to redraw
+ *  A 32x64 array of bits representing white and black pixels (corresponding to
+ *  set and unset bits in said array)
+ * @param rows
+ *  Bitmap of rows to repaint (see collectChangedRows)
  * @description:
- *  Redraws a given pixel on the screen
+ *  Expands given rows into pixels with a lookup table (from phosphor
+ *  intensities with persistence on), uploads the span of rows between the
+ *  first and the last one into the texture and then presents it scaled
+ *  to the whole window (render thread only)
  */
-VM_RESULT redrawPixel(VideoInterface *interface, QWORD *screen, WORD row, WORD col) {
-    SDL_Rect nextPixel;
-    BYTE pxl = GET_BIT_BE(screen[row], col);
+VM_RESULT redrawScreen(VideoInterface *interface, const QWORD *screen, DWORD rows) {
+	VM_ASSERT(interface == NULL);
 
-    row *= interface->pixelHeight;
-    col *= interface->pixelWidth;
+    if (rows == 0)
+        return VM_RESULT_SUCCESS;
 
-    GET_NEXT_PIXEL(nextPixel,
-                col, row,
-                interface->pixelWidth,
-                interface->pixelHeight);
+    BYTE first = __builtin_ctz(rows);
+    BYTE last = 31 - __builtin_clz(rows);
 
-    if (pxl)
-        SDL_SetRenderDrawColor(interface->renderer, VIDEO_WHITE_PIXEL_RGBO);
-    else
-        SDL_SetRenderDrawColor(interface->renderer, VIDEO_BLACK_PIXEL_RGBO);
+	for (BYTE i = first; i <= last; i++) {
+        if (!(rows & (1u << i)))
+            continue;
+
+        if (interface->persistence)
+            expandPhosphorRow(&interface->pixels[i * SCREEN_RESOLUTION_WIDTH],
+                    &interface->phosphor.intensity[i * SCREEN_RESOLUTION_WIDTH]);
+        else
+            expandRow(&interface->pixels[i * SCREEN_RESOLUTION_WIDTH], screen[i]);
+    }
 
-    SDL_RenderFillRect(interface->renderer, &nextPixel);
+    SDL_Rect span = {0, first, SCREEN_RESOLUTION_WIDTH, last - first + 1};
+    SDL_UpdateTexture(interface->texture, &span,
+            &interface->pixels[first * SCREEN_RESOLUTION_WIDTH], VIDEO_PITCH);
 
-    return VM_RESULT_SUCCESS;
+    SDL_RenderCopy(interface->renderer, interface->texture, NULL, NULL);
+	SDL_RenderPresent(interface->renderer);
+
+	return VM_RESULT_SUCCESS;
 }
 
-/** redrawScreen
+/** publishFrame
  *
  * @param interface
  *  A pointer to a VideoInterface struct to be used
  * @param screen
- *  A 32x64 array of bits representing white and black pixels (corresponding to
- *  set and unset bits in said array)
+ *  Screen of a core at the end of an emulated frame
  * @description:
- *  Redraws the whole screen using a given screen content
+ *  Hands a copy of a screen over to the render thread, never waits
+ *  (called by the emulation thread only)
  */
-VM_RESULT redrawScreen(VideoInterface *interface, QWORD *screen) {
-	VM_ASSERT(interface == NULL);
-
-	for (BYTE i = 0; i < SCREEN_RESOLUTION_HEIGHT; i++)
-		for (BYTE j = 0; j < SCREEN_RESOLUTION_WIDTH; j++)
-            redrawPixel(interface, screen, i, j);
+void publishFrame(VideoInterface *interface, const QWORD *screen) {
+	FrameSnapshot *snapshot = getBackSnapshot(&interface->mailbox);
 
-	SDL_RenderPresent(interface->renderer);
+	memcpy(snapshot->gfx, screen, sizeof(snapshot->gfx));
+	snapshot->frame = ++interface->stats.published;
+	snapshot->publishedAt = SDL_GetPerformanceCounter();
 
-	return VM_RESULT_SUCCESS;
+	publishSnapshot(&interface->mailbox);
+	SDL_SemPost(interface->frameSignal);
 }
 
 /** destroyVideoInterface
@@ -148,8 +552,19 @@ VM_RESULT destroyVideoInterface(VideoInterface **m_interface) {
 	VideoInterface *interface = *m_interface;
 
 	if (interface != NULL) {
+        // Render thread destroys renderer and texture itself before it exits
+        if (interface->renderThread != NULL) {
+            SDL_AtomicSet(&interface->quit, 1);
+            SDL_SemPost(interface->frameSignal);
+            SDL_WaitThread(interface->renderThread, NULL);
+
+            if (interface->printStats)
+                printFrameStats(&interface->stats, stdout);
+        }
+
+        SDL_DestroySemaphore(interface->frameSignal);
+        SDL_DestroySemaphore(interface->renderStarted);
         SDL_DestroyWindow(interface->window);
-		SDL_DestroyRenderer(interface->renderer);
 		free(interface);
 	}
 
@@ -158,29 +573,122 @@ VM_RESULT destroyVideoInterface(VideoInterface **m_interface) {
 
 // ============================= Audio Interface Functions =============================
 
-/** gitSquareWave
+void initSoundQueue(SoundQueue *queue) {
+	SDL_AtomicSet(&queue->head, 0);
+	SDL_AtomicSet(&queue->tail, 0);
+}
+
+// Adds a transition to the queue (emulation thread only), returns 0 if it's full
+BYTE pushSoundEvent(SoundQueue *queue, QWORD tick, BYTE on) {
+	unsigned tail = SDL_AtomicGet(&queue->tail);
+	if (tail - (unsigned) SDL_AtomicGet(&queue->head) == SOUND_QUEUE_SIZE)
+		return 0;
+
+	SoundEvent *event = &queue->events[tail & (SOUND_QUEUE_SIZE - 1)];
+	event->tick = tick;
+	event->on = on;
+
+	// Atomic add is a full barrier so the event is written before consumer can see it
+	SDL_AtomicAdd(&queue->tail, 1);
+	return 1;
+}
+
+// Returns the oldest transition without removing it (audio callback only) or NULL
+const SoundEvent *peekSoundEvent(SoundQueue *queue) {
+	unsigned head = SDL_AtomicGet(&queue->head);
+	if (head == (unsigned) SDL_AtomicGet(&queue->tail))
+		return NULL;
+
+	return &queue->events[head & (SOUND_QUEUE_SIZE - 1)];
+}
+
+// Removes the oldest transition (audio callback only)
+void popSoundEvent(SoundQueue *queue) {
+	SDL_AtomicAdd(&queue->head, 1);
+}
+
+
+/** buildSquareWavetable
  *
+ * @param wavetable
+ *  Array of AUDIO_WAVETABLE_SIZE samples to be filled with one period of a wave
  * @param tone
- *  A float number representing a frequency of a sound
- * @param volume
- *  An integer representing sound's amplitude (or volume)
- * @param permutations
- *  Basically a sample rate of a sound
- * @param time
- *  A double float number representing a point at time at which current sample is
- *  to be created
+ *  Frequency of a wave in Hz
+ * @param sampleRate
+ *  Sample rate of an audio device the wave is going to be played on
+ * @param amplitude
+ *  Peak value of a wave
  * @description:
- *  Used in processAudioCallback function to build a sample of a square wave at
- *  a given point in time with given tone and sound
+ *  Builds a band limited square wave by summing up only the odd harmonics
+ *  that are below the Nyquist frequency (so it doesn't alias) and scales it
+ *  so that it's peak (overshoot included) is exactly the amplitude
+ *  Runs once when audio is initialized, all the sin() calls happen here
  */
-Sint16 getSquareWave(float tone, Uint16 volume, Uint16 permutations, double time) {
-	Sint16 sample = 0;
-	for (int i = 0; i < permutations; i++) {
-		sample += volume * sin((2 * i + 1) * tone * time) / (2 * i + 1);
+void buildSquareWavetable(Sint16 *wavetable, WORD tone, int sampleRate, Sint16 amplitude) {
+	static double wave[AUDIO_WAVETABLE_SIZE];
+	double peak = 0.0;
+
+	for (int i = 0; i < AUDIO_WAVETABLE_SIZE; i++) {
+		double angle = 2.0 * M_PI * i / AUDIO_WAVETABLE_SIZE;
+
+		wave[i] = 0.0;
+		for (int harmonic = 1; (double) harmonic * tone < sampleRate / 2.0; harmonic += 2)
+			wave[i] += sin(harmonic * angle) / harmonic;
+
+		if (fabs(wave[i]) > peak)
+			peak = fabs(wave[i]);
 	}
+
+	for (int i = 0; i < AUDIO_WAVETABLE_SIZE; i++)
+		wavetable[i] = peak > 0.0 ? (Sint16) lround(wave[i] * amplitude / peak) : 0;
+}
+
+// Default WAVE_FUNCTION: a table lookup and an add per sample
+Sint16 getWavetableSample(Oscillator *oscillator) {
+	Sint16 sample = oscillator->wavetable[oscillator->phase >> AUDIO_WAVETABLE_SHIFT];
+	oscillator->phase += oscillator->phaseStep;
+
 	return sample;
 }
 
+/** getEventSample
+ *
+ * @param cbData
+ *  Pointer to AudioCallbackData of a device
+ * @param event
+ *  Transition to be played
+ * @param now
+ *  Sample that's being produced right now
+ * @description:
+ *  Maps emulated time of a transition onto a sample it has to be played at,
+ *  transitions keep exactly the same distance from each other as they had
+ *  in emulated time unless one of them would have to be played in the past
+ *  (emulation was held or is slower than audio) or too far in the future
+ *  in which case the mapping starts over from that transition
+ */
+static QWORD getEventSample(AudioCallbackData *cbData, const SoundEvent *event, QWORD now) {
+	QWORD samplesPerTick = cbData->sampleRate / TIMER_DECREASE_FREQUENCY;
+
+	if (cbData->anchored) {
+		QWORD at = cbData->anchorSample + (event->tick - cbData->anchorTick) * cbData->sampleRate
+				/ TIMER_DECREASE_FREQUENCY;
+
+		if (at >= now && at <= now + samplesPerTick * AUDIO_MAX_EVENT_LEAD)
+			return at;
+	}
+
+	cbData->anchored = 1;
+	cbData->anchorSample = now + samplesPerTick * AUDIO_EVENT_LATENCY;
+	cbData->anchorTick = event->tick;
+
+	return cbData->anchorSample;
+}
+
+// Next sample of a beep, silence while the gate is closed
+static inline Sint16 getGatedSample(AudioCallbackData *cbData) {
+	return cbData->gate ? cbData->getWaveSample(&cbData->oscillator) : 0;
+}
+
 /** processAudioCallback
  *
  * @param userData
@@ -191,23 +699,38 @@ Sint16 getSquareWave(float tone, Uint16 volume, Uint16 permutations, double time
  * @param bytes
  *  The length of a sample in bytes
  * @description:
- *  A function that is called all the time when the audio state is on and
- *  generates a next piece (or sample) of audio to be played
+ *  A function that is called all the time (device is never paused) and
+ *  generates a next piece (or sample) of audio to be played, sound timer
+ *  transitions from the queue open and close the beep at exact samples
  */
 void processAudioCallback(void *userData, Uint8 *bytestream, int bytes) {
 	Sint16 *stream = (Sint16*) bytestream;
 	int length = bytes / 2;
 	AudioCallbackData *cbData = (AudioCallbackData*) userData;
 
-	int *currentSample = &cbData->currentSample;
+	const SoundEvent *event;
+	int i = 0;
 
-	for (int i = 0; i < length; i++, (*currentSample)++) {
-		double time = (double)(*currentSample) / (double)AUDIO_SAMPLES_PER_SECOND;
-		stream[i] = cbData->getWaveSample(DEFAULT_SQWAVE_TONE,
-				DEFAULT_SQWAVE_VOLUME,
-				DEFAULT_SQWAVE_PERMUTATIONS,
-				time);
+	while ((event = peekSoundEvent(&cbData->queue)) != NULL) {
+		QWORD at = getEventSample(cbData, event, cbData->position + i);
+		if (at >= cbData->position + length)
+			break;
+
+		for (; cbData->position + i < at; i++)
+			stream[i] = getGatedSample(cbData);
+
+		// Every beep starts from the same phase
+		if (event->on && !cbData->gate)
+			cbData->oscillator.phase = 0;
+
+		cbData->gate = event->on;
+		popSoundEvent(&cbData->queue);
 	}
+
+	for (; i < length; i++)
+		stream[i] = getGatedSample(cbData);
+
+	cbData->position += length;
 }
 
 /** initAudioInterface
@@ -215,13 +738,18 @@ void processAudioCallback(void *userData, Uint8 *bytestream, int bytes) {
  * @param m_interface
  *  A reference to a pointer to AudioInterface struct representing an
  *  audio interface to be initialized
+ * @param tone
+ *  Beep tone in Hz
+ * @param volume
+ *  Beep volume in percent of the full scale
  * @description:
  *  Allocates memory for an audio interface and then populates it with
  *  appropriate data and also preparing the actual media library to be
- *  used with a given interface
+ *  used with a given interface, the beep wavetable is built for the
+ *  sample rate the device actually has
  *  TODO: add support for other media libraries compatible with CLI only mode
  */
-VM_RESULT initAudioInterface(AudioInterface **m_interface) {
+VM_RESULT initAudioInterface(AudioInterface **m_interface, WORD tone, BYTE volume) {
     VM_ASSERT(SDL_Init(SDL_INIT_AUDIO) != 0);
 
 	*m_interface = (AudioInterface*) malloc(sizeof(AudioInterface));
@@ -239,10 +767,18 @@ VM_RESULT initAudioInterface(AudioInterface **m_interface) {
 
 	interface->specWant.callback = processAudioCallback;
 	interface->specWant.userdata = &(interface->cbData);
-	interface->cbData.currentSample = 0;
-	interface->cbData.getWaveSample = getSquareWave;
+	interface->cbData.oscillator.phase = 0;
+	interface->cbData.oscillator.phaseStep = 0;
+	interface->cbData.oscillator.wavetable = interface->wavetable;
+	interface->cbData.getWaveSample = getWavetableSample;
+	interface->cbData.gate = 0;
+	interface->cbData.position = 0;
+	interface->cbData.anchored = 0;
+	initSoundQueue(&interface->cbData.queue);
 
 	interface->state = AUDIO_STATE_PAUSED;
+	interface->tone = tone;
+	interface->volume = volume;
 
     interface->deviceId = SDL_OpenAudioDevice(NULL, 0,
                 &interface->specWant, &interface->specHave,
@@ -258,6 +794,16 @@ VM_RESULT initAudioInterface(AudioInterface **m_interface) {
 		return VM_RESULT_ERROR;
 	}
 
+    // Device starts paused so the callback isn't running yet
+    interface->cbData.sampleRate = interface->specHave.freq;
+    buildSquareWavetable(interface->wavetable, tone, interface->specHave.freq,
+            (Sint16) (INT16_MAX * volume / AUDIO_MAX_VOLUME));
+    interface->cbData.oscillator.phaseStep =
+            (DWORD) (((QWORD) tone << 32) / interface->specHave.freq);
+
+    // From now on it plays all the time, beeps are gated by the callback
+    SDL_PauseAudioDevice(interface->deviceId, 0);
+
 	return VM_RESULT_SUCCESS;
 }
 
@@ -274,10 +820,10 @@ VM_RESULT destroyAudioInterface(AudioInterface **m_interface) {
 	AudioInterface *interface = *m_interface;
 
 	if (interface != NULL) {
+		SDL_CloseAudioDevice(interface->deviceId);
 		free(interface);
 	}
 
-	SDL_CloseAudioDevice(interface->deviceId);
 	return VM_RESULT_SUCCESS;
 }
 
@@ -285,37 +831,153 @@ VM_RESULT destroyAudioInterface(AudioInterface **m_interface) {
  *
  * @param interface
  *  Pointer to AudioInterface struct
+ * @param tick
+ *  Timer tick (emulated time) the beep starts at
  * @description:
- *  Sets the audio state to AUDIO_STATE_PLAYING and
- *  signalling SDL2 library to start playing it
+ *  Sets the audio state to AUDIO_STATE_PLAYING and queues a transition
+ *  for the audio callback (if the queue is full it's tried again next time)
  *  TODO: Only for SDL2 based interface, need to add support for other libs
  */
-void startBeep(AudioInterface *interface) {
+void startBeep(AudioInterface *interface, QWORD tick) {
 	if (interface->state == AUDIO_STATE_PLAYING)
 		return;
 
-    logToFile("Beep start\n");
+	if (!pushSoundEvent(&interface->cbData.queue, tick, 1))
+		return;
 
 	interface->state = AUDIO_STATE_PLAYING;
-	SDL_PauseAudioDevice(interface->deviceId, interface->state);
 }
 
 /** stopBeep
  *
  * @param interface
  *  Pointer to AudioInterface struct
+ * @param tick
+ *  Timer tick (emulated time) the beep stops at
  * @description:
- *  Sets the audio state to AUDIO_STATE_PAUSED and
- *  signalling SDL2 library to stop playing it
+ *  Sets the audio state to AUDIO_STATE_PAUSED and queues a transition
+ *  for the audio callback (if the queue is full it's tried again next time)
  *  TODO: Only for SDL2 based interface, need to add support for other libs
  */
-void stopBeep(AudioInterface *interface) {
+void stopBeep(AudioInterface *interface, QWORD tick) {
 	if (interface->state == AUDIO_STATE_PAUSED)
 		return;
 
-    logToFile("Beep stop\n");
+	if (!pushSoundEvent(&interface->cbData.queue, tick, 0))
+		return;
+
 	interface->state = AUDIO_STATE_PAUSED;
-	SDL_PauseAudioDevice(interface->deviceId, interface->state);
+}
+
+// ============================== Frame Scheduler Functions ==============================
+
+/** initScheduler
+ *
+ * @param scheduler
+ *  Pointer to FrameScheduler struct to be initialized
+ * @param ips
+ *  Number of instructions per second to run
+ * @description:
+ *  Prepares a scheduler for a run with a given speed, frame timing itself
+ *  starts with the first waitForNextFrame so headless runs never touch SDL
+ */
+void initScheduler(FrameScheduler *scheduler, DWORD ips) {
+	scheduler->ips = ips;
+	scheduler->cycleRemainder = 0;
+	scheduler->frequency = 0;
+	scheduler->start = 0;
+	scheduler->frame = 0;
+}
+
+// Returns number of opcodes to run during the next frame
+DWORD nextFrameCycles(FrameScheduler *scheduler) {
+	QWORD total = (QWORD) scheduler->ips + scheduler->cycleRemainder;
+
+	scheduler->cycleRemainder = total % TIMER_DECREASE_FREQUENCY;
+	return total / TIMER_DECREASE_FREQUENCY;
+}
+
+/** waitForNextFrame
+ *
+ * @param scheduler
+ *  Pointer to FrameScheduler struct
+ * @description:
+ *  Sleeps (once) until the next frame is due
+ *  Frames are scheduled relative to the start of a schedule rather than to
+ *  the moment this function is called so that time spent emulating a frame
+ *  (or oversleeping) is made up for during next frames, but if emulation
+ *  falls too far behind (host is too slow or process was suspended) the
+ *  schedule starts over
+ */
+void waitForNextFrame(FrameScheduler *scheduler) {
+	Uint64 now = SDL_GetPerformanceCounter();
+
+	if (scheduler->start == 0) {
+		scheduler->frequency = SDL_GetPerformanceFrequency();
+		scheduler->start = now;
+		scheduler->frame = 0;
+	}
+
+	scheduler->frame++;
+
+	// Split into whole seconds and the rest to keep it exact without overflowing
+	QWORD seconds = scheduler->frame / TIMER_DECREASE_FREQUENCY;
+	QWORD frames = scheduler->frame % TIMER_DECREASE_FREQUENCY;
+	Uint64 nextFrame = scheduler->start + seconds * scheduler->frequency
+			+ frames * scheduler->frequency / TIMER_DECREASE_FREQUENCY;
+
+	Uint64 maxLag = scheduler->frequency * SCHEDULER_MAX_LAG_FRAMES / TIMER_DECREASE_FREQUENCY;
+	if (now > nextFrame + maxLag) {
+		resetScheduler(scheduler);
+		return;
+	}
+
+	if (now < nextFrame)
+		SDL_Delay((nextFrame - now) * 1000 / scheduler->frequency);
+}
+
+// Makes scheduler start over (e.g. after emulation was held by a debugger)
+void resetScheduler(FrameScheduler *scheduler) {
+	scheduler->start = 0;
+}
+
+// ================================= Timer Clock Functions =================================
+
+// Prepares timer clock for a given number of instructions per second
+void initTimerClock(TimerClock *clock, DWORD ips) {
+	clock->ips = ips;
+	clock->accumulator = 0;
+	clock->ticks = 0;
+}
+
+// Returns number of opcodes that can be run before timers have to tick again
+DWORD cyclesUntilTimerTick(const TimerClock *clock) {
+	DWORD left = clock->ips - clock->accumulator;
+	return (left + TIMER_DECREASE_FREQUENCY - 1) / TIMER_DECREASE_FREQUENCY;
+}
+
+/** advanceTimerClock
+ *
+ * @param clock
+ *  Pointer to TimerClock struct
+ * @param core
+ *  Pointer to C8core struct whose timers are to be decreased
+ * @param cycles
+ *  Number of opcodes that were just run
+ * @description:
+ *  Accounts for emulated time that passed while running a given number of opcodes
+ *  and decreases timers for every 1/TIMER_DECREASE_FREQUENCY of a second in it
+ *  (which is more than once per opcode when ips is less than TIMER_DECREASE_FREQUENCY)
+ */
+void advanceTimerClock(TimerClock *clock, C8core *core, DWORD cycles) {
+	QWORD elapsed = clock->accumulator + (QWORD) cycles * TIMER_DECREASE_FREQUENCY;
+	QWORD ticks = elapsed / clock->ips;
+
+	clock->accumulator = elapsed % clock->ips;
+	clock->ticks += ticks;
+
+	core->tDelay = ticks < core->tDelay ? core->tDelay - ticks : 0;
+	core->tSound = ticks < core->tSound ? core->tSound - ticks : 0;
 }
 
 // =================================== VM Functions ===================================
@@ -325,15 +987,17 @@ void stopBeep(AudioInterface *interface) {
  * @param m_vm
  *  Reference to a pointer to VM struct that is to be initialized
  * @param ROMFileName
- *  Path to a ROM file to be executed by VM
- * @param flags
- *  A byte representing 8 flags for VM
+ *  Path to a ROM file to be executed by VM (unused if config holds a ROM image)
+ * @param config
+ *  Pointer to VMConfig struct holding VM flags and options
  * @description:
  *  Allocates memory and initializes VM with populating it's handler
  *  struct with appropriate data and calling all initializer functions
  *  for each interface included in a VM (and according to the flags being set)
  */
-VM_RESULT initVM(VM **m_vm, char *ROMFileName, BYTE flags) {
+VM_RESULT initVM(VM **m_vm, char *ROMFileName, const VMConfig *config) {
+	VM_ASSERT(config == NULL);
+
 	*m_vm = (VM*) malloc(sizeof(VM));
 	VM *vm = *m_vm;
 
@@ -343,13 +1007,40 @@ VM_RESULT initVM(VM **m_vm, char *ROMFileName, BYTE flags) {
 	vm->video = NULL;
 	vm->core = NULL;
 	vm->dbg = NULL;
-    vm->flags = flags;
-
-    SDL_Init(SDL_INIT_EVENTS);
-	VM_ASSERT(initVideoInterface(&vm->video) != VM_RESULT_SUCCESS);
-	VM_ASSERT(initAudioInterface(&vm->audio) != VM_RESULT_SUCCESS);
+    vm->flags = config->flags;
+    vm->engine = config->engine != NULL ? config->engine : &ENGINES[DEFAULT_EXEC_ENGINE];
+    initBreakpoints(&vm->breakpoints);
+    DWORD ips = config->ips != 0 ? config->ips : CPU_INSTRUCTIONS_PER_SECOND;
+
+    // Has to happen before the core runs anything (engines cache handlers)
+    selectQuirkProfile(config->quirks != NULL ? config->quirks : &QUIRK_PROFILES[DEFAULT_QUIRK_PROFILE]);
+
+    initScheduler(&vm->scheduler, ips);
+    initTimerClock(&vm->timers, ips);
+
+    vm->cycleLimit = config->cycleLimit;
+    vm->frameLimit = config->frameLimit;
+    vm->cycles = 0;
+    vm->frames = 0;
+    vm->keyEventCount = 0;
+    vm->inputWindowStart = 0;
+
+    // Headless VM never touches SDL so it can run where there is no display
+    if (!(vm->flags & VM_FLAG_HEADLESS)) {
+        SDL_Init(SDL_INIT_EVENTS);
+        VM_ASSERT(initVideoInterface(&vm->video, vm->flags & VM_FLAG_VSYNC,
+                    vm->flags & VM_FLAG_FRAME_STATS,
+                    vm->flags & VM_FLAG_PERSISTENCE) != VM_RESULT_SUCCESS);
+        VM_ASSERT(initAudioInterface(&vm->audio,
+                    config->tone != 0 ? config->tone : AUDIO_DEFAULT_TONE,
+                    config->volume) != VM_RESULT_SUCCESS);
+    }
 
-	FILE *ROMHandler = fopen(ROMFileName, "r");
+	FILE *ROMHandler = NULL;
+	if (config->ROMImage != NULL)
+		ROMHandler = fmemopen((void*) config->ROMImage, config->ROMImageSize, "r");
+	else
+		ROMHandler = fopen(ROMFileName, "r");
 
 	VM_ASSERT(ROMHandler == NULL);
 
@@ -358,8 +1049,9 @@ VM_RESULT initVM(VM **m_vm, char *ROMFileName, BYTE flags) {
 
 	VM_ASSERT(coreInitResult != VM_RESULT_SUCCESS);
 
-    if (vm->flags & VM_FLAG_DEBUGGER) {
-        if (initDebugger(&vm->dbg, vm->core) != VM_RESULT_SUCCESS) {
+    if ((vm->flags & VM_FLAG_DEBUGGER) && !(vm->flags & VM_FLAG_HEADLESS)) {
+        BYTE refreshRate = config->debugRate != 0 ? config->debugRate : DEBUGGER_DEFAULT_REFRESH_RATE;
+        if (initDebugger(&vm->dbg, vm->core, refreshRate) != VM_RESULT_SUCCESS) {
             printf("Failed to initialize debugger!\n");
             vm->dbg = NULL;
         }
@@ -368,17 +1060,32 @@ VM_RESULT initVM(VM **m_vm, char *ROMFileName, BYTE flags) {
 	return VM_RESULT_SUCCESS;
 }
 
+// Applies a single key event to a keypad
+static inline void applyKeyEvent(C8core *core, const KeyEvent *event) {
+	if (event->down)
+		core->keypadState |= event->key;
+	else
+		core->keypadState &= ~event->key;
+}
+
 /** pollEvents
  *
  * @param vm
  *  Pointer to a VM struct
  * @description:
  *  Used to poll for keyboard events
+ *  Key events are queued rather than applied right away: each one is
+ *  stamped with the opcode of the next frame that is as far into that
+ *  frame as the event was into the time since the last poll (taken from
+ *  SDL event timestamps), so a ROM sees keys change at the right
+ *  instruction and even a tap shorter than a frame is never lost
  *  TODO: Only supports SDL2, need to add support for other libs
  */
 VM_RESULT pollEvents(VM *vm, VM_RESULT dbgState) {
 	VM_ASSERT(vm == NULL);
 	SDL_Event ev;
+	BYTE firstEvent = vm->keyEventCount;
+
 	while (SDL_PollEvent(&ev)) {
 		if (ev.type == SDL_QUIT) {
 			return VM_RESULT_EVENT_QUIT;
@@ -398,16 +1105,302 @@ VM_RESULT pollEvents(VM *vm, VM_RESULT dbgState) {
                 WORD key = getKeyBitmask(ev.key.keysym.scancode);
 
                 if (key != WRONG_INPUT) {
-                    if (ev.type == SDL_KEYDOWN) {
-                        vm->core->keypadState |= key;
-                    } else if (ev.type == SDL_KEYUP) {
-                        vm->core->keypadState &= ~key;
+                    KeyEvent event = {
+                        .cycle = ev.key.timestamp,  // Turned into an opcode below
+                        .key = key,
+                        .down = ev.type == SDL_KEYDOWN
+                    };
+
+                    // Queue is only full if a whole lot of keys changed within a frame,
+                    // then everything queued is applied first so events never go out of order
+                    if (vm->keyEventCount < KEY_EVENT_QUEUE_SIZE) {
+                        vm->keyEvents[vm->keyEventCount++] = event;
+                    } else {
+                        applyKeyEvents(vm);
+                        applyKeyEvent(vm->core, &event);
                     }
                 }
             }
 		}
 	}
 
+    Uint32 now = SDL_GetTicks();
+    Uint32 window = now - vm->inputWindowStart;
+    DWORD frameCycles = vm->scheduler.ips / TIMER_DECREASE_FREQUENCY;
+
+    for (BYTE i = firstEvent; i < vm->keyEventCount; i++) {
+        Uint32 timestamp = vm->keyEvents[i].cycle;
+        Uint32 elapsed = (Sint32) (timestamp - vm->inputWindowStart) < 0 ? 0 : timestamp - vm->inputWindowStart;
+
+        if (window == 0 || elapsed >= window)
+            vm->keyEvents[i].cycle = frameCycles;
+        else
+            vm->keyEvents[i].cycle = (QWORD) elapsed * frameCycles / window;
+    }
+
+    vm->inputWindowStart = now;
+
+	return VM_RESULT_SUCCESS;
+}
+
+// Applies all queued key events at once (e.g. before a debugger step)
+void applyKeyEvents(VM *vm) {
+	for (BYTE i = 0; i < vm->keyEventCount; i++)
+		applyKeyEvent(vm->core, &vm->keyEvents[i]);
+
+	vm->keyEventCount = 0;
+}
+
+/** runFrameCycles
+ *
+ * @param vm
+ *  Pointer to VM struct
+ * @param cycles
+ *  Number of opcodes in a frame
+ * @description:
+ *  Runs a frame (see runTimedCycles) stopping at every queued key event
+ *  to apply it right before the opcode it was stamped with
+ *  Frame ends early if execution stops at a breakpoint (key events
+ *  it didn't reach are applied right away)
+ *  Returns number of opcodes that were actually run (or skipped)
+ */
+DWORD runFrameCycles(VM *vm, DWORD cycles) {
+	DWORD ran = 0;
+
+	for (BYTE i = 0; i < vm->keyEventCount; i++) {
+		DWORD until = vm->keyEvents[i].cycle < cycles ? vm->keyEvents[i].cycle : cycles;
+
+		if (until > ran && !vm->breakpoints.hit)
+			ran += runTimedCycles(vm, until - ran);
+
+		applyKeyEvent(vm->core, &vm->keyEvents[i]);
+	}
+
+	vm->keyEventCount = 0;
+
+	if (ran < cycles && !vm->breakpoints.hit)
+		ran += runTimedCycles(vm, cycles - ran);
+
+	return ran;
+}
+
+/** advanceVMTime
+ *
+ * @param vm
+ *  Pointer to VM struct
+ * @param cycles
+ *  Number of opcodes that were just run (or skipped)
+ * @description:
+ *  Advances timers (see advanceTimerClock) and queues a beep transition if
+ *  sound timer has just been set or has run out, stamped with the timer tick
+ *  it happened at (the COSMAC VIP also gated it's beeper from the 60Hz timer
+ *  interrupt so a tick is as exact as it gets)
+ */
+static void advanceVMTime(VM *vm, DWORD cycles) {
+	BYTE sound = vm->core->tSound;
+	QWORD ticks = vm->timers.ticks;
+
+	advanceTimerClock(&vm->timers, vm->core, cycles);
+
+	if (vm->audio == NULL)
+		return;
+
+	if (vm->core->tSound > 0)
+		startBeep(vm->audio, vm->timers.ticks);
+	else
+		stopBeep(vm->audio, ticks + sound < vm->timers.ticks ? ticks + sound : vm->timers.ticks);
+}
+
+// Number of opcodes in a delay timer polling loop (FX07 / 3X00 / 1NNN)
+#define DELAY_LOOP_LENGTH	3
+
+/** skipDelayLoop
+ *
+ * @param vm
+ *  Pointer to VM struct with a core in CORE_WAIT_DELAY state at the start of a loop
+ * @param cycles
+ *  Maximum number of opcodes to skip
+ * @description:
+ *  Skips whole iterations of a delay timer polling loop in which FX07 still
+ *  reads non zero value leaving a core exactly as if they were run
+ *  Returns number of opcodes that were skipped
+ */
+static DWORD skipDelayLoop(VM *vm, DWORD cycles) {
+	C8core *core = vm->core;
+	TimerClock *clock = &vm->timers;
+
+	// Opcodes left until delay timer reaches zero
+	QWORD expiry = ((QWORD) core->tDelay * clock->ips - clock->accumulator
+			+ TIMER_DECREASE_FREQUENCY - 1) / TIMER_DECREASE_FREQUENCY;
+
+	// Iterations that start before that
+	QWORD iterations = (expiry + DELAY_LOOP_LENGTH - 1) / DELAY_LOOP_LENGTH;
+	if (iterations > cycles / DELAY_LOOP_LENGTH)
+		iterations = cycles / DELAY_LOOP_LENGTH;
+
+	if (iterations == 0)
+		return 0;
+
+	// Register holds whatever FX07 read during the last skipped iteration
+	QWORD lastRead = (iterations - 1) * DELAY_LOOP_LENGTH;
+	QWORD ticks = (clock->accumulator + lastRead * TIMER_DECREASE_FREQUENCY) / clock->ips;
+	BYTE x = (core->memory[core->PC] & 0x0F);
+
+	core->reg[x] = core->tDelay - ticks;
+
+	advanceVMTime(vm, iterations * DELAY_LOOP_LENGTH);
+	return iterations * DELAY_LOOP_LENGTH;
+}
+
+/** skipIdleCycles
+ *
+ * @param vm
+ *  Pointer to VM struct
+ * @param cycles
+ *  Maximum number of opcodes to skip
+ * @description:
+ *  Checks if a core is idle (see CoreWaitState) and if it is then instead of
+ *  running opcodes that would change nothing it only accounts for emulated
+ *  time they would take
+ *  Returns number of opcodes that were skipped (zero if a core isn't idle)
+ */
+DWORD skipIdleCycles(VM *vm, DWORD cycles) {
+	switch (updateWaitState(vm->core)) {
+	case CORE_WAIT_KEY:
+	case CORE_WAIT_HALT:
+		// Keypad only changes between runs (see runFrameCycles) so the whole budget can go
+		advanceVMTime(vm, cycles);
+		return cycles;
+	case CORE_WAIT_DELAY:
+		return skipDelayLoop(vm, cycles);
+	default:
+		return 0;
+	}
+}
+
+/** runTimedCycles
+ *
+ * @param vm
+ *  Pointer to VM struct
+ * @param cycles
+ *  Number of opcodes to run
+ * @description:
+ *  Runs a given number of opcodes with a VM's engine in chunks that end
+ *  exactly where timers have to tick, so that a ROM reading the delay timer
+ *  sees the same value no matter how opcodes are batched
+ *  Idle loops are skipped over at the start of every chunk (see skipIdleCycles)
+ *  While there are breakpoints or watchpoints opcodes are run by runUntilBreakpoint
+ *  instead (idle loops that have a breakpoint are run too) and it stops at the
+ *  first one that hits
+ *  Returns number of opcodes that were actually run (or skipped)
+ */
+DWORD runTimedCycles(VM *vm, DWORD cycles) {
+	BreakpointSet *breakpoints = &vm->breakpoints;
+	DWORD ran = 0;
+
+	while (ran < cycles) {
+		if (breakpoints->count == 0
+				|| !hasBreakpointInRange(breakpoints, vm->core->PC, DELAY_LOOP_LENGTH * OPCODE_SIZE))
+			ran += skipIdleCycles(vm, cycles - ran);
+		if (ran == cycles)
+			break;
+
+		DWORD chunk = cyclesUntilTimerTick(&vm->timers);
+		if (chunk > cycles - ran)
+			chunk = cycles - ran;
+
+		DWORD chunkRan = breakpoints->count != 0 || CORE_WATCHING(vm->core) ?
+				runUntilBreakpoint(vm->core, chunk, breakpoints) : vm->engine->run(vm->core, chunk);
+		advanceVMTime(vm, chunkRan);
+		ran += chunkRan;
+
+		if (chunkRan < chunk)
+			break;
+	}
+
+	return ran;
+}
+
+// Updates opcode a core is about to run (it's what debugger shows as current)
+static inline void fetchNextOpcode(C8core *core) {
+	core->opcode = GET_WORD(core->memory[core->PC], core->memory[core->PC + 1]);
+}
+
+/* Whatever DXYN and 00E0 did during a frame is published once at the end of it
+ * (or after a debugger step) and only if some rows really changed (a sprite
+ * drawn twice in a frame usually changes nothing at all), render thread
+ * presents it on it's own
+ */
+static void publishPendingFrame(VM *vm) {
+	if (CHECK_CUSTOM_FLAG(vm->core, (CUSTOM_FLAG_REDRAW_PENDING | CUSTOM_FLAG_CLEAR_SCREEN))) {
+		if (collectChangedRows(vm->core) != 0)
+			publishFrame(vm->video, vm->core->gfx);
+		UNSET_CUSTOM_FLAG(vm->core, CUSTOM_FLAG_REDRAW_PENDING | CUSTOM_FLAG_CLEAR_SCREEN);
+	}
+}
+
+/** runDebuggerCommands
+ *
+ * @param vm
+ *  Pointer to VM struct with a debugger
+ * @param held
+ *  Reference to a flag that is non zero while debugger holds execution
+ * @description:
+ *  Carries out every command debugger thread sent since the last call
+ *  and publishes a new core snapshot if there were any
+ *  Returns VM_RESULT_EVENT_QUIT if user quit from debugger
+ */
+static VM_RESULT runDebuggerCommands(VM *vm, BYTE *held) {
+	DebuggerCommand command;
+	BYTE handled = 0;
+
+	while (popDebuggerCommand(vm->dbg, &command)) {
+		switch (command.type) {
+		case DEBUGGER_COMMAND_PAUSE:
+			*held = 1;
+			break;
+		case DEBUGGER_COMMAND_RESUME:
+			// Scheduler starts over so it doesn't try to catch up with the pause
+			*held = 0;
+			vm->breakpoints.stepOver = 1;
+			resetScheduler(&vm->scheduler);
+			vm->video->stats.lastFrameStart = 0;
+			break;
+		case DEBUGGER_COMMAND_STEP:
+			if (*held) {
+				applyKeyEvents(vm);
+				vm->breakpoints.stepOver = 1;
+				runTimedCycles(vm, 1);
+				vm->breakpoints.stepOver = 0;
+				vm->breakpoints.hit = 0;
+				fetchNextOpcode(vm->core);
+				publishPendingFrame(vm);
+			}
+			break;
+		case DEBUGGER_COMMAND_QUIT:
+			return VM_RESULT_EVENT_QUIT;
+		case DEBUGGER_COMMAND_SET_BREAKPOINT:
+			setBreakpoint(&vm->breakpoints, &command.breakpoint);
+			break;
+		case DEBUGGER_COMMAND_CLEAR_BREAKPOINT:
+			clearBreakpoint(&vm->breakpoints, command.breakpoint.addr);
+			break;
+#if CORE_WATCHPOINTS
+		case DEBUGGER_COMMAND_SET_WATCHPOINT:
+			setWatchpoint(vm->core, command.addr, command.length);
+			break;
+		case DEBUGGER_COMMAND_CLEAR_WATCHPOINTS:
+			clearWatchpoints(vm->core);
+			break;
+#endif
+		}
+
+		handled = 1;
+	}
+
+	if (handled)
+		publishCoreSnapshot(vm->dbg, vm->core, &vm->breakpoints, *held);
+
 	return VM_RESULT_SUCCESS;
 }
 
@@ -420,75 +1413,177 @@ VM_RESULT pollEvents(VM *vm, VM_RESULT dbgState) {
  *  Also holds an infinite execution loop within it and
  *  invokes debugger and such
  *  Basically handles everything
+ *  Debugger runs on it's own thread: emulation publishes a core snapshot
+ *  after every frame and takes commands from it at the start of every frame
+ *  so a ROM runs at full speed with debugger open
  */
 VM_RESULT runVM(VM *vm) {
 	VM_ASSERT(vm == NULL);
 
-	Uint64 currentTicks = 0;
-	Uint64 nextTicks = 0;
-	Uint64 nextTimerTicks = 0;
+	if (vm->flags & VM_FLAG_HEADLESS)
+		return runHeadless(vm);
 
 	VM_RESULT runningState = VM_RESULT_SUCCESS;
-    VM_RESULT dbgHeld = VM_RESULT_SUCCESS;
 
-	vm->core->opcode = GET_WORD(vm->core->memory[vm->core->PC], vm->core->memory[vm->core->PC + 1]);
-	if (vm->dbg != NULL && (vm->flags & VM_FLAG_DEBUGGER)) {
-		dbgHeld = updateDebugger(vm->dbg);
-    }
+    // Debugger starts with execution held (see initDebugger)
+    BYTE held = vm->dbg != NULL;
+
+	fetchNextOpcode(vm->core);
+	if (vm->dbg != NULL)
+		publishCoreSnapshot(vm->dbg, vm->core, &vm->breakpoints, held);
 
 	while (runningState == VM_RESULT_SUCCESS) {
-		currentTicks = SDL_GetTicks64();
-
-        if (dbgHeld == VM_RESULT_SUCCESS) {
-            nextTicks = vm->core->prevCycleTicks + CORE_TICKS_PER_CYCLE;
-            nextTimerTicks = vm->core->prevTimerTicks + CORE_TICKS_PER_CYCLE;
-        } else {
-            nextTicks = vm->core->prevCycleTicks + CORE_TICKS_PER_CYCLE_DBG;
-            nextTimerTicks = currentTicks + CORE_TICKS_PER_CYCLE;
+        if (vm->dbg != NULL && runDebuggerCommands(vm, &held) == VM_RESULT_EVENT_QUIT)
+            return VM_RESULT_EVENT_QUIT;
+
+        if (held) {
+            // Nothing happens until there is an SDL event or debugger sends a command
+            // (which pushes an event too) so a paused VM takes no CPU at all
+            SDL_WaitEvent(NULL);
+            runningState = pollEvents(vm, VM_RESULT_DBG);
+            continue;
         }
 
-		if (currentTicks < nextTicks) {
-			SDL_Delay(nextTicks - currentTicks);
-		}
+        runFrameCycles(vm, nextFrameCycles(&vm->scheduler));
+        fetchNextOpcode(vm->core);
+        publishPendingFrame(vm);
+
+        // Execution stopped at a breakpoint or a watchpoint: it's held right there
+        // until debugger resumes it (snapshot of a held core wakes debugger up)
+        vm->breakpoints.stepOver = 0;
+        if (vm->breakpoints.hit) {
+            vm->breakpoints.hit = 0;
+            held = 1;
+        }
+
+        if (vm->dbg != NULL)
+            publishCoreSnapshot(vm->dbg, vm->core, &vm->breakpoints, held);
+
+        runningState = pollEvents(vm, VM_RESULT_SUCCESS);
+
+        waitForNextFrame(&vm->scheduler);
+        recordFrameStart(&vm->video->stats, SDL_GetPerformanceCounter());
+	}
+
+	return runningState;
+}
+
+// Set by SIGINT handler to stop a headless run
+static volatile sig_atomic_t g_headlessInterrupted = 0;
+
+static void handleHeadlessSigint(int sig) {
+	(void) sig;
+	g_headlessInterrupted = 1;
+}
+
+/** runHeadless
+ *
+ * @param vm
+ *  Pointer to a headless VM
+ * @description:
+ *  Runs a core with no pacing at all one frame (see FrameScheduler) after
+ *  another, timers are driven by the number of opcodes run (see TimerClock)
+ *  so a run is deterministic and doesn't depend on how fast the host is
+ *  Stops when either cycle or frame limit is reached, when a core hits
+ *  a critical error or on keyboard interrupt and then prints the final state
+ */
+VM_RESULT runHeadless(VM *vm) {
+	VM_ASSERT(vm == NULL);
 
-		vm->core->prevCycleTicks = currentTicks;
+	VM_RESULT result = VM_RESULT_SUCCESS;
+	C8core *core = vm->core;
 
-		if (currentTicks >= nextTimerTicks) {
-			vm->core->tDelay -= vm->core->tDelay > 0 ? 1 : 0;
-			vm->core->tSound -= vm->core->tSound > 0 ? 1 : 0;
-			vm->core->prevTimerTicks = currentTicks;
+	g_headlessInterrupted = 0;
+	void (*prevSigint)(int) = signal(SIGINT, handleHeadlessSigint);
+
+	while (result == VM_RESULT_SUCCESS) {
+		if (vm->frameLimit != 0 && vm->frames >= vm->frameLimit)
+			break;
+
+		DWORD frameCycles = nextFrameCycles(&vm->scheduler);
+		DWORD cycles = frameCycles;
+		if (vm->cycleLimit != 0) {
+			if (vm->cycles >= vm->cycleLimit)
+				break;
+
+			if (vm->cycleLimit - vm->cycles < cycles)
+				cycles = vm->cycleLimit - vm->cycles;
 		}
 
-        if (dbgHeld == VM_RESULT_SUCCESS) {
-            processOpcode(vm->core);
-            vm->core->opcode = GET_WORD(vm->core->memory[vm->core->PC], vm->core->memory[vm->core->PC + 1]);
-        }
+		vm->cycles += runTimedCycles(vm, cycles);
 
-		if (vm->dbg != NULL && (vm->flags & VM_FLAG_DEBUGGER)) {
-			dbgHeld = updateDebugger(vm->dbg);
-            if (dbgHeld == VM_RESULT_EVENT_QUIT)
-                return VM_RESULT_EVENT_QUIT;
-        }
+		if (cycles == frameCycles)
+			vm->frames++;
 
-        if (dbgHeld == VM_RESULT_SUCCESS) {
-            if (CHECK_CUSTOM_FLAG(vm->core, CUSTOM_FLAG_REDRAW_PENDING)) {
-                redrawScreen(vm->video, vm->core->gfx);
-                UNSET_CUSTOM_FLAG(vm->core, CUSTOM_FLAG_REDRAW_PENDING);
-            } else if (CHECK_CUSTOM_FLAG(vm->core, CUSTOM_FLAG_CLEAR_SCREEN)) {
-                clearScreen(vm->video);
-                UNSET_CUSTOM_FLAG(vm->core, CUSTOM_FLAG_CLEAR_SCREEN);
-            }
+		UNSET_CUSTOM_FLAG(core, CUSTOM_FLAG_REDRAW_PENDING | CUSTOM_FLAG_CLEAR_SCREEN);
 
-            if (vm->core->tSound > 0)
-                startBeep(vm->audio);
-            else
-                stopBeep(vm->audio);
-        }
+		if (CHECK_CUSTOM_FLAG(core, CUSTOM_FLAG_CRITICAL_ERROR))
+			result = VM_RESULT_ERROR;
+		else if (g_headlessInterrupted)
+			result = VM_RESULT_EVENT_SIGINT;
 
-        runningState = pollEvents(vm, dbgHeld);
+		// There is no input in headless mode so without limits a ROM that
+		// halted or waits for a key would otherwise run forever
+		if (vm->cycleLimit == 0 && vm->frameLimit == 0 && core->tDelay == 0 && core->tSound == 0) {
+			BYTE waitState = updateWaitState(core);
+			if (waitState == CORE_WAIT_HALT || waitState == CORE_WAIT_KEY)
+				break;
+		}
 	}
 
-	return runningState;
+	signal(SIGINT, prevSigint);
+
+	core->opcode = GET_WORD(core->memory[core->PC], core->memory[core->PC + 1]);
+	updateWaitState(core);
+	printHeadlessState(vm, stdout);
+
+	return result;
+}
+
+// Names of core wait states for printHeadlessState
+static const char *g_waitStateNames[CORE_WAIT_STATE_COUNT] = {"none", "key", "halt", "delay"};
+
+/** printHeadlessState
+ *
+ * @param vm
+ *  Pointer to a VM struct after a headless run
+ * @param out
+ *  Where to print
+ * @description:
+ *  Prints number of cycles and frames that were run, registers, timers,
+ *  stack and custom flags of a core and also the screen if VM_FLAG_PRINT_SCREEN is set
+ */
+void printHeadlessState(const VM *vm, FILE *out) {
+	const C8core *core = vm->core;
+
+	fprintf(out, "cycles: %llu\nframes: %llu\ntimer ticks: %llu\n",
+			(unsigned long long) vm->cycles,
+			(unsigned long long) vm->frames,
+			(unsigned long long) vm->timers.ticks);
+	fprintf(out, "quirks: %s\n", g_quirkProfile->name);
+	fprintf(out, "PC: 0x%03X  opcode: 0x%04X  I: 0x%03X  SP: %u\n",
+			core->PC, core->opcode, core->I, core->SP);
+
+	for (BYTE i = 0; i < GENERAL_PURPOSE_REGISTERS; i++)
+		fprintf(out, "V%X: 0x%02X%s", i, core->reg[i], (i & 7) == 7 ? "\n" : "  ");
+
+	fprintf(out, "delay: %u  sound: %u  keypad: 0x%04X  flags: 0x%02X  wait: %s\n",
+			core->tDelay, core->tSound, core->keypadState, core->customFlags,
+			core->waitState < CORE_WAIT_STATE_COUNT ? g_waitStateNames[core->waitState] : "?");
+
+	fprintf(out, "stack:");
+	for (BYTE i = 0; i < core->SP && i < STACK_SIZE; i++)
+		fprintf(out, " 0x%03X", core->stack[i]);
+	fprintf(out, "\n");
+
+	if (!(vm->flags & VM_FLAG_PRINT_SCREEN))
+		return;
+
+	for (WORD row = 0; row < SCREEN_RESOLUTION_HEIGHT; row++) {
+		for (WORD col = 0; col < SCREEN_RESOLUTION_WIDTH; col++)
+			fputc(GET_BIT_BE(core->gfx[row], col) ? '#' : '.', out);
+		fputc('\n', out);
+	}
 }
 
 /** destroyVM
@@ -508,12 +1603,15 @@ VM_RESULT destroyVM(VM **m_vm) {
 		destroyDebugger(&vm->dbg);
 	}
 
+	destroyExecEngines();
 	destroyAudioInterface(&vm->audio);
 	destroyVideoInterface(&vm->video);
 	destroyCore(&vm->core);
 
+	if (!(vm->flags & VM_FLAG_HEADLESS))
+		SDL_Quit();
+
 	free(vm);
-	SDL_Quit();
 
 	return VM_RESULT_SUCCESS;
 }
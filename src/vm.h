@@ -11,8 +11,91 @@
 #define _VM_H_
 
 #include "opcodes.h"
+#include "c8exec.h"
 #include "c8debug.h"
 
+// ============================== Frame Mailbox Definition ==============================
+
+#define FRAME_MAILBOX_SLOTS			3
+#define FRAME_MAILBOX_FRESH			(1 << 2)    // Shared slot holds a frame renderer hasn't taken yet
+#define FRAME_MAILBOX_INDEX_MASK	(FRAME_MAILBOX_FRESH - 1)
+
+// Screen of an emulated frame as it's handed over to a renderer
+typedef struct _FrameSnapshot {
+	QWORD gfx[SCREEN_RESOLUTION_HEIGHT];
+	QWORD frame;                // Sequence number of a published frame
+	Uint64 publishedAt;         // Performance counter value at the moment of publishing
+} FrameSnapshot;
+
+/* Lock-free triple buffer between the emulation thread and the render thread
+ * Emulation fills it's back slot and swaps it with the shared one, renderer
+ * swaps it's front slot with the shared one only if that one is fresh
+ * Neither side ever waits for the other one, renderer always gets the newest
+ * frame and frames it was too slow to take are simply overwritten
+ */
+typedef struct _FrameMailbox {
+	FrameSnapshot slots[FRAME_MAILBOX_SLOTS];
+	BYTE back;                  // Slot owned by emulation
+	BYTE front;                 // Slot owned by renderer
+	SDL_atomic_t shared;        // Shared slot index | FRAME_MAILBOX_FRESH
+} FrameMailbox;
+
+void initMailbox(FrameMailbox *mailbox);
+FrameSnapshot *getBackSnapshot(FrameMailbox *mailbox);
+void publishSnapshot(FrameMailbox *mailbox);
+BYTE hasFreshSnapshot(FrameMailbox *mailbox);
+const FrameSnapshot *takeSnapshot(FrameMailbox *mailbox);
+
+/* Frame timing statistics (all times are in performance counter ticks)
+ * Emulation fields are written only by the emulation thread and render
+ * fields only by the render thread so they are read after it's stopped
+ */
+typedef struct _FrameStats {
+	Uint64 frequency;           // Performance counter frequency
+
+    // Emulation thread
+	QWORD frames;               // Emulated frames
+	QWORD published;            // Frames published to a renderer
+	Uint64 lastFrameStart;      // When the previous frame started
+	Uint64 jitterSum;           // Sum of deviations of frame lengths from 1/60 of a second
+	Uint64 jitterMax;           // The largest such deviation
+
+    // Render thread
+	QWORD taken;                // Frames taken from the mailbox
+	QWORD presented;            // Frames presented (taken frames with no changes aren't)
+	Uint64 presentSum;          // Total time spent in redrawScreen
+	Uint64 presentMax;          // The longest redrawScreen
+	Uint64 latencySum;          // Total time from publishing a frame to presenting it
+	Uint64 latencyMax;          // The longest such time
+} FrameStats;
+
+void recordFrameStart(FrameStats *stats, Uint64 now);
+void printFrameStats(const FrameStats *stats, FILE *out);
+
+// ============================ Phosphor Persistence Definition ============================
+
+// Intensities are 0.8 fixed point numbers (PHOSPHOR_FULL is a lit pixel)
+#define PHOSPHOR_FULL				0xFF
+#define PHOSPHOR_DECAY				0xA0    // Fraction of intensity a pixel keeps after 1/60 of a second
+#define PHOSPHOR_MAX_STEPS			16      // Any intensity decays to 0 in that many steps
+
+/* Pixels that are turned off keep glowing for a few frames like on a CRT
+ * so sprites a ROM erases and redraws with XOR don't flicker
+ * Only pixels that are still fading are decayed, so once a screen settles
+ * it costs nothing and a frame costs as much as the pixels that changed
+ */
+typedef struct _Phosphor {
+	BYTE intensity[SCREEN_TOTAL_PIXELS];        // Lit pixels are PHOSPHOR_FULL, fading pixels less, others 0
+	QWORD fading[SCREEN_RESOLUTION_HEIGHT];     // Pixels that are off but still glow
+	DWORD fadingRows;           // Bitmap of rows with fading pixels
+	Uint64 decayInterval;       // Performance counter ticks between decay steps
+	Uint64 nextDecay;           // Performance counter value when the next decay step is due
+} Phosphor;
+
+void initPhosphor(Phosphor *phosphor, Uint64 frequency);
+void updatePhosphor(Phosphor *phosphor, const QWORD *shown, const QWORD *screen, DWORD rows, Uint64 now);
+DWORD decayPhosphor(Phosphor *phosphor, Uint64 now);
+
 // ============================= Video Interface Definition =============================
 
 #define VIDEO_DEFAULT_RESOLUTION_WIDTH		(SCREEN_RESOLUTION_WIDTH * 16)
@@ -22,31 +105,63 @@
 #define VIDEO_DEFAULT_RENDER_INDEX			-1
 #define VIDEO_DEFAULT_RENDER_FLAGS			0
 
+// Refresh rate assumed when a display doesn't report one
+#define VIDEO_DEFAULT_REFRESH_RATE			TIMER_DECREASE_FREQUENCY
+
 #define VIDEO_BLACK_PIXEL_RGBO				0x00, 0x00, 0x00, 0xFF
 #define VIDEO_WHITE_PIXEL_RGBO				0xFF, 0xFF, 0xFF, 0xFF
 
-#define GET_NEXT_PIXEL(pxl, xc, yc, width, height) \
-	pxl.x = xc; \
-	pxl.y = yc; \
-	pxl.w = width; \
-	pxl.h = height;
+// Same colors as pixels of VIDEO_PIXEL_FORMAT
+#define VIDEO_PIXEL_FORMAT					SDL_PIXELFORMAT_RGBA8888
+#define VIDEO_BLACK_PIXEL					0x000000FF
+#define VIDEO_WHITE_PIXEL					0xFFFFFFFF
+
+// Number of bytes in a single row of VideoInterface pixels
+#define VIDEO_PITCH							(SCREEN_RESOLUTION_WIDTH * sizeof(DWORD))
 
+/* Window is created and it's events are handled by the main thread while
+ * renderer and texture are created and used only by the render thread
+ * Emulation publishes frames through the mailbox and never waits for a present
+ * Render thread sleeps until a frame is published (or a fading pixel has to be
+ * decayed) so it takes no CPU while nothing is drawn
+ */
 typedef struct _VideoInterface {
 	SDL_Window *window;
-	SDL_Renderer *renderer;
+	SDL_Renderer *renderer;     // Render thread only
+	SDL_Texture *texture;       // 64x32 streaming texture that's scaled to the window (render thread only)
 	WORD resolutionWidth;
 	WORD resolutionHeight;
 	BYTE isFullScreen;
 	DWORD windowFlags;
-	BYTE pixelWidth;
-	BYTE pixelHeight;
 	const char *windowTitle;
+
+    BYTE vsync;                 // Presents wait for display's vertical blank
+    BYTE printStats;            // Frame stats are printed when interface is destroyed
+    BYTE persistence;           // Pixels are drawn from phosphor intensities instead of screen bits
+    int refreshRate;            // Refresh rate of a display the window is on
+    QWORD presentInterval;      // Minimum time between presents (0 if every frame can be presented)
+    QWORD nextPresent;          // Performance counter value when the next present is due
+
+    SDL_Thread *renderThread;
+    SDL_sem *frameSignal;       // Posted after every published frame
+    SDL_sem *renderStarted;     // Posted once render thread has set up (or failed to set up) renderer
+    SDL_atomic_t renderState;   // VM_RESULT of render thread setup
+    SDL_atomic_t quit;          // Non zero when render thread has to stop
+
+    FrameMailbox mailbox;
+    FrameStats stats;
+    Phosphor phosphor;          // Render thread only
+
+    // Picture in VIDEO_PIXEL_FORMAT, only changed rows are expanded into it
+    // and then uploaded into the texture
+	DWORD pixels[SCREEN_TOTAL_PIXELS];
 } VideoInterface;
 
-VM_RESULT initVideoInterface(VideoInterface **m_interface);
+VM_RESULT initVideoInterface(VideoInterface **m_interface, BYTE vsync, BYTE printStats, BYTE persistence);
+BYTE isPresentDue(VideoInterface *interface);
 VM_RESULT clearScreen(VideoInterface *interface);
-VM_RESULT redrawPixel(VideoInterface *interface, QWORD *screen, WORD row, WORD col);
-VM_RESULT redrawScreen(VideoInterface *interface, QWORD *screen);
+VM_RESULT redrawScreen(VideoInterface *interface, const QWORD *screen, DWORD rows);
+void publishFrame(VideoInterface *interface, const QWORD *screen);
 VM_RESULT destroyVideoInterface(VideoInterface **m_interface);
 
 // ============================= Audio Interface Definition =============================
@@ -54,43 +169,170 @@ VM_RESULT destroyVideoInterface(VideoInterface **m_interface);
 #define AUDIO_SAMPLES_PER_SECOND		44100
 #define AUDIO_FORMAT_DEFAULT			AUDIO_S16SYS
 #define AUDIO_CHANNELS					1
-#define AUDIO_BUFFER_SIZE				1024
+#define AUDIO_BUFFER_SIZE				256     // Device runs all the time so it's kept short for latency
 #define AUDIO_BYTES_PER_SAMPLE			sizeof(Uint16) * 2
 
-#define DEFAULT_SQWAVE_TONE				1101.0f
-#define DEFAULT_SQWAVE_VOLUME			3000
-#define DEFAULT_SQWAVE_PERMUTATIONS		300
+// Beep tone in Hz and volume in percent of the full scale
+// (defaults sound the same as the old additive square wave did)
+#define AUDIO_DEFAULT_TONE				175
+#define AUDIO_MIN_TONE					20
+#define AUDIO_MAX_TONE					10000
+#define AUDIO_DEFAULT_VOLUME			8
+#define AUDIO_MAX_VOLUME				100
+
+// One period of a wave, indexed by the top bits of an oscillator phase
+#define AUDIO_WAVETABLE_BITS			11
+#define AUDIO_WAVETABLE_SIZE			(1 << AUDIO_WAVETABLE_BITS)
+#define AUDIO_WAVETABLE_SHIFT			(32 - AUDIO_WAVETABLE_BITS)
 
 #define AUDIO_STATE_PLAYING				0
 #define AUDIO_STATE_PAUSED				1
 
-typedef Sint16 (*WAVE_FUNCTION)(float, Uint16, Uint16, double);
+// Beep transitions are played that many frames later than the emulated time
+// they happened at (a frame is emulated in a burst at it's start so transitions
+// come up to a frame early), a transition that would be late or further ahead
+// than AUDIO_MAX_EVENT_LEAD frames resynchronizes audio with emulated time
+#define AUDIO_EVENT_LATENCY				1
+#define AUDIO_MAX_EVENT_LEAD			(AUDIO_EVENT_LATENCY + SCHEDULER_MAX_LAG_FRAMES)
 
+// Must be a power of 2, a transition can't happen more often than once a timer tick
+#define SOUND_QUEUE_SIZE				64
+
+// Sound timer turning beep on or off at a given moment of emulated time
+typedef struct _SoundEvent {
+	QWORD tick;                 // Timer tick the transition happened at (see TimerClock)
+	BYTE on;                    // Non zero if beep starts
+} SoundEvent;
+
+/* Lock-free single producer single consumer queue of sound timer transitions
+ * Emulation thread pushes and audio callback pops, neither ever waits
+ * (head and tail only grow, indices are taken modulo SOUND_QUEUE_SIZE)
+ */
+typedef struct _SoundQueue {
+	SoundEvent events[SOUND_QUEUE_SIZE];
+	SDL_atomic_t head;          // Next event to pop (written by consumer)
+	SDL_atomic_t tail;          // Next free slot (written by producer)
+} SoundQueue;
+
+void initSoundQueue(SoundQueue *queue);
+BYTE pushSoundEvent(SoundQueue *queue, QWORD tick, BYTE on);
+const SoundEvent *peekSoundEvent(SoundQueue *queue);
+void popSoundEvent(SoundQueue *queue);
+
+// Phase accumulator that walks over a wavetable
+typedef struct _Oscillator {
+	DWORD phase;                // Position within a period (0.32 fixed point)
+	DWORD phaseStep;            // Phase increment per sample (tone / sample rate as 0.32 fixed point)
+	const Sint16 *wavetable;    // One period of a wave already scaled to volume
+} Oscillator;
+
+// Returns the next sample of an oscillator and advances it
+typedef Sint16 (*WAVE_FUNCTION)(Oscillator*);
+
+// Everything the audio callback owns (queue is shared with emulation)
 typedef struct _AudioCallbackData {
-	int currentSample;
+	Oscillator oscillator;
 	WAVE_FUNCTION getWaveSample;
+	SoundQueue queue;
+
+	BYTE gate;                  // Beep is on
+	int sampleRate;             // Sample rate of the device
+	QWORD position;             // Samples produced so far
+	BYTE anchored;              // Emulated time is mapped to samples
+	QWORD anchorSample;         // Sample that anchorTick is played at
+	QWORD anchorTick;
 } AudioCallbackData;
 
 typedef struct _AudioInterface {
 	SDL_AudioSpec specWant;
 	SDL_AudioSpec specHave;
 	AudioCallbackData cbData;
-	BYTE state;
+	BYTE state;                 // Beep state as emulation last pushed it
     SDL_AudioDeviceID deviceId;
+
+    WORD tone;                  // Beep tone in Hz
+    BYTE volume;                // Beep volume in percent
+    Sint16 wavetable[AUDIO_WAVETABLE_SIZE];
 } AudioInterface;
 
-VM_RESULT initAudioInterface(AudioInterface **m_interface);
+VM_RESULT initAudioInterface(AudioInterface **m_interface, WORD tone, BYTE volume);
+void buildSquareWavetable(Sint16 *wavetable, WORD tone, int sampleRate, Sint16 amplitude);
+Sint16 getWavetableSample(Oscillator *oscillator);
 void processAudioCallback(void *userData, Uint8 *bytestream, int bytes);
-Sint16 getSquareWave(float tone, Uint16 volume, Uint16 permutations, double time);
 VM_RESULT destroyAudioInterface(AudioInterface **m_interface);
-void startBeep(AudioInterface *interface);
-void stopBeep(AudioInterface *interface);
+void startBeep(AudioInterface *interface, QWORD tick);
+void stopBeep(AudioInterface *interface, QWORD tick);
+
+// ============================== Frame Scheduler Definition ==============================
+
+// Range of instructions per second that can be set from command line
+#define SCHEDULER_MIN_IPS			1
+#define SCHEDULER_MAX_IPS			100000000
+
+// If emulation falls behind by that many frames scheduler stops trying to catch up
+#define SCHEDULER_MAX_LAG_FRAMES	4
+
+/* Runs emulation in frames, TIMER_DECREASE_FREQUENCY frames per second
+ * Each frame is a batch of ips / TIMER_DECREASE_FREQUENCY opcodes and the remainder
+ * of that division is carried over to next frames so that any ips is run exactly
+ *
+ * Frame deadlines are computed from the start of a schedule and a frame number
+ * rather than by adding up frame lengths so rounding errors never accumulate
+ */
+typedef struct _FrameScheduler {
+	DWORD ips;                  // Instructions per second
+	DWORD cycleRemainder;       // Carried over fraction of a cycle (in 1/TIMER_DECREASE_FREQUENCY)
+	Uint64 frequency;           // Performance counter frequency
+	Uint64 start;               // Performance counter value when schedule started (0 if not started)
+	QWORD frame;                // Number of frames since schedule started
+} FrameScheduler;
+
+void initScheduler(FrameScheduler *scheduler, DWORD ips);
+DWORD nextFrameCycles(FrameScheduler *scheduler);
+void waitForNextFrame(FrameScheduler *scheduler);
+void resetScheduler(FrameScheduler *scheduler);
+
+// ================================= Timer Clock Definition =================================
+
+/* Decreases delay and sound timers at exactly TIMER_DECREASE_FREQUENCY per second
+ * of emulated time i.e. once per every ips / TIMER_DECREASE_FREQUENCY opcodes run
+ * Time is counted in opcodes and not taken from a host clock so timers run at the
+ * same pace relative to a ROM no matter how the host schedules emulation (frame
+ * batches, debugger steps, headless runs at full speed)
+ */
+typedef struct _TimerClock {
+	DWORD ips;                  // Instructions per second
+	DWORD accumulator;          // Opcodes run since the last tick (in 1/TIMER_DECREASE_FREQUENCY)
+	QWORD ticks;                // Total number of timer ticks so far
+} TimerClock;
+
+void initTimerClock(TimerClock *clock, DWORD ips);
+DWORD cyclesUntilTimerTick(const TimerClock *clock);
+void advanceTimerClock(TimerClock *clock, C8core *core, DWORD cycles);
 
 // =================================== VM Definition ===================================
 
-// XXX: This is the only flag I need currently
-//      Maybe in the future I will need more flags (which is honestly unlikely)
-#define VM_FLAG_DEBUGGER    1 << 0
+#define VM_FLAG_DEBUGGER        (1 << 0)
+#define VM_FLAG_HEADLESS        (1 << 1)  // No video, audio or debugger, runs as fast as possible
+#define VM_FLAG_PRINT_SCREEN    (1 << 2)  // Print the screen after a headless run
+#define VM_FLAG_VSYNC           (1 << 3)  // Sync presents to display's vertical blank
+#define VM_FLAG_FRAME_STATS     (1 << 4)  // Print frame timing stats on exit
+#define VM_FLAG_PERSISTENCE     (1 << 5)  // Fade pixels out instead of turning them off at once
+
+// Options that VM is initialized with (filled from command line arguments)
+typedef struct _VMConfig {
+    BYTE flags;                 // VM_FLAG_* flags
+    const ExecEngine *engine;   // Execution engine to run opcodes with
+    const BYTE *ROMImage;       // ROM image to run instead of a ROM file (or NULL)
+    WORD ROMImageSize;          // Size of ROMImage in bytes
+    QWORD cycleLimit;           // Headless run stops after that many opcodes (0 for no limit)
+    QWORD frameLimit;           // Headless run stops after that many frames (0 for no limit)
+    DWORD ips;                  // Instructions per second (0 for CPU_INSTRUCTIONS_PER_SECOND)
+    const QuirkProfile *quirks; // Quirk profile to run opcodes with (NULL for the default one)
+    WORD tone;                  // Beep tone in Hz (0 for AUDIO_DEFAULT_TONE)
+    BYTE volume;                // Beep volume in percent
+    BYTE debugRate;             // Debugger refresh rate in Hz (0 for DEBUGGER_DEFAULT_REFRESH_RATE)
+} VMConfig;
 
 typedef struct _VM {
 	AudioInterface *audio;
@@ -98,12 +340,34 @@ typedef struct _VM {
 	C8core *core;
 	Debugger *dbg;
 
+    const ExecEngine *engine;
+    FrameScheduler scheduler;
+    TimerClock timers;
+    BreakpointSet breakpoints;  // Set from debugger (see runTimedCycles)
+
     BYTE flags;
+
+    QWORD cycleLimit;
+    QWORD frameLimit;
+    QWORD cycles;       // Opcodes run so far (headless only)
+    QWORD frames;       // Frames run so far (headless only)
+
+    // Key events polled during a frame are applied during the next one
+    // at the same point of it as they happened at (see pollEvents)
+    KeyEvent keyEvents[KEY_EVENT_QUEUE_SIZE];
+    BYTE keyEventCount;
+    Uint32 inputWindowStart;    // SDL ticks when events were polled last
 } VM;
 
-VM_RESULT initVM(VM **m_vm, char *ROMFileName, BYTE flags);
+VM_RESULT initVM(VM **m_vm, char *ROMFileName, const VMConfig *config);
 VM_RESULT pollEvents(VM *vm, VM_RESULT dbgState);
+void applyKeyEvents(VM *vm);
+DWORD runFrameCycles(VM *vm, DWORD cycles);
+DWORD skipIdleCycles(VM *vm, DWORD cycles);
+DWORD runTimedCycles(VM *vm, DWORD cycles);
 VM_RESULT runVM(VM *vm);
+VM_RESULT runHeadless(VM *vm);
+void printHeadlessState(const VM *vm, FILE *out);
 VM_RESULT destroyVM(VM **m_vm);
 
 #endif  /* _VM_H_ */